@@ -0,0 +1,288 @@
+#include "annotation_binary.h"
+#include "utils.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+	const char MAGIC[4] = {'P', 'D', 'R', 'B'};
+	
+	uint64_t align8(uint64_t n)
+	{
+		return (n + 7) & ~uint64_t(7);
+	}
+	
+	bool inRange(uint64_t offset, uint64_t length, uint64_t limit)
+	{
+		return offset <= limit && length <= limit - offset;
+	}
+}
+
+AnnotationBinary::AnnotationBinary()
+	: data_(NULL)
+	, length_(0)
+	, header_(NULL)
+	, images_(NULL)
+	, polygons_(NULL)
+	, vertices_(NULL)
+	, strings_(NULL)
+{
+}
+
+AnnotationBinary::~AnnotationBinary()
+{
+	this->close();
+}
+
+void AnnotationBinary::close()
+{
+	if (data_ != NULL) {
+		munmap(const_cast<char*>(data_), length_);
+	}
+	data_ = NULL;
+	length_ = 0;
+	header_ = NULL;
+	images_ = NULL;
+	polygons_ = NULL;
+	vertices_ = NULL;
+	strings_ = NULL;
+}
+
+bool AnnotationBinary::open(const std::string &filename)
+{
+	this->close();
+	
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+		::close(fd);
+		return false;
+	}
+	
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) return false;
+	
+	data_ = static_cast<const char*>(addr);
+	length_ = st.st_size;
+	header_ = reinterpret_cast<const Header*>(data_);
+	
+	// Validate every section and record once so lookups can trust the file
+	const Header &h = *header_;
+	bool ok = memcmp(h.magic, MAGIC, 4) == 0 && h.version == VERSION && h.file_size == length_;
+	ok = ok && inRange(h.images_offset, uint64_t(h.n_images) * sizeof(ImageRecord), length_);
+	ok = ok && inRange(h.polygons_offset, uint64_t(h.n_polygons) * sizeof(PolygonRecord), length_);
+	ok = ok && h.n_vertices <= length_ && inRange(h.vertices_offset, h.n_vertices * 2 * sizeof(float), length_);
+	ok = ok && inRange(h.strings_offset, h.string_bytes, length_);
+	ok = ok && (h.images_offset % 8) == 0 && (h.polygons_offset % 8) == 0 && (h.vertices_offset % 8) == 0;
+	if (!ok) {
+		std::cout << utils::getBashColorText("[Error] Invalid binary annotation file: " + filename, 'r', 'b') << std::endl;
+		this->close();
+		return false;
+	}
+	
+	images_ = reinterpret_cast<const ImageRecord*>(data_ + h.images_offset);
+	polygons_ = reinterpret_cast<const PolygonRecord*>(data_ + h.polygons_offset);
+	vertices_ = reinterpret_cast<const float*>(data_ + h.vertices_offset);
+	strings_ = data_ + h.strings_offset;
+	
+	for (uint32_t i=0; i<h.n_images && ok; i++) {
+		const ImageRecord &image = images_[i];
+		ok = inRange(image.name_offset, image.name_length, h.string_bytes);
+		ok = ok && inRange(image.first_polygon, image.polygon_count, h.n_polygons);
+		if (ok && i > 0) {
+			ok = this->imageName(i - 1) < this->imageName(i);
+		}
+	}
+	for (uint32_t i=0; i<h.n_polygons && ok; i++) {
+		const PolygonRecord &polygon = polygons_[i];
+		ok = inRange(polygon.id_offset, polygon.id_length, h.string_bytes);
+		ok = ok && inRange(polygon.first_vertex, polygon.vertex_count, h.n_vertices);
+	}
+	if (!ok) {
+		std::cout << utils::getBashColorText("[Error] Corrupted records in " + filename, 'r', 'b') << std::endl;
+		this->close();
+		return false;
+	}
+	return true;
+}
+
+boost::string_ref AnnotationBinary::stringAt(uint32_t offset, uint32_t length)
+{
+	return boost::string_ref(strings_ + offset, length);
+}
+
+boost::string_ref AnnotationBinary::imageName(size_t index)
+{
+	const ImageRecord &image = images_[index];
+	return this->stringAt(image.name_offset, image.name_length);
+}
+
+cv::Size AnnotationBinary::imageSize(size_t index)
+{
+	return cv::Size(images_[index].width, images_[index].height);
+}
+
+int AnnotationBinary::find(const std::string &name)
+{
+	size_t lo = 0, hi = this->size();
+	boost::string_ref key(name);
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (this->imageName(mid) < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < this->size() && this->imageName(lo) == key) {
+		return int(lo);
+	}
+	return -1;
+}
+
+void AnnotationBinary::loadIds(size_t index, std::vector<std::string> &ids)
+{
+	ids.clear();
+	if (index >= this->size()) return;
+	
+	// Only the strings, for indexing images whose drawers are not built yet
+	const ImageRecord &image = images_[index];
+	const PolygonRecord *first = polygons_ + image.first_polygon;
+	ids.reserve(image.polygon_count);
+	for (uint32_t i=0; i<image.polygon_count; i++) {
+		ids.push_back(this->stringAt(first[i].id_offset, first[i].id_length).to_string());
+	}
+}
+
+bool AnnotationBinary::loadDrawer(size_t index, MyPolygonDrawer &drawer)
+{
+	if (index >= this->size()) return false;
+	
+	const ImageRecord &image = images_[index];
+	const PolygonRecord *first = polygons_ + image.first_polygon;
+	
+	size_t n_vertices = 0;
+	for (uint32_t i=0; i<image.polygon_count; i++) {
+		n_vertices += first[i].vertex_count;
+	}
+	
+	drawer.setImageSize(this->imageSize(index));
+	drawer.reserve(image.polygon_count, n_vertices);
+	for (uint32_t i=0; i<image.polygon_count; i++) {
+		const PolygonRecord &polygon = first[i];
+		const cv::Point2f *points = reinterpret_cast<const cv::Point2f*>(vertices_ + 2 * polygon.first_vertex);
+		drawer.addRegion(this->stringAt(polygon.id_offset, polygon.id_length).to_string(), points, polygon.vertex_count);
+	}
+	drawer.clearModified();
+	return true;
+}
+
+int AnnotationBinary::loadAll(DrawerMap &drawers, bool overwrite)
+{
+	int count = 0;
+	for (size_t i=0; i<this->size(); i++) {
+		std::string name = this->imageName(i).to_string();
+		if (!overwrite && drawers.count(name) > 0) continue;
+		
+		MyPolygonDrawer drawer;
+		if (this->loadDrawer(i, drawer)) {
+			drawers[name] = drawer;
+			count++;
+		}
+	}
+	return count;
+}
+
+bool AnnotationBinary::save(const std::string &filename, DrawerMap &drawers)
+{
+	// Size every section first so the buffer is allocated once
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, 4);
+	header.version = VERSION;
+	header.n_images = uint32_t(drawers.size());
+	
+	DrawerMap::iterator it;
+	for (it = drawers.begin(); it != drawers.end(); it++) {
+		const PolygonStore &polygons = it->second.getPolygons();
+		header.n_polygons += uint32_t(polygons.size());
+		header.n_vertices += polygons.vertexCount();
+		header.string_bytes += it->first.size();
+		for (PolygonStore::const_iterator p = polygons.begin(); p != polygons.end(); ++p) {
+			header.string_bytes += (*p).idRef().size();
+		}
+	}
+	
+	header.images_offset = align8(sizeof(Header));
+	header.polygons_offset = align8(header.images_offset + uint64_t(header.n_images) * sizeof(ImageRecord));
+	header.vertices_offset = align8(header.polygons_offset + uint64_t(header.n_polygons) * sizeof(PolygonRecord));
+	header.strings_offset = header.vertices_offset + header.n_vertices * 2 * sizeof(float);
+	header.file_size = header.strings_offset + header.string_bytes;
+	
+	std::string buffer(header.file_size, '\0');
+	char *out = &buffer[0];
+	memcpy(out, &header, sizeof(header));
+	
+	ImageRecord *images = reinterpret_cast<ImageRecord*>(out + header.images_offset);
+	PolygonRecord *records = reinterpret_cast<PolygonRecord*>(out + header.polygons_offset);
+	float *vertices = reinterpret_cast<float*>(out + header.vertices_offset);
+	char *strings = out + header.strings_offset;
+	
+	uint32_t n_polygons = 0;
+	uint64_t n_vertices = 0;
+	uint32_t n_chars = 0;
+	for (it = drawers.begin(); it != drawers.end(); it++, images++) {
+		const PolygonStore &polygons = it->second.getPolygons();
+		cv::Size size = it->second.getImageSize();
+		
+		images->name_offset = n_chars;
+		images->name_length = uint32_t(it->first.size());
+		memcpy(strings + n_chars, it->first.data(), it->first.size());
+		n_chars += images->name_length;
+		images->width = size.width;
+		images->height = size.height;
+		images->first_polygon = n_polygons;
+		images->polygon_count = uint32_t(polygons.size());
+		
+		for (PolygonStore::const_iterator p = polygons.begin(); p != polygons.end(); ++p) {
+			PolygonStore::View polygon = *p;
+			PolygonRecord &record = records[n_polygons++];
+			boost::string_ref id = polygon.idRef();
+			record.id_offset = n_chars;
+			record.id_length = uint32_t(id.size());
+			memcpy(strings + n_chars, id.data(), id.size());
+			n_chars += record.id_length;
+			record.vertex_count = uint32_t(polygon.size());
+			record.first_vertex = n_vertices;
+			for (size_t k=0; k<polygon.size(); k++) {
+				vertices[2 * n_vertices] = polygon[k].x;
+				vertices[2 * n_vertices + 1] = polygon[k].y;
+				n_vertices++;
+			}
+		}
+	}
+	return utils::writeFileAtomic(filename, buffer);
+}
+
+bool AnnotationBinary::yamlToBinary(const std::string &yaml_file, const std::string &binary_file)
+{
+	DrawerMap drawers;
+	if (!annotation_io::loadYaml(yaml_file, drawers)) return false;
+	return save(binary_file, drawers);
+}
+
+bool AnnotationBinary::binaryToYaml(const std::string &binary_file, const std::string &yaml_file, const std::string &appname)
+{
+	AnnotationBinary binary;
+	if (!binary.open(binary_file)) return false;
+	
+	DrawerMap drawers;
+	binary.loadAll(drawers);
+	return annotation_io::saveYaml(yaml_file, appname, drawers);
+}
@@ -0,0 +1,86 @@
+#ifndef ANNOTATION_BINARY_H
+#define ANNOTATION_BINARY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/utility/string_ref.hpp>
+#include "polygon_drawer/annotation_io.h"
+
+// Memory-mappable annotation file (polygon_drawer.bin). Layout, all
+// sections 8-byte aligned and little-endian:
+//   Header | ImageRecord[n_images] | PolygonRecord[n_polygons]
+//   | float[2 * n_vertices] | char strings[string_bytes]
+// Images are sorted by name, polygons by id inside each image, which is
+// the order of DrawerMap and PolygonStore.
+class AnnotationBinary {
+public:
+	static const uint32_t VERSION = 1;
+	
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t n_images;
+		uint32_t n_polygons;
+		uint64_t n_vertices;
+		uint64_t string_bytes;
+		uint64_t images_offset;
+		uint64_t polygons_offset;
+		uint64_t vertices_offset;
+		uint64_t strings_offset;
+		uint64_t file_size;
+	};
+	
+	struct ImageRecord {
+		uint32_t name_offset;
+		uint32_t name_length;
+		int32_t width;
+		int32_t height;
+		uint32_t first_polygon;
+		uint32_t polygon_count;
+	};
+	
+	struct PolygonRecord {
+		uint32_t id_offset;
+		uint32_t id_length;
+		uint32_t vertex_count;
+		uint32_t reserved;
+		uint64_t first_vertex;
+	};
+	
+	AnnotationBinary();
+	~AnnotationBinary();
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() { return data_ != NULL; }
+	
+	size_t size() { return header_ ? header_->n_images : 0; }
+	int find(const std::string &name);
+	boost::string_ref imageName(size_t index);
+	cv::Size imageSize(size_t index);
+	void loadIds(size_t index, std::vector<std::string> &ids);
+	bool loadDrawer(size_t index, MyPolygonDrawer &drawer);
+	int loadAll(DrawerMap &drawers, bool overwrite = false);
+	
+	static bool save(const std::string &filename, DrawerMap &drawers);
+	static bool yamlToBinary(const std::string &yaml_file, const std::string &binary_file);
+	static bool binaryToYaml(const std::string &binary_file, const std::string &yaml_file, const std::string &appname);
+
+private:
+	// Owns the mapping, copies would unmap it twice
+	AnnotationBinary(const AnnotationBinary&);
+	AnnotationBinary& operator=(const AnnotationBinary&);
+	
+	boost::string_ref stringAt(uint32_t offset, uint32_t length);
+	
+	const char *data_;
+	size_t length_;
+	const Header *header_;
+	const ImageRecord *images_;
+	const PolygonRecord *polygons_;
+	const float *vertices_;
+	const char *strings_;
+};
+
+#endif
@@ -0,0 +1,420 @@
+#include "annotation_diff.h"
+#include "geometry.h"
+#include "utils.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+namespace {
+	// Stored sizes of 0 x 0 still compare the normalized shapes, on this grid
+	const int FALLBACK_SIZE = 1024;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	// The popcount loop is the hot spot; the clone for CPUs with POPCNT is picked at load time
+	#define DIFF_POPCOUNT_CLONES __attribute__((target_clones("popcnt", "default")))
+#else
+	#define DIFF_POPCOUNT_CLONES
+#endif
+	
+	DIFF_POPCOUNT_CLONES
+	void countBits(const uint64_t *a, const uint64_t *b, size_t n, uint64_t &intersection, uint64_t &total)
+	{
+		uint64_t both = 0, any = 0;
+		for (size_t i=0; i<n; i++) {
+			both += __builtin_popcountll(a[i] & b[i]);
+			any += __builtin_popcountll(a[i] | b[i]);
+		}
+		intersection = both;
+		total = any;
+	}
+	
+	// Pixel rectangle covering a polygon, clipped to the image
+	cv::Rect pixelBounds(const PolygonStore::View &polygon, cv::Size size)
+	{
+		if (polygon.size() < 3) return cv::Rect();
+		cv::Rect_<float> b = geometry::bounds(polygon.points(), polygon.size());
+		int x0 = int(std::floor(b.x * size.width)), x1 = int(std::ceil((b.x + b.width) * size.width)) + 1;
+		int y0 = int(std::floor(b.y * size.height)), y1 = int(std::ceil((b.y + b.height) * size.height)) + 1;
+		return cv::Rect(x0, y0, x1 - x0, y1 - y0) & cv::Rect(0, 0, size.width, size.height);
+	}
+	
+	// Rows of 64-bit words over a window of the image. Polygons are filled with the
+	// even-odd rule from an edge list sorted by first row, so a row only visits the
+	// edges that cross it; a pixel is set when its center lies inside
+	class BitMask {
+	public:
+		BitMask(cv::Rect window)
+			: window_(window), words_((window.width + 63) / 64), bits_(size_t(words_) * window.height, 0) {}
+		
+		void fill(const PolygonStore::View &polygon, cv::Size size);
+		const uint64_t* data() const { return bits_.data(); }
+		size_t words() const { return bits_.size(); }
+	
+	private:
+		struct Edge {
+			int first_row;
+			int end_row;
+			double x;       // at the center of first_row
+			double slope;   // dx per row
+			bool operator<(const Edge &other) const { return first_row < other.first_row; }
+		};
+		
+		void setSpan(int y, int x0, int x1);
+		
+		cv::Rect window_;
+		int words_;
+		std::vector<uint64_t> bits_;
+		std::vector<Edge> edges_;
+		std::vector<Edge> active_;
+		std::vector<double> crossings_;
+	};
+	
+	void BitMask::fill(const PolygonStore::View &polygon, cv::Size size)
+	{
+		size_t n = polygon.size();
+		if (n < 3 || window_.area() <= 0) return;
+		
+		const cv::Point2f *points = polygon.points();
+		edges_.clear();
+		for (size_t i=0, j=n-1; i<n; j=i++) {
+			double xa = points[j].x * size.width, ya = points[j].y * size.height;
+			double xb = points[i].x * size.width, yb = points[i].y * size.height;
+			if (ya > yb) {
+				std::swap(xa, xb);
+				std::swap(ya, yb);
+			}
+			// Rows whose center is in [ya, yb), horizontal edges cover none
+			Edge edge;
+			edge.first_row = std::max(int(std::ceil(ya - 0.5)), window_.y);
+			edge.end_row = std::min(int(std::ceil(yb - 0.5)), window_.y + window_.height);
+			if (edge.first_row >= edge.end_row) continue;
+			edge.slope = (xb - xa) / (yb - ya);
+			edge.x = xa + (edge.first_row + 0.5 - ya) * edge.slope;
+			edges_.push_back(edge);
+		}
+		if (edges_.empty()) return;
+		std::sort(edges_.begin(), edges_.end());
+		
+		active_.clear();
+		size_t next = 0;
+		for (int y=edges_[0].first_row; y<window_.y + window_.height; y++) {
+			while (next < edges_.size() && edges_[next].first_row == y) {
+				active_.push_back(edges_[next++]);
+			}
+			if (active_.empty() && next == edges_.size()) break;
+			
+			crossings_.clear();
+			size_t kept = 0;
+			for (size_t k=0; k<active_.size(); k++) {
+				if (active_[k].end_row <= y) continue;
+				crossings_.push_back(active_[k].x);
+				active_[k].x += active_[k].slope;
+				active_[kept++] = active_[k];
+			}
+			active_.resize(kept);
+			std::sort(crossings_.begin(), crossings_.end());
+			for (size_t k=0; k+1<crossings_.size(); k+=2) {
+				this->setSpan(y, int(std::ceil(crossings_[k] - 0.5)), int(std::ceil(crossings_[k + 1] - 0.5)));
+			}
+		}
+	}
+	
+	void BitMask::setSpan(int y, int x0, int x1)
+	{
+		x0 = std::max(x0, window_.x) - window_.x;
+		x1 = std::min(x1, window_.x + window_.width) - window_.x;
+		if (x0 >= x1) return;
+		
+		uint64_t *row = &bits_[size_t(y - window_.y) * words_];
+		int w0 = x0 >> 6, w1 = (x1 - 1) >> 6;
+		uint64_t first = ~uint64_t(0) << (x0 & 63);
+		uint64_t last = ~uint64_t(0) >> (63 - ((x1 - 1) & 63));
+		if (w0 == w1) {
+			row[w0] |= first & last;
+			return;
+		}
+		row[w0] |= first;
+		for (int w=w0+1; w<w1; w++) {
+			row[w] = ~uint64_t(0);
+		}
+		row[w1] |= last;
+	}
+	
+	bool sameVertices(const PolygonStore::View &a, const PolygonStore::View &b)
+	{
+		return a.size() == b.size() && memcmp(a.points(), b.points(), a.size() * sizeof(cv::Point2f)) == 0;
+	}
+	
+	struct Candidate {
+		double iou;
+		int left;
+		int right;
+		bool operator<(const Candidate &other) const {
+			// Best first; ties in id order, so the pairing is the same on every run
+			if (iou != other.iou) return iou > other.iou;
+			if (left != other.left) return left < other.left;
+			return right < other.right;
+		}
+	};
+}
+
+AnnotationDiff::AnnotationDiff(ThreadPool &pool, double min_iou)
+	: pool_(pool)
+	, min_iou_(min_iou)
+	, counts_(NUM_CHANGE_TYPES, 0)
+	, unchanged_(0)
+	, only_left_(0)
+	, only_right_(0)
+	, mean_image_iou_(1.0)
+{
+}
+
+const char* AnnotationDiff::changeName(int type)
+{
+	static const char *names[NUM_CHANGE_TYPES] = {"added", "removed", "moved", "renamed"};
+	return (type >= 0 && type < NUM_CHANGE_TYPES) ? names[type] : "unknown";
+}
+
+AnnotationDiff::Overlap AnnotationDiff::overlapOf(const std::vector<PolygonStore::View> &left, const std::vector<PolygonStore::View> &right, cv::Size size)
+{
+	// Only the window covering both sides is rasterized
+	cv::Rect window;
+	for (size_t i=0; i<left.size(); i++) window |= pixelBounds(left[i], size);
+	for (size_t i=0; i<right.size(); i++) window |= pixelBounds(right[i], size);
+	
+	Overlap overlap;
+	if (window.area() <= 0) return overlap;
+	BitMask a(window), b(window);
+	for (size_t i=0; i<left.size(); i++) a.fill(left[i], size);
+	for (size_t i=0; i<right.size(); i++) b.fill(right[i], size);
+	countBits(a.data(), b.data(), a.words(), overlap.intersection, overlap.total);
+	return overlap;
+}
+
+void AnnotationDiff::compareImage(const std::string &name, const MyPolygonDrawer *left, const MyPolygonDrawer *right, Partial &out)
+{
+	cv::Size size = left ? left->getImageSize() : cv::Size(0, 0);
+	if ((size.width <= 0 || size.height <= 0) && right) size = right->getImageSize();
+	if (size.width <= 0 || size.height <= 0) size = cv::Size(FALLBACK_SIZE, FALLBACK_SIZE);
+	
+	std::vector<PolygonStore::View> l, r;
+	if (left) l.assign(left->getPolygons().begin(), left->getPolygons().end());
+	if (right) r.assign(right->getPolygons().begin(), right->getPolygons().end());
+	
+	ImageResult result;
+	result.name = name;
+	result.left = l.size();
+	result.right = r.size();
+	result.unchanged = 0;
+	std::fill(result.counts, result.counts + NUM_CHANGE_TYPES, 0);
+	
+	Change change;
+	change.image = name;
+	std::vector<int> left_match(l.size(), -1), right_match(r.size(), -1);
+	
+	// Both stores iterate in id order, the same ids meet in one merge pass
+	for (size_t i=0, j=0; i<l.size() && j<r.size(); ) {
+		int c = l[i].idRef().compare(r[j].idRef());
+		if (c < 0) {
+			i++;
+		} else if (c > 0) {
+			j++;
+		} else {
+			left_match[i] = int(j);
+			right_match[j] = int(i);
+			if (sameVertices(l[i], r[j])) {
+				result.unchanged++;
+			} else {
+				change.left_id = change.right_id = l[i].id();
+				change.type = MOVED;
+				change.iou = overlapOf(std::vector<PolygonStore::View>(1, l[i]), std::vector<PolygonStore::View>(1, r[j]), size).iou();
+				out.changes.push_back(change);
+				result.counts[MOVED]++;
+			}
+			i++;
+			j++;
+		}
+	}
+	
+	// The rest by overlap, only pairs whose boxes meet are rasterized
+	std::vector<Candidate> candidates;
+	std::vector<cv::Rect> right_bounds(r.size());
+	for (size_t j=0; j<r.size(); j++) {
+		if (right_match[j] < 0) right_bounds[j] = pixelBounds(r[j], size);
+	}
+	for (size_t i=0; i<l.size(); i++) {
+		if (left_match[i] >= 0) continue;
+		cv::Rect bounds = pixelBounds(l[i], size);
+		for (size_t j=0; j<r.size(); j++) {
+			if (right_match[j] >= 0 || (bounds & right_bounds[j]).area() <= 0) continue;
+			Candidate candidate;
+			candidate.iou = overlapOf(std::vector<PolygonStore::View>(1, l[i]), std::vector<PolygonStore::View>(1, r[j]), size).iou();
+			candidate.left = int(i);
+			candidate.right = int(j);
+			if (candidate.iou >= min_iou_) candidates.push_back(candidate);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+	for (size_t k=0; k<candidates.size(); k++) {
+		const Candidate &candidate = candidates[k];
+		if (left_match[candidate.left] >= 0 || right_match[candidate.right] >= 0) continue;
+		left_match[candidate.left] = candidate.right;
+		right_match[candidate.right] = candidate.left;
+		change.left_id = l[candidate.left].id();
+		change.right_id = r[candidate.right].id();
+		change.type = RENAMED;
+		change.iou = candidate.iou;
+		out.changes.push_back(change);
+		result.counts[RENAMED]++;
+	}
+	
+	change.iou = 0.0;
+	change.right_id.clear();
+	change.type = REMOVED;
+	for (size_t i=0; i<l.size(); i++) {
+		if (left_match[i] >= 0) continue;
+		change.left_id = l[i].id();
+		out.changes.push_back(change);
+		result.counts[REMOVED]++;
+	}
+	change.left_id.clear();
+	change.type = ADDED;
+	for (size_t j=0; j<r.size(); j++) {
+		if (right_match[j] >= 0) continue;
+		change.right_id = r[j].id();
+		out.changes.push_back(change);
+		result.counts[ADDED]++;
+	}
+	
+	// Per label, e.g. car_1 and car_2 both count as car
+	std::map<std::string, std::pair<std::vector<PolygonStore::View>, std::vector<PolygonStore::View> > > labels;
+	for (size_t i=0; i<l.size(); i++) labels[annotation_io::labelOf(l[i].id())].first.push_back(l[i]);
+	for (size_t j=0; j<r.size(); j++) labels[annotation_io::labelOf(r[j].id())].second.push_back(r[j]);
+	std::map<std::string, std::pair<std::vector<PolygonStore::View>, std::vector<PolygonStore::View> > >::iterator it;
+	for (it = labels.begin(); it != labels.end(); it++) {
+		Overlap overlap = overlapOf(it->second.first, it->second.second, size);
+		Overlap &sum = out.labels[it->first];
+		sum.intersection += overlap.intersection;
+		sum.total += overlap.total;
+	}
+	
+	result.overlap = overlapOf(l, r, size);
+	out.images.push_back(result);
+}
+
+void AnnotationDiff::run(DrawerMap &left, DrawerMap &right)
+{
+	// Every image of either side, in name order; a missing side has no polygons
+	struct Item {
+		const std::string *name;
+		const MyPolygonDrawer *left;
+		const MyPolygonDrawer *right;
+	};
+	std::vector<Item> items;
+	only_left_ = only_right_ = 0;
+	DrawerMap::iterator a = left.begin(), b = right.begin();
+	while (a != left.end() || b != right.end()) {
+		Item item;
+		if (b == right.end() || (a != left.end() && a->first < b->first)) {
+			item.name = &a->first;
+			item.left = &a->second;
+			item.right = NULL;
+			a++;
+			only_left_++;
+		} else if (a == left.end() || b->first < a->first) {
+			item.name = &b->first;
+			item.left = NULL;
+			item.right = &b->second;
+			b++;
+			only_right_++;
+		} else {
+			item.name = &a->first;
+			item.left = &a->second;
+			item.right = &b->second;
+			a++;
+			b++;
+		}
+		items.push_back(item);
+	}
+	
+	// A few ranges per thread balance uneven images without merging a result per image
+	size_t n_ranges = std::min(items.size(), size_t(std::max(pool_.size(), 1) * 8));
+	std::vector<Partial> partials(n_ranges);
+	pool_.parallelFor(n_ranges, [&](size_t k) {
+		size_t begin = items.size() * k / n_ranges;
+		size_t end = items.size() * (k + 1) / n_ranges;
+		for (size_t i=begin; i<end; i++) {
+			this->compareImage(*items[i].name, items[i].left, items[i].right, partials[k]);
+		}
+	});
+	
+	images_.clear();
+	changes_.clear();
+	labels_.clear();
+	counts_.assign(NUM_CHANGE_TYPES, 0);
+	unchanged_ = 0;
+	overlap_ = Overlap();
+	double iou_sum = 0.0;
+	for (size_t k=0; k<partials.size(); k++) {
+		Partial &partial = partials[k];
+		for (size_t i=0; i<partial.images.size(); i++) {
+			const ImageResult &image = partial.images[i];
+			for (int t=0; t<NUM_CHANGE_TYPES; t++) counts_[t] += image.counts[t];
+			unchanged_ += image.unchanged;
+			overlap_.intersection += image.overlap.intersection;
+			overlap_.total += image.overlap.total;
+			iou_sum += image.overlap.iou();
+		}
+		images_.insert(images_.end(), partial.images.begin(), partial.images.end());
+		changes_.insert(changes_.end(), partial.changes.begin(), partial.changes.end());
+		for (std::map<std::string, Overlap>::iterator it = partial.labels.begin(); it != partial.labels.end(); it++) {
+			labels_[it->first].intersection += it->second.intersection;
+			labels_[it->first].total += it->second.total;
+		}
+	}
+	mean_image_iou_ = images_.empty() ? 1.0 : iou_sum / images_.size();
+}
+
+std::string AnnotationDiff::formatReport()
+{
+	std::stringstream ss;
+	ss << "{\n\"summary\": {\"images\": " << images_.size() << ", \"only_left\": " << only_left_ << ", \"only_right\": " << only_right_
+		<< ", \"unchanged\": " << unchanged_;
+	for (int t=0; t<NUM_CHANGE_TYPES; t++) {
+		ss << ", \"" << changeName(t) << "\": " << counts_[t];
+	}
+	ss << cv::format(", \"iou\": %.6f, \"mean_image_iou\": %.6f},\n", overlap_.iou(), mean_image_iou_);
+	
+	ss << "\"labels\": {";
+	bool first = true;
+	for (std::map<std::string, Overlap>::iterator it = labels_.begin(); it != labels_.end(); it++, first = false) {
+		ss << (first ? "\n" : ",\n") << "  \"" << utils::jsonEscape(it->first) << "\": "
+			<< cv::format("{\"iou\": %.6f, \"intersection_px\": %llu, \"union_px\": %llu}", it->second.iou(),
+			(unsigned long long) it->second.intersection, (unsigned long long) it->second.total);
+	}
+	ss << "\n},\n";
+	
+	ss << "\"images\": [";
+	for (size_t i=0; i<images_.size(); i++) {
+		const ImageResult &image = images_[i];
+		ss << (i > 0 ? ",\n" : "\n") << "  {\"image\": \"" << utils::jsonEscape(image.name) << "\", "
+			<< cv::format("\"iou\": %.6f, \"left\": %d, \"right\": %d, \"unchanged\": %d", image.overlap.iou(), int(image.left), int(image.right), int(image.unchanged));
+		for (int t=0; t<NUM_CHANGE_TYPES; t++) {
+			ss << ", \"" << changeName(t) << "\": " << image.counts[t];
+		}
+		ss << "}";
+	}
+	ss << "\n],\n";
+	
+	ss << "\"changes\": [";
+	for (size_t i=0; i<changes_.size(); i++) {
+		const Change &change = changes_[i];
+		ss << (i > 0 ? ",\n" : "\n") << "  {\"image\": \"" << utils::jsonEscape(change.image) << "\", \"type\": \"" << changeName(change.type)
+			<< "\", \"left_id\": \"" << utils::jsonEscape(change.left_id) << "\", \"right_id\": \"" << utils::jsonEscape(change.right_id) << "\", "
+			<< cv::format("\"iou\": %.6f}", change.iou);
+	}
+	ss << "\n]\n}\n";
+	return ss.str();
+}
@@ -0,0 +1,96 @@
+#ifndef ANNOTATION_DIFF_H
+#define ANNOTATION_DIFF_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "polygon_drawer/annotation_io.h"
+#include "polygon_drawer/thread_pool.h"
+
+// Compares two annotations of the same images, e.g. by two annotators.
+// Polygons are paired by id first; the rest are paired greedily by
+// overlap, best IoU first, down to min_iou. Overlaps are counted on packed
+// bit masks at the stored w x h: polygons are scan-converted straight into
+// 64-bit words (a pixel is inside when its center is) and intersection and
+// union are popcounts of the AND and OR of two masks. Images are split
+// into ranges compared in parallel and merged in order, so the report does
+// not depend on the number of threads.
+class AnnotationDiff {
+public:
+	enum ChangeType {
+		ADDED,      // only on the right
+		REMOVED,    // only on the left
+		MOVED,      // same id, other vertices
+		RENAMED,    // paired by overlap, the ids differ
+		NUM_CHANGE_TYPES
+	};
+	
+	struct Change {
+		std::string image;
+		std::string left_id;
+		std::string right_id;
+		int type;
+		double iou;     // of the pair, 0 for ADDED and REMOVED
+	};
+	
+	// Pixels of the union and the intersection of two sets of polygons
+	struct Overlap {
+		uint64_t intersection;
+		uint64_t total;
+		
+		Overlap() : intersection(0), total(0) {}
+		double iou() const { return total > 0 ? double(intersection) / total : 1.0; }
+	};
+	
+	struct ImageResult {
+		std::string name;
+		size_t left;        // polygons on each side
+		size_t right;
+		size_t unchanged;
+		size_t counts[NUM_CHANGE_TYPES];
+		Overlap overlap;    // all regions of the image
+	};
+	
+	AnnotationDiff(ThreadPool &pool, double min_iou = 0.5);
+	void run(DrawerMap &left, DrawerMap &right);
+	std::string formatReport();
+	
+	const std::vector<ImageResult>& images() { return images_; }
+	const std::vector<Change>& changes() { return changes_; }
+	const std::map<std::string, Overlap>& labels() { return labels_; }
+	size_t count(int type) { return counts_[type]; }
+	size_t unchanged() { return unchanged_; }
+	size_t onlyLeft() { return only_left_; }
+	size_t onlyRight() { return only_right_; }
+	Overlap overlap() { return overlap_; }
+	double meanImageIou() { return mean_image_iou_; }
+	
+	static const char* changeName(int type);
+	static Overlap overlapOf(const std::vector<PolygonStore::View> &left, const std::vector<PolygonStore::View> &right, cv::Size size);
+
+private:
+	struct Partial {
+		std::vector<ImageResult> images;
+		std::vector<Change> changes;
+		std::map<std::string, Overlap> labels;
+	};
+	
+	void compareImage(const std::string &name, const MyPolygonDrawer *left, const MyPolygonDrawer *right, Partial &out);
+	
+	ThreadPool &pool_;
+	double min_iou_;
+	
+	std::vector<ImageResult> images_;
+	std::vector<Change> changes_;
+	std::map<std::string, Overlap> labels_;     // summed over all images
+	std::vector<size_t> counts_;
+	size_t unchanged_;
+	size_t only_left_;
+	size_t only_right_;
+	Overlap overlap_;
+	double mean_image_iou_;
+};
+
+#endif
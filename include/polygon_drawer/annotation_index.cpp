@@ -0,0 +1,159 @@
+#include "annotation_index.h"
+
+#include <algorithm>
+
+namespace {
+	const char *BUCKET_NAMES[AnnotationIndex::NUM_BUCKETS] = {"0", "1", "2-9", "10+"};
+}
+
+void AnnotationIndex::reset(size_t n_images)
+{
+	entries_.assign(n_images, Entry());
+	by_label_.clear();
+	for (int b=0; b<NUM_BUCKETS; b++) {
+		by_bucket_[b].clear();
+	}
+	labeled_.clear();
+	
+	// Every image starts unlabeled; the hinted insert keeps this linear
+	for (size_t i=0; i<n_images; i++) {
+		by_bucket_[EMPTY].insert(by_bucket_[EMPTY].end(), int(i));
+	}
+}
+
+void AnnotationIndex::update(int position, const std::vector<std::string> &ids)
+{
+	if (position < 0 || position >= int(entries_.size())) return;
+	
+	Entry entry;
+	entry.bucket = bucketOf(ids.size());
+	for (size_t i=0; i<ids.size(); i++) {
+		entry.labels.push_back(annotation_io::labelOf(ids[i]));
+	}
+	std::sort(entry.labels.begin(), entry.labels.end());
+	entry.labels.erase(std::unique(entry.labels.begin(), entry.labels.end()), entry.labels.end());
+	
+	Entry &old = entries_[position];
+	if (old.bucket == entry.bucket && old.labels == entry.labels) return;
+	
+	for (size_t i=0; i<old.labels.size(); i++) {
+		std::map<std::string, std::set<int> >::iterator it = by_label_.find(old.labels[i]);
+		it->second.erase(position);
+		if (it->second.empty()) by_label_.erase(it);
+	}
+	by_bucket_[old.bucket].erase(position);
+	labeled_.erase(position);
+	
+	for (size_t i=0; i<entry.labels.size(); i++) {
+		by_label_[entry.labels[i]].insert(position);
+	}
+	by_bucket_[entry.bucket].insert(position);
+	if (entry.bucket != EMPTY) labeled_.insert(position);
+	old.labels.swap(entry.labels);
+	old.bucket = entry.bucket;
+}
+
+void AnnotationIndex::update(int position, const PolygonStore &polygons)
+{
+	std::vector<std::string> ids;
+	ids.reserve(polygons.size());
+	for (PolygonStore::const_iterator p = polygons.begin(); p != polygons.end(); ++p) {
+		ids.push_back((*p).id());
+	}
+	this->update(position, ids);
+}
+
+int AnnotationIndex::bucketOf(size_t polygons)
+{
+	if (polygons == 0) return EMPTY;
+	if (polygons == 1) return ONE;
+	return polygons < 10 ? FEW : MANY;
+}
+
+const char* AnnotationIndex::bucketName(int bucket)
+{
+	return (bucket >= 0 && bucket < NUM_BUCKETS) ? BUCKET_NAMES[bucket] : "unknown";
+}
+
+int AnnotationIndex::parseBucket(const std::string &name)
+{
+	for (int b=0; b<NUM_BUCKETS; b++) {
+		if (name == BUCKET_NAMES[b]) return b;
+	}
+	return -1;
+}
+
+// The smallest of the sets the filter restricts to, NULL when it restricts nothing
+const std::set<int>* AnnotationIndex::candidates(const Filter &filter) const
+{
+	static const std::set<int> none;
+	const std::set<int> *best = NULL;
+	if (!filter.label.empty()) {
+		std::map<std::string, std::set<int> >::const_iterator it = by_label_.find(filter.label);
+		if (it == by_label_.end()) return &none;
+		best = &it->second;
+	}
+	if (filter.bucket >= 0 && filter.bucket < NUM_BUCKETS) {
+		const std::set<int> *set = &by_bucket_[filter.bucket];
+		if (best == NULL || set->size() < best->size()) best = set;
+	}
+	if (filter.labeled >= 0) {
+		const std::set<int> *set = filter.labeled ? &labeled_ : &by_bucket_[EMPTY];
+		if (best == NULL || set->size() < best->size()) best = set;
+	}
+	return best;
+}
+
+bool AnnotationIndex::matches(const Filter &filter, int position) const
+{
+	const Entry &entry = entries_[position];
+	if (!filter.label.empty() && !std::binary_search(entry.labels.begin(), entry.labels.end(), filter.label)) return false;
+	if (filter.bucket >= 0 && entry.bucket != filter.bucket) return false;
+	if (filter.labeled >= 0 && (entry.bucket != EMPTY) != (filter.labeled != 0)) return false;
+	return true;
+}
+
+int AnnotationIndex::step(const std::set<int> &positions, int from, int direction)
+{
+	if (positions.empty()) return -1;
+	if (direction >= 0) {
+		std::set<int>::const_iterator it = positions.upper_bound(from);
+		return (it != positions.end()) ? *it : *positions.begin();
+	}
+	std::set<int>::const_iterator it = positions.lower_bound(from);
+	return (it != positions.begin()) ? *--it : *positions.rbegin();
+}
+
+int AnnotationIndex::next(const Filter &filter, int from, int direction) const
+{
+	int n = int(entries_.size());
+	if (n == 0) return -1;
+	const std::set<int> *positions = this->candidates(filter);
+	if (positions == NULL) {
+		return (n + (from + (direction >= 0 ? 1 : -1)) % n) % n;
+	}
+	
+	// With one criterion the first candidate matches; the others are checked on the entries
+	int position = from;
+	for (size_t k=0; k<positions->size(); k++) {
+		position = step(*positions, position, direction);
+		if (this->matches(filter, position)) return position;
+	}
+	return -1;
+}
+
+std::vector<int> AnnotationIndex::select(const Filter &filter) const
+{
+	std::vector<int> positions;
+	const std::set<int> *candidates = this->candidates(filter);
+	if (candidates == NULL) {
+		for (int i=0; i<int(entries_.size()); i++) {
+			positions.push_back(i);
+		}
+		return positions;
+	}
+	for (std::set<int>::const_iterator it = candidates->begin(); it != candidates->end(); it++) {
+		if (this->matches(filter, *it)) positions.push_back(*it);
+	}
+	return positions;
+}
@@ -0,0 +1,72 @@
+#ifndef ANNOTATION_INDEX_H
+#define ANNOTATION_INDEX_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include "polygon_drawer/annotation_io.h"
+
+// Inverted index from labels and polygon counts to images, for jumping
+// between matching images instead of stepping through all of them. Images
+// are positions in a fixed list, the editor's navigation order; every key
+// keeps an ordered set of positions, so the next match in either direction
+// is a single lookup. An image's entry is replaced whenever its polygons
+// change, which costs O(k log n) for k labels.
+class AnnotationIndex {
+public:
+	enum Bucket {
+		EMPTY,      // no polygons, the image is unlabeled
+		ONE,
+		FEW,        // 2 to 9
+		MANY,       // 10 or more
+		NUM_BUCKETS
+	};
+	
+	// Criteria of a query, all given ones have to match
+	struct Filter {
+		std::string label;  // empty for any
+		int labeled;        // 1 labeled, 0 unlabeled, -1 either
+		int bucket;         // -1 for any
+		
+		Filter() : labeled(-1), bucket(-1) {}
+	};
+	
+	AnnotationIndex() {}
+	void reset(size_t n_images);
+	void update(int position, const std::vector<std::string> &ids);
+	void update(int position, const PolygonStore &polygons);
+	
+	// The nearest match after 'from' in the given direction (+1 or -1), wrapping
+	// around the list; -1 when nothing matches
+	int next(const Filter &filter, int from, int direction) const;
+	std::vector<int> select(const Filter &filter) const;
+	
+	size_t size() const { return entries_.size(); }
+	size_t count(int bucket) const { return by_bucket_[bucket].size(); }
+	const std::map<std::string, std::set<int> >& labels() const { return by_label_; }
+	
+	static int bucketOf(size_t polygons);
+	static const char* bucketName(int bucket);
+	static int parseBucket(const std::string &name);
+
+private:
+	struct Entry {
+		std::vector<std::string> labels;    // sorted, unique
+		int bucket;
+		
+		Entry() : bucket(EMPTY) {}
+	};
+	
+	const std::set<int>* candidates(const Filter &filter) const;
+	bool matches(const Filter &filter, int position) const;
+	static int step(const std::set<int> &positions, int from, int direction);
+	
+	std::vector<Entry> entries_;
+	std::map<std::string, std::set<int> > by_label_;
+	std::set<int> by_bucket_[NUM_BUCKETS];
+	std::set<int> labeled_;
+};
+
+#endif
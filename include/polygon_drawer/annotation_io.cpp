@@ -0,0 +1,230 @@
+#include "annotation_io.h"
+#include "flow_reader.h"
+#include "utils.h"
+
+#include <yaml-cpp/yaml.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+bool annotation_io::loadYaml(const std::string &filename, DrawerMap &drawers, bool verbose)
+{
+	// Files written by this tool are parsed without building a YAML document
+	FlowReader flow;
+	if (flow.read(filename, drawers)) {
+		if (verbose) {
+			double seconds = std::max(flow.elapsedMs(), 1e-3) / 1000.0;
+			std::cout << cv::format(" Parsed %d images, %d polygons in %.1f ms (%.1f MB/s, %.0f polygons/s)", 
+				int(flow.images()), int(flow.polygons()), flow.elapsedMs(), 
+				flow.bytes() / (1024.0 * 1024.0) / seconds, flow.polygons() / seconds) << std::endl;
+		}
+		return true;
+	}
+	
+	std::ifstream reader(filename);
+	if (!reader.is_open()) {
+		return false;
+	}
+	reader.close();
+	
+	if (verbose) {
+		std::cout << utils::getBashColorText("[Warning] Unrecognized layout, parsing with yaml-cpp: " + filename, 'y', 'b') << std::endl;
+	}
+	YAML::Node node = YAML::LoadFile(filename);
+	if (node["polygons"]) {
+		if (node["polygons"].size() > 0) {
+			for (int i=0; i<(int)node["polygons"].size(); i++) {
+				MyPolygonDrawer drawer;
+				
+				auto data = node["polygons"][i];
+				std::string name = data["name"].as<std::string>();
+				cv::Size image_size(data["w"].as<int>(), data["h"].as<int>());
+				
+				drawer.setImageSize(image_size);
+				
+				if (verbose) {
+					std::cout << " " << name << ", Size: " << image_size.width << " x " << image_size.height << ", polygons: " << data["ids"].size() << std::endl;
+				}
+				if (data["ids"] && data["vertices"]) {
+					if (data["ids"].size() == data["vertices"].size()) {
+						
+						int index = 0;
+						std::vector<cv::Point2f> points;
+						for (auto single_box : data["vertices"]) {
+							points.clear();
+							for (auto vertice : single_box) {
+								points.push_back(cv::Point2f(vertice[0].as<double>(), vertice[1].as<double>()));
+							}
+							std::string id = data["ids"][index].as<std::string>();
+							index++;
+							drawer.addRegion(id, points.data(), points.size());
+						}
+					}
+				}
+				
+				// Freshly loaded data has nothing to save
+				drawer.clearModified();
+				drawers[name] = drawer;
+			}
+		}
+	}
+	return true;
+}
+
+std::string annotation_io::formatEntry(const std::string &name, MyPolygonDrawer &drawer)
+{
+	return " - { name: " + name + ", " + drawer.getTextInfo() + "}";
+}
+
+std::string annotation_io::formatDocument(const std::string &appname, DrawerMap &drawers)
+{
+	std::stringstream ss;
+	ss << "appname: " << appname << std::endl;
+	ss << "\ndatetime: " << utils::getLocaltime(0) << std::endl;
+	ss << "\npolygons:" << std::endl;
+	DrawerMap::iterator it;
+	for (it = drawers.begin(); it != drawers.end(); it++) {
+		ss << formatEntry(it->first, it->second) << std::endl;
+	}
+	return ss.str();
+}
+
+bool annotation_io::saveYaml(const std::string &filename, const std::string &appname, DrawerMap &drawers)
+{
+	return utils::writeFileAtomic(filename, formatDocument(appname, drawers));
+}
+
+std::string annotation_io::shardPath(const std::string &shard_dir, const std::string &name)
+{
+	// Image names are paths relative to source_image_dir, the shard tree mirrors them
+	return shard_dir + "/" + name + ".yaml";
+}
+
+bool annotation_io::saveShard(const std::string &shard_dir, const std::string &appname, const std::string &name, MyPolygonDrawer &drawer)
+{
+	std::string filename = shardPath(shard_dir, name);
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(boost::filesystem::path(filename).parent_path(), ec);
+	if (ec) return false;
+	
+	DrawerMap single;
+	single.insert(std::pair<std::string, MyPolygonDrawer>(name, drawer));
+	return saveYaml(filename, appname, single);
+}
+
+int annotation_io::loadShards(const std::string &shard_dir, DrawerMap &drawers, std::vector<std::string> *files)
+{
+	boost::system::error_code ec;
+	if (!boost::filesystem::is_directory(shard_dir, ec)) return 0;
+	
+	int count = 0;
+	boost::filesystem::recursive_directory_iterator it(shard_dir, ec), it_end;
+	for (; it != it_end; it.increment(ec)) {
+		if (ec) break;
+		if (!boost::filesystem::is_regular_file(it->status())) continue;
+		
+		std::string filename = it->path().string();
+		if (it->path().extension() != ".yaml") continue;
+		
+		// Shards are newer than the combined file and replace its entries
+		if (loadYaml(filename, drawers)) {
+			count++;
+			if (files != NULL) {
+				files->push_back(filename);
+			}
+		}
+	}
+	return count;
+}
+
+int annotation_io::workerOf(const std::string &name, int count)
+{
+	if (count <= 1) return 0;
+	
+	// FNV-1a: the same on every machine and run, unlike std::hash; adding images never moves others
+	uint32_t hash = 2166136261u;
+	for (size_t i=0; i<name.size(); i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+	return int(hash % uint32_t(count));
+}
+
+std::string annotation_io::workerName(int index, int count)
+{
+	return cv::format("worker_%d_of_%d", index, count);
+}
+
+std::string annotation_io::workerDir(const std::string &results_dir)
+{
+	return results_dir + "/workers";
+}
+
+std::string annotation_io::lockPath(const std::string &results_dir)
+{
+	return results_dir + "/polygon_drawer.lock";
+}
+
+std::string annotation_io::labelOf(const std::string &id)
+{
+	size_t pos = id.find_last_not_of("0123456789");
+	if (pos == std::string::npos || pos == 0 || pos + 1 == id.size()) return id;
+	if (id[pos] != '_' && id[pos] != '-') return id;
+	return id.substr(0, pos);
+}
+
+int annotation_io::classOf(const ClassMap &classes, const std::string &id)
+{
+	ClassMap::const_iterator it = classes.find(labelOf(id));
+	return (it != classes.end()) ? it->second : 0;
+}
+
+annotation_io::ClassMap annotation_io::collectClasses(DrawerMap &drawers)
+{
+	// Sorted labels get 1-based indices, 0 is the background
+	ClassMap classes;
+	DrawerMap::iterator it;
+	for (it = drawers.begin(); it != drawers.end(); it++) {
+		const PolygonStore &polygons = it->second.getPolygons();
+		for (PolygonStore::const_iterator p = polygons.begin(); p != polygons.end(); ++p) {
+			classes[labelOf((*p).id())] = 0;
+		}
+	}
+	int index = 1;
+	for (ClassMap::iterator c = classes.begin(); c != classes.end(); c++) {
+		c->second = index++;
+	}
+	return classes;
+}
+
+bool annotation_io::loadClasses(const std::string &filename, ClassMap &classes)
+{
+	// One label per line, the line number is the class index
+	std::ifstream reader(filename);
+	if (!reader.is_open()) return false;
+	
+	std::string line;
+	int index = 1;
+	while (std::getline(reader, line)) {
+		if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+		if (line.empty()) continue;
+		classes[line] = index++;
+	}
+	return true;
+}
+
+std::string annotation_io::formatClasses(const ClassMap &classes)
+{
+	std::vector<std::string> names(classes.size());
+	for (ClassMap::const_iterator it = classes.begin(); it != classes.end(); it++) {
+		if (it->second >= 1 && it->second <= int(names.size())) {
+			names[it->second - 1] = it->first;
+		}
+	}
+	std::string text;
+	for (size_t i=0; i<names.size(); i++) {
+		text += names[i] + "\n";
+	}
+	return text;
+}
@@ -0,0 +1,43 @@
+#ifndef ANNOTATION_IO_H
+#define ANNOTATION_IO_H
+
+#include <iostream>
+#include <string>
+#include <map>
+#include "polygon_drawer/editor.h"
+
+typedef std::map<std::string, MyPolygonDrawer> DrawerMap;
+
+// Reading and writing of polygon_drawer.yaml. The same schema is used for
+// the combined file and for the per-image shards written by autosave.
+namespace annotation_io {
+	bool loadYaml(const std::string &filename, DrawerMap &drawers, bool verbose = false);
+	std::string formatEntry(const std::string &name, MyPolygonDrawer &drawer);
+	std::string formatDocument(const std::string &appname, DrawerMap &drawers);
+	bool saveYaml(const std::string &filename, const std::string &appname, DrawerMap &drawers);
+	
+	std::string shardPath(const std::string &shard_dir, const std::string &name);
+	bool saveShard(const std::string &shard_dir, const std::string &appname, const std::string &name, MyPolygonDrawer &drawer);
+	int loadShards(const std::string &shard_dir, DrawerMap &drawers, std::vector<std::string> *files = NULL);
+	
+	// Several editor processes share one dataset: image names are split over the workers by a
+	// stable hash, worker k of n keeps results_dir/workers/worker_<k>_of_<n>.yaml and its
+	// autosave shards in the directory of the same name, and 'polygon_tools merge' combines them.
+	// Writers of polygon_drawer.yaml hold the lock file
+	int workerOf(const std::string &name, int count);
+	std::string workerName(int index, int count);
+	std::string workerDir(const std::string &results_dir);
+	std::string lockPath(const std::string &results_dir);
+	
+	// Region ids double as labels; "car_2" and "car-2" are both instances of "car"
+	std::string labelOf(const std::string &id);
+	
+	// Label -> 1-based class index, 0 is the background
+	typedef std::map<std::string, int> ClassMap;
+	int classOf(const ClassMap &classes, const std::string &id);
+	ClassMap collectClasses(DrawerMap &drawers);
+	bool loadClasses(const std::string &filename, ClassMap &classes);
+	std::string formatClasses(const ClassMap &classes);
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "annotation_validator.h"
+#include "geometry.h"
+#include "image_scanner.h"
+#include "shape.h"
+#include "utils.h"
+
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+namespace {
+	const int AREA_BUCKETS = 7;     // <1e-5, [1e-5, 1e-4), ..., [0.1, 1), >= 1
+	const int COUNT_BUCKETS = 12;   // 0, 1, [2, 4), [4, 8), ..., >= 1024
+	
+	int areaBucket(double fraction)
+	{
+		if (fraction <= 0.0) return 0;
+		int bucket = int(std::floor(std::log10(fraction))) + 6;
+		return std::min(std::max(bucket, 0), AREA_BUCKETS - 1);
+	}
+	
+	int countBucket(size_t n)
+	{
+		int bucket = 0;
+		while (n > 0 && bucket < COUNT_BUCKETS - 1) {
+			n >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+	
+	std::string areaBucketName(int bucket)
+	{
+		if (bucket == 0) return "<1e-05";
+		if (bucket == AREA_BUCKETS - 1) return ">=1";
+		return cv::format("[1e%d, 1e%d)", bucket - 6, bucket - 5);
+	}
+	
+	std::string countBucketName(int bucket)
+	{
+		if (bucket == 0) return "0";
+		if (bucket == 1) return "1";
+		if (bucket == COUNT_BUCKETS - 1) return cv::format(">=%d", 1 << (bucket - 1));
+		return cv::format("[%d, %d)", 1 << (bucket - 1), 1 << bucket);
+	}
+}
+
+AnnotationValidator::AnnotationValidator(ThreadPool &pool, double min_area_px)
+	: pool_(pool)
+	, min_area_px_(min_area_px)
+	, counts_(NUM_ISSUE_TYPES, 0)
+	, area_histogram_(AREA_BUCKETS, 0)
+	, count_histogram_(COUNT_BUCKETS, 0)
+	, images_(0)
+	, polygons_(0)
+	, vertices_(0)
+	, max_polygons_(0)
+{
+}
+
+const char* AnnotationValidator::issueName(int type)
+{
+	static const char *names[NUM_ISSUE_TYPES] = {
+		"self_intersection", "out_of_range", "zero_area", "duplicate_id", "size_mismatch", "missing_image"
+	};
+	return (type >= 0 && type < NUM_ISSUE_TYPES) ? names[type] : "unknown";
+}
+
+void AnnotationValidator::checkImage(const std::string &name, const MyPolygonDrawer &drawer, const std::string &image_dir, Partial &out)
+{
+	cv::Size size = drawer.getImageSize();
+	const PolygonStore &polygons = drawer.getPolygons();
+	
+	Issue issue;
+	issue.image = name;
+	for (PolygonStore::const_iterator it = polygons.begin(); it != polygons.end(); ++it) {
+		PolygonStore::View polygon = *it;
+		const cv::Point2f *points = polygon.points();
+		size_t n = polygon.size();
+		out.polygons++;
+		out.vertices += n;
+		out.labels[annotation_io::labelOf(polygon.id())]++;
+		
+		shape::View view = shape::classify(points, n);
+		double area = std::fabs(shape::signedArea(view));
+		out.area_histogram[areaBucket(area)]++;
+		
+		issue.id = polygon.id();
+		size_t outside = geometry::countOutOfRange(points, n);
+		if (outside > 0) {
+			issue.type = OUT_OF_RANGE;
+			issue.detail = cv::format("%d of %d vertices outside [0, 1]", int(outside), int(n));
+			out.issues.push_back(issue);
+		}
+		// A crossing shape such as a bow tie can sum to zero area, report the crossing first
+		double area_px = area * size.width * size.height;
+		if (shape::selfIntersects(view)) {
+			issue.type = SELF_INTERSECTION;
+			issue.detail = cv::format("%d vertices", int(n));
+			out.issues.push_back(issue);
+		} else if (n < 3 || area_px < min_area_px_) {
+			issue.type = ZERO_AREA;
+			issue.detail = cv::format("%d vertices, area %.3f px", int(n), area_px);
+			out.issues.push_back(issue);
+		}
+	}
+	out.count_histogram[countBucket(polygons.size())]++;
+	
+	const std::vector<std::string> &duplicates = drawer.getDuplicateIds();
+	for (size_t i=0; i<duplicates.size(); i++) {
+		issue.id = duplicates[i];
+		issue.type = DUPLICATE_ID;
+		issue.detail = "later copy dropped by the loader";
+		out.issues.push_back(issue);
+	}
+	
+	// Only the image header is read, the pixels are never decoded
+	if (!image_dir.empty()) {
+		issue.id = "";
+		cv::Size actual;
+		std::string filename = image_dir + "/" + name;
+		if (!boost::filesystem::exists(filename)) {
+			issue.type = MISSING_IMAGE;
+			issue.detail = filename;
+			out.issues.push_back(issue);
+		} else if (ImageScanner::probeImageSize(filename, actual) && actual != size) {
+			issue.type = SIZE_MISMATCH;
+			issue.detail = cv::format("stored %d x %d, image %d x %d", size.width, size.height, actual.width, actual.height);
+			out.issues.push_back(issue);
+		}
+	}
+}
+
+void AnnotationValidator::run(DrawerMap &drawers, const std::string &image_dir)
+{
+	std::vector<DrawerMap::iterator> items;
+	for (DrawerMap::iterator it = drawers.begin(); it != drawers.end(); it++) {
+		items.push_back(it);
+	}
+	
+	// A few ranges per thread balance uneven images without merging a result per image
+	size_t n_ranges = std::min(items.size(), size_t(std::max(pool_.size(), 1) * 8));
+	std::vector<Partial> partials(n_ranges);
+	pool_.parallelFor(n_ranges, [&](size_t r) {
+		Partial &partial = partials[r];
+		partial.area_histogram.assign(AREA_BUCKETS, 0);
+		partial.count_histogram.assign(COUNT_BUCKETS, 0);
+		partial.polygons = 0;
+		partial.vertices = 0;
+		size_t begin = items.size() * r / n_ranges;
+		size_t end = items.size() * (r + 1) / n_ranges;
+		for (size_t i=begin; i<end; i++) {
+			this->checkImage(items[i]->first, items[i]->second, image_dir, partial);
+		}
+	});
+	
+	issues_.clear();
+	counts_.assign(NUM_ISSUE_TYPES, 0);
+	labels_.clear();
+	area_histogram_.assign(AREA_BUCKETS, 0);
+	count_histogram_.assign(COUNT_BUCKETS, 0);
+	images_ = items.size();
+	polygons_ = vertices_ = max_polygons_ = 0;
+	for (size_t r=0; r<partials.size(); r++) {
+		Partial &partial = partials[r];
+		for (size_t i=0; i<partial.issues.size(); i++) {
+			counts_[partial.issues[i].type]++;
+		}
+		issues_.insert(issues_.end(), partial.issues.begin(), partial.issues.end());
+		for (std::map<std::string, size_t>::iterator it = partial.labels.begin(); it != partial.labels.end(); it++) {
+			labels_[it->first] += it->second;
+		}
+		for (int k=0; k<AREA_BUCKETS; k++) area_histogram_[k] += partial.area_histogram[k];
+		for (int k=0; k<COUNT_BUCKETS; k++) count_histogram_[k] += partial.count_histogram[k];
+		polygons_ += partial.polygons;
+		vertices_ += partial.vertices;
+	}
+	for (size_t i=0; i<items.size(); i++) {
+		max_polygons_ = std::max(max_polygons_, items[i]->second.getPolygons().size());
+	}
+}
+
+std::string AnnotationValidator::formatReport()
+{
+	std::stringstream ss;
+	ss << "{\n\"summary\": {\"images\": " << images_ << ", \"polygons\": " << polygons_ << ", \"vertices\": " << vertices_;
+	for (int t=0; t<NUM_ISSUE_TYPES; t++) {
+		ss << ", \"" << issueName(t) << "\": " << counts_[t];
+	}
+	ss << "},\n";
+	
+	ss << "\"stats\": {\n";
+	ss << "  \"polygons_per_image\": {\"mean\": " << cv::format("%.3f", images_ > 0 ? double(polygons_) / images_ : 0.0)
+		<< ", \"max\": " << max_polygons_ << ", \"histogram\": {";
+	for (int k=0; k<COUNT_BUCKETS; k++) {
+		ss << (k > 0 ? ", " : "") << "\"" << countBucketName(k) << "\": " << count_histogram_[k];
+	}
+	ss << "}},\n  \"area_fraction_histogram\": {";
+	for (int k=0; k<AREA_BUCKETS; k++) {
+		ss << (k > 0 ? ", " : "") << "\"" << areaBucketName(k) << "\": " << area_histogram_[k];
+	}
+	ss << "},\n  \"labels\": {";
+	bool first = true;
+	for (std::map<std::string, size_t>::iterator it = labels_.begin(); it != labels_.end(); it++, first = false) {
+		ss << (first ? "" : ", ") << "\"" << utils::jsonEscape(it->first) << "\": " << it->second;
+	}
+	ss << "}\n},\n";
+	
+	ss << "\"issues\": [";
+	for (size_t i=0; i<issues_.size(); i++) {
+		const Issue &issue = issues_[i];
+		ss << (i > 0 ? ",\n" : "\n") << "  {\"image\": \"" << utils::jsonEscape(issue.image) << "\", \"id\": \"" << utils::jsonEscape(issue.id)
+			<< "\", \"type\": \"" << issueName(issue.type) << "\", \"detail\": \"" << utils::jsonEscape(issue.detail) << "\"}";
+	}
+	ss << "\n]\n}\n";
+	return ss.str();
+}
@@ -0,0 +1,72 @@
+#ifndef ANNOTATION_VALIDATOR_H
+#define ANNOTATION_VALIDATOR_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include "polygon_drawer/annotation_io.h"
+#include "polygon_drawer/thread_pool.h"
+
+// Checks every drawer for annotations that would poison a training run and
+// gathers dataset statistics on the way. Images are split into contiguous
+// ranges that are checked in parallel and merged in order, so the report
+// does not depend on the number of threads.
+class AnnotationValidator {
+public:
+	enum IssueType {
+		SELF_INTERSECTION,
+		OUT_OF_RANGE,       // vertices outside [0, 1]
+		ZERO_AREA,          // fewer than 3 vertices or below min_area_px
+		DUPLICATE_ID,       // dropped by the loader
+		SIZE_MISMATCH,      // stored w/h differ from the image header
+		MISSING_IMAGE,
+		NUM_ISSUE_TYPES
+	};
+	
+	struct Issue {
+		std::string image;
+		std::string id;
+		int type;
+		std::string detail;
+	};
+	
+	AnnotationValidator(ThreadPool &pool, double min_area_px = 1.0);
+	void run(DrawerMap &drawers, const std::string &image_dir = "");
+	std::string formatReport();
+	
+	const std::vector<Issue>& issues() { return issues_; }
+	size_t count(int type) { return counts_[type]; }
+	size_t images() { return images_; }
+	size_t polygons() { return polygons_; }
+	size_t vertices() { return vertices_; }
+	
+	static const char* issueName(int type);
+
+private:
+	struct Partial {
+		std::vector<Issue> issues;
+		std::map<std::string, size_t> labels;
+		std::vector<size_t> area_histogram;
+		std::vector<size_t> count_histogram;
+		size_t polygons;
+		size_t vertices;
+	};
+	
+	void checkImage(const std::string &name, const MyPolygonDrawer &drawer, const std::string &image_dir, Partial &out);
+	
+	ThreadPool &pool_;
+	double min_area_px_;
+	
+	std::vector<Issue> issues_;
+	std::vector<size_t> counts_;
+	std::map<std::string, size_t> labels_;
+	std::vector<size_t> area_histogram_;    // polygon area as a fraction of the image, per decade
+	std::vector<size_t> count_histogram_;   // polygons per image, power-of-two buckets
+	size_t images_;
+	size_t polygons_;
+	size_t vertices_;
+	size_t max_polygons_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "async_writer.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+AsyncWriter::AsyncWriter(size_t max_pending)
+	: max_pending_(std::max<size_t>(max_pending, 1))
+	, written_(0)
+	, bytes_(0)
+	, failures_(0)
+	, stop_(false)
+{
+	worker_ = std::thread(&AsyncWriter::workerLoop, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+	this->finish();
+}
+
+void AsyncWriter::write(const std::string &filename, std::vector<unsigned char> &content)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	space_cond_.wait(lock, [this] { return jobs_.size() < max_pending_; });
+	jobs_.push_back(Job());
+	jobs_.back().filename = filename;
+	jobs_.back().content.swap(content);
+	work_cond_.notify_one();
+}
+
+int AsyncWriter::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	work_cond_.notify_one();
+	if (worker_.joinable()) {
+		worker_.join();
+	}
+	return failures_;
+}
+
+void AsyncWriter::workerLoop()
+{
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+			if (jobs_.empty()) return;
+			job.filename.swap(jobs_.front().filename);
+			job.content.swap(jobs_.front().content);
+			jobs_.pop_front();
+		}
+		space_cond_.notify_one();
+		
+		if (this->writeFile(job)) {
+			written_++;
+			bytes_ += job.content.size();
+		} else {
+			failures_++;
+			std::cout << utils::getBashColorText("[Error] Failed to write " + job.filename, 'r', 'b') << std::endl;
+		}
+	}
+}
+
+bool AsyncWriter::writeFile(const Job &job)
+{
+	// Outputs mirror the image tree, so the same few directories come up again and again
+	std::string dir = boost::filesystem::path(job.filename).parent_path().string();
+	if (!dir.empty() && created_dirs_.count(dir) == 0) {
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(dir, ec);
+		if (ec) return false;
+		created_dirs_.insert(dir);
+	}
+	
+	FILE *file = fopen(job.filename.c_str(), "wb");
+	if (file == NULL) return false;
+	size_t n = job.content.empty() ? 0 : fwrite(job.content.data(), 1, job.content.size(), file);
+	bool ok = (n == job.content.size());
+	ok = (fclose(file) == 0) && ok;
+	return ok;
+}
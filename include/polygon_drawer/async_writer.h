@@ -0,0 +1,49 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Writes encoded files on a dedicated thread so that producers keep
+// encoding while the disk catches up. write() blocks once 'max_pending'
+// buffers are queued, which bounds the memory held by the pipeline.
+class AsyncWriter {
+public:
+	AsyncWriter(size_t max_pending = 64);
+	~AsyncWriter();
+	void write(const std::string &filename, std::vector<unsigned char> &content);
+	int finish();
+	
+	size_t written() { return written_; }
+	size_t bytes() { return bytes_; }
+
+private:
+	struct Job {
+		std::string filename;
+		std::vector<unsigned char> content;
+	};
+	
+	void workerLoop();
+	bool writeFile(const Job &job);
+	
+	std::deque<Job> jobs_;
+	std::set<std::string> created_dirs_;
+	size_t max_pending_;
+	size_t written_;
+	size_t bytes_;
+	int failures_;
+	bool stop_;
+	
+	std::mutex mutex_;
+	std::condition_variable work_cond_;
+	std::condition_variable space_cond_;
+	std::thread worker_;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+
+// Lock-free bounded queue for any number of producers and consumers, after
+// Dmitry Vyukov's design: every cell carries a sequence number that tells a
+// producer whether the cell is free and a consumer whether it is filled, so
+// the only contended operation is one CAS on the head or the tail. The
+// editor uses it as MPSC (input events to the model thread) and SPSC
+// (prompt requests to the console thread). push() never blocks and fails
+// when the queue is full.
+template<typename T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity = 1024)
+		: enqueue_pos_(0), dequeue_pos_(0)
+	{
+		size_t size = 2;
+		while (size < capacity) size <<= 1;
+		mask_ = size - 1;
+		cells_.reset(new Cell[size]);
+		for (size_t i=0; i<size; i++) {
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	
+	bool push(T item) {
+		Cell *cell;
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+			if (diff == 0) {
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(item);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	
+	bool pop(T &item) {
+		Cell *cell;
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		item = std::move(cell->data);
+		// Drop whatever the moved-from value still holds, e.g. a cv::Mat reference
+		cell->data = T();
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+	
+	size_t capacity() { return mask_ + 1; }
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+	
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+	
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	// Separate cache lines so that producers and the consumer do not share one
+	alignas(64) std::atomic<size_t> enqueue_pos_;
+	alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
+#endif
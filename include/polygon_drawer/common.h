@@ -21,7 +21,56 @@ struct MyPolygon {
 struct LabelImageInfo {
 	std::string name;
 	std::string filename;
-	cv::Mat image;
+	cv::Size size;          // from the file header, (0, 0) when unknown
+	uint64_t file_size;
+	int64_t mtime;
+	
+	LabelImageInfo()
+		: size(0, 0), file_size(0), mtime(0)
+	{}
+};
+
+struct EditorOptions {
+	int image_cache_mb;
+	int prefetch_radius;
+	int scan_threads;       // 0 uses every core
+	bool probe_image_size;
+	bool autosave;          // write a shard for each edited image when leaving it
+	int viewport_width;     // window size limit, larger images are shown scaled down
+	int viewport_height;
+	int tile_size;          // edge of a pyramid tile in pixels
+	int tile_cache_mb;      // memory budget for downscaled tiles (LRU)
+	bool profile;           // stage timers, the HUD and a trace file on exit
+	bool show_hud;          // frame-time overlay at start, toggled with 'h'
+	bool proposals;         // snap polygons onto objects with 's'
+	int proposal_threads;   // background threads for the proposals, kept off the editor threads
+	int worker_index;       // this process annotates the images with annotation_io::workerOf == worker_index
+	int worker_count;       // 1 is the single-process mode that writes polygon_drawer.yaml itself
+	bool display_cache;     // keep the reduced copies of large images on disk
+	std::string display_cache_dir;   // empty uses results_dir/display_cache
+	bool watch_source_dir;  // pick up images added, removed or renamed in source_image_dir while running
+	int watch_debounce_ms;  // changes are applied once the directory was quiet this long
+
+	EditorOptions()
+		: image_cache_mb(1024)
+		, prefetch_radius(2)
+		, scan_threads(0)
+		, probe_image_size(true)
+		, autosave(true)
+		, viewport_width(1280)
+		, viewport_height(800)
+		, tile_size(256)
+		, tile_cache_mb(256)
+		, profile(true)
+		, show_hud(false)
+		, proposals(true)
+		, proposal_threads(1)
+		, worker_index(0)
+		, worker_count(1)
+		, display_cache(true)
+		, watch_source_dir(true)
+		, watch_debounce_ms(250)
+	{}
 };
 
 #endif
@@ -0,0 +1,220 @@
+#include "dataset_export.h"
+#include "async_writer.h"
+#include "utils.h"
+
+#include <cstdarg>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+namespace {
+	void appendf(std::string &out, const char *fmt, ...)
+	{
+		char buffer[256];
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(buffer, sizeof(buffer), fmt, args);
+		va_end(args);
+		if (n <= 0) return;
+		if (size_t(n) < sizeof(buffer)) {
+			out.append(buffer, size_t(n));
+			return;
+		}
+		
+		// Long ids or many-digit coordinates: formatted again straight into the output
+		size_t size = out.size();
+		out.resize(size + size_t(n) + 1);
+		va_start(args, fmt);
+		vsnprintf(&out[size], size_t(n) + 1, fmt, args);
+		va_end(args);
+		out.resize(size + size_t(n));
+	}
+}
+
+DatasetExporter::DatasetExporter(ThreadPool &pool, const annotation_io::ClassMap &classes, size_t batch_size)
+	: pool_(pool)
+	, classes_(classes)
+	, batch_size_(std::max<size_t>(batch_size, 1))
+	, images_(0)
+	, polygons_(0)
+	, skipped_(0)
+{
+}
+
+double DatasetExporter::polygonArea(const std::vector<cv::Point2f> &points)
+{
+	double area = 0.0;
+	for (size_t i=0, j=points.size()-1; i<points.size(); j=i++) {
+		area += double(points[j].x) * points[i].y - double(points[i].x) * points[j].y;
+	}
+	return std::fabs(area) * 0.5;
+}
+
+void DatasetExporter::formatBatch(std::vector<DrawerMap::iterator> &items, size_t begin, size_t end,
+	const std::function<std::string(size_t, size_t&)> &format, std::vector<std::string> &chunks)
+{
+	chunks.assign(end - begin, std::string());
+	std::vector<size_t> counts(end - begin, 0);
+	pool_.parallelFor(end - begin, [&](size_t k) {
+		chunks[k] = format(begin + k, counts[k]);
+	});
+	for (size_t k=0; k<counts.size(); k++) {
+		polygons_ += counts[k];
+		skipped_ += items[begin + k]->second.getPolygons().size() - counts[k];
+	}
+}
+
+std::string DatasetExporter::cocoAnnotations(const MyPolygonDrawer &drawer, int image_id, int64_t first_id, size_t &n_written)
+{
+	std::string out;
+	std::vector<cv::Point2f> points;
+	cv::Size size = drawer.getImageSize();
+	const PolygonStore &polygons = drawer.getPolygons();
+	
+	int64_t id = first_id;
+	for (PolygonStore::const_iterator it = polygons.begin(); it != polygons.end(); ++it, id++) {
+		PolygonStore::View polygon = *it;
+		int category = annotation_io::classOf(classes_, polygon.id());
+		if (polygon.size() < 3 || category == 0) continue;
+		
+		// Stored coordinates are normalized to [0, 1], COCO wants pixels
+		points.resize(polygon.size());
+		float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+		for (size_t k=0; k<polygon.size(); k++) {
+			points[k] = cv::Point2f(polygon[k].x * size.width, polygon[k].y * size.height);
+			x0 = std::min(x0, points[k].x);
+			y0 = std::min(y0, points[k].y);
+			x1 = std::max(x1, points[k].x);
+			y1 = std::max(y1, points[k].y);
+		}
+		
+		if (!out.empty()) out += ",\n";
+		appendf(out, "  {\"id\": %lld, \"image_id\": %d, \"category_id\": %d, \"iscrowd\": 0, \"segmentation\": [[",
+			(long long)id, image_id, category);
+		for (size_t k=0; k<points.size(); k++) {
+			appendf(out, k == 0 ? "%.2f, %.2f" : ", %.2f, %.2f", points[k].x, points[k].y);
+		}
+		appendf(out, "]], \"area\": %.2f, \"bbox\": [%.2f, %.2f, %.2f, %.2f]}",
+			this->polygonArea(points), x0, y0, x1 - x0, y1 - y0);
+		n_written++;
+	}
+	return out;
+}
+
+std::string DatasetExporter::yoloLines(const MyPolygonDrawer &drawer, size_t &n_written)
+{
+	std::string out;
+	const PolygonStore &polygons = drawer.getPolygons();
+	for (PolygonStore::const_iterator it = polygons.begin(); it != polygons.end(); ++it) {
+		PolygonStore::View polygon = *it;
+		int category = annotation_io::classOf(classes_, polygon.id());
+		if (polygon.size() < 3 || category == 0) continue;
+		
+		appendf(out, "%d", category - 1);
+		for (size_t k=0; k<polygon.size(); k++) {
+			float x = std::min(std::max(polygon[k].x, 0.0f), 1.0f);
+			float y = std::min(std::max(polygon[k].y, 0.0f), 1.0f);
+			appendf(out, " %.6f %.6f", x, y);
+		}
+		out += "\n";
+		n_written++;
+	}
+	return out;
+}
+
+bool DatasetExporter::writeCoco(DrawerMap &drawers, const std::string &filename)
+{
+	images_ = polygons_ = skipped_ = 0;
+	std::vector<DrawerMap::iterator> items;
+	std::vector<int64_t> first_ids;
+	int64_t next_id = 1;
+	for (DrawerMap::iterator it = drawers.begin(); it != drawers.end(); it++) {
+		items.push_back(it);
+		first_ids.push_back(next_id);
+		next_id += it->second.getPolygons().size();
+	}
+	
+	// Streamed to a temporary file and renamed at the end, like the YAML
+	std::string tmp = filename + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL) return false;
+	std::vector<char> file_buffer(1 << 20);
+	setvbuf(file, file_buffer.data(), _IOFBF, file_buffer.size());
+	
+	fprintf(file, "{\n\"info\": {\"description\": \"polygon_drawer export\", \"date_created\": \"%s\"},\n", utils::getLocaltime(0).c_str());
+	fprintf(file, "\"images\": [\n");
+	for (size_t i=0; i<items.size(); i++) {
+		cv::Size size = items[i]->second.getImageSize();
+		fprintf(file, "%s  {\"id\": %d, \"file_name\": \"%s\", \"width\": %d, \"height\": %d}", i > 0 ? ",\n" : "",
+			int(i + 1), utils::jsonEscape(items[i]->first).c_str(), size.width, size.height);
+	}
+	images_ = items.size();
+	
+	fprintf(file, "\n],\n\"annotations\": [\n");
+	bool first = true;
+	std::vector<std::string> chunks;
+	for (size_t begin=0; begin<items.size(); begin+=batch_size_) {
+		size_t end = std::min(begin + batch_size_, items.size());
+		this->formatBatch(items, begin, end, [&](size_t i, size_t &n) {
+			return this->cocoAnnotations(items[i]->second, int(i + 1), first_ids[i], n);
+		}, chunks);
+		for (size_t k=0; k<chunks.size(); k++) {
+			if (chunks[k].empty()) continue;
+			if (!first) fputs(",\n", file);
+			fwrite(chunks[k].data(), 1, chunks[k].size(), file);
+			first = false;
+		}
+	}
+	
+	fprintf(file, "\n],\n\"categories\": [\n");
+	std::vector<std::pair<int, std::string> > categories;
+	for (annotation_io::ClassMap::const_iterator it = classes_.begin(); it != classes_.end(); it++) {
+		categories.push_back(std::make_pair(it->second, it->first));
+	}
+	std::sort(categories.begin(), categories.end());
+	for (size_t i=0; i<categories.size(); i++) {
+		fprintf(file, "%s  {\"id\": %d, \"name\": \"%s\"}", i > 0 ? ",\n" : "", categories[i].first, utils::jsonEscape(categories[i].second).c_str());
+	}
+	fprintf(file, "\n]\n}\n");
+	
+	bool ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool DatasetExporter::writeYolo(DrawerMap &drawers, const std::string &out_dir)
+{
+	images_ = polygons_ = skipped_ = 0;
+	std::vector<DrawerMap::iterator> items;
+	for (DrawerMap::iterator it = drawers.begin(); it != drawers.end(); it++) {
+		items.push_back(it);
+	}
+	
+	AsyncWriter writer(2 * batch_size_);
+	std::vector<std::string> chunks;
+	std::vector<unsigned char> content;
+	for (size_t begin=0; begin<items.size(); begin+=batch_size_) {
+		size_t end = std::min(begin + batch_size_, items.size());
+		this->formatBatch(items, begin, end, [&](size_t i, size_t &n) {
+			return this->yoloLines(items[i]->second, n);
+		}, chunks);
+		
+		// Images without polygons still get an empty label file, YOLO reads that as background
+		for (size_t k=0; k<chunks.size(); k++) {
+			boost::filesystem::path path = boost::filesystem::path(out_dir) / items[begin + k]->first;
+			content.assign(chunks[k].begin(), chunks[k].end());
+			writer.write(path.replace_extension(".txt").string(), content);
+		}
+	}
+	
+	std::string class_text = annotation_io::formatClasses(classes_);
+	content.assign(class_text.begin(), class_text.end());
+	writer.write((boost::filesystem::path(out_dir) / "classes.txt").string(), content);
+	images_ = items.size();
+	return writer.finish() == 0;
+}
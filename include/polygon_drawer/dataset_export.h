@@ -0,0 +1,43 @@
+#ifndef DATASET_EXPORT_H
+#define DATASET_EXPORT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include "polygon_drawer/annotation_io.h"
+#include "polygon_drawer/thread_pool.h"
+
+// Exports the drawers to training formats. Images are processed in batches:
+// each batch is formatted in parallel on the pool, then written in image
+// name order, so the output is deterministic and only one batch of text
+// is held in memory at a time.
+//   COCO      one instance-segmentation JSON file, streamed to disk
+//   YOLO-seg  one "<class> x1 y1 x2 y2 ..." text file per image, 0-based classes
+class DatasetExporter {
+public:
+	DatasetExporter(ThreadPool &pool, const annotation_io::ClassMap &classes, size_t batch_size = 256);
+	bool writeCoco(DrawerMap &drawers, const std::string &filename);
+	bool writeYolo(DrawerMap &drawers, const std::string &out_dir);
+	
+	size_t images() { return images_; }
+	size_t polygons() { return polygons_; }
+	size_t skipped() { return skipped_; }
+	
+	static double polygonArea(const std::vector<cv::Point2f> &points);
+
+private:
+	std::string cocoAnnotations(const MyPolygonDrawer &drawer, int image_id, int64_t first_id, size_t &n_written);
+	std::string yoloLines(const MyPolygonDrawer &drawer, size_t &n_written);
+	void formatBatch(std::vector<DrawerMap::iterator> &items, size_t begin, size_t end,
+		const std::function<std::string(size_t, size_t&)> &format, std::vector<std::string> &chunks);
+	
+	ThreadPool &pool_;
+	annotation_io::ClassMap classes_;
+	size_t batch_size_;
+	size_t images_;
+	size_t polygons_;
+	size_t skipped_;
+};
+
+#endif
@@ -0,0 +1,323 @@
+#include "directory_watcher.h"
+#include "image_scanner.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <boost/filesystem.hpp>
+
+namespace {
+	// Files are picked up when their writer closes them, not when they appear half written
+	const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+	
+	std::string join(const std::string &dir, const std::string &entry)
+	{
+		return dir.empty() ? entry : dir + "/" + entry;
+	}
+	
+	bool isBelow(const std::string &name, const std::string &dir)
+	{
+		return name.size() > dir.size() && name.compare(0, dir.size(), dir) == 0 && name[dir.size()] == '/';
+	}
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string &root, Callback callback, int debounce_ms, int max_delay_ms, bool probe_size)
+	: root_(root)
+	, callback_(callback)
+	, debounce_ms_(debounce_ms)
+	, max_delay_ms_(std::max(max_delay_ms, debounce_ms))
+	, probe_size_(probe_size)
+	, fd_(-1)
+	, stop_(false)
+	, overflowed_(false)
+	, watch_limit_warned_(false)
+	, first_ns_(0)
+	, last_ns_(0)
+{
+	while (root_.size() > 1 && root_[root_.size() - 1] == '/') {
+		root_.erase(root_.size() - 1);
+	}
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	this->stop();
+}
+
+bool DirectoryWatcher::start()
+{
+	if (fd_ >= 0) return true;
+	fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd_ < 0) {
+		std::cout << utils::getBashColorText("[Warning] Cannot watch " + root_ + ": inotify is not available", 'y', 'b') << std::endl;
+		return false;
+	}
+	if (!this->watchTree("", NULL)) {
+		std::cout << utils::getBashColorText("[Warning] Cannot watch " + root_, 'y', 'b') << std::endl;
+		::close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	stop_ = false;
+	thread_ = std::thread(&DirectoryWatcher::loop, this);
+	return true;
+}
+
+void DirectoryWatcher::stop()
+{
+	stop_ = true;
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	if (fd_ >= 0) {
+		::close(fd_);
+		fd_ = -1;
+	}
+	dirs_.clear();
+}
+
+std::string DirectoryWatcher::absolute(const std::string &name)
+{
+	return name.empty() ? root_ : root_ + "/" + name;
+}
+
+// Watches 'dir' and the directories below it; with 'files', also lists the images already there,
+// which were written before the watch could see them
+bool DirectoryWatcher::watchTree(const std::string &dir, std::vector<std::string> *files)
+{
+	int wd = inotify_add_watch(fd_, this->absolute(dir).c_str(), WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOSPC && !watch_limit_warned_) {
+			std::cout << utils::getBashColorText("[Warning] Out of inotify watches, raise fs.inotify.max_user_watches to follow all of " + root_, 'y', 'b') << std::endl;
+			watch_limit_warned_ = true;
+		}
+		return false;
+	}
+	dirs_[wd] = dir;
+	
+	boost::system::error_code ec;
+	boost::filesystem::directory_iterator it(this->absolute(dir), ec), it_end;
+	for (; !ec && it != it_end; it.increment(ec)) {
+		// Like ImageScanner, symlinked directories are not followed
+		boost::filesystem::file_status link_status = it->symlink_status(ec);
+		if (ec) continue;
+		std::string name = join(dir, it->path().filename().string());
+		if (boost::filesystem::is_directory(link_status)) {
+			this->watchTree(name, files);
+		} else if (files != NULL && ImageScanner::isImageFile(name)) {
+			files->push_back(name);
+		}
+	}
+	return true;
+}
+
+void DirectoryWatcher::loop()
+{
+	// Aligned for the event headers
+	std::vector<uint64_t> buffer(64 * 1024 / sizeof(uint64_t));
+	char *data = reinterpret_cast<char*>(buffer.data());
+	size_t capacity = buffer.size() * sizeof(uint64_t);
+	
+	while (!stop_) {
+		// Short polls, so that stop() is never held up for long
+		int timeout_ms = 100;
+		if (!changes_.empty() || !moved_from_.empty() || overflowed_) {
+			int64_t now = Profiler::now();
+			int64_t quiet_ms = debounce_ms_ - (now - last_ns_) / 1000000;
+			int64_t due_ms = max_delay_ms_ - (now - first_ns_) / 1000000;
+			timeout_ms = int(std::max<int64_t>(0, std::min<int64_t>(timeout_ms, std::min(quiet_ms, due_ms))));
+			if (timeout_ms == 0) {
+				this->flush();
+				continue;
+			}
+		}
+		
+		struct pollfd fd = {fd_, POLLIN, 0};
+		if (poll(&fd, 1, timeout_ms) <= 0) continue;
+		
+		// Drained in one go; a burst fills the buffer many times before the batch is due
+		while (true) {
+			ssize_t length = read(fd_, data, capacity);
+			if (length <= 0) break;
+			int64_t now = Profiler::now();
+			if (changes_.empty() && moved_from_.empty() && !overflowed_) first_ns_ = now;
+			last_ns_ = now;
+			for (char *p = data; p < data + length; ) {
+				const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+				if (event->mask & IN_Q_OVERFLOW) {
+					overflowed_ = true;
+				} else if (event->mask & IN_IGNORED) {
+					dirs_.erase(event->wd);
+				} else if (event->len > 0) {
+					this->handle(event->wd, event->mask, event->cookie, event->name);
+				}
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+	}
+}
+
+void DirectoryWatcher::handle(int wd, uint32_t mask, uint32_t cookie, const std::string &entry)
+{
+	std::map<int, std::string>::iterator dir = dirs_.find(wd);
+	if (dir == dirs_.end()) return;
+	std::string name = join(dir->second, entry);
+	bool is_dir = (mask & IN_ISDIR) != 0;
+	bool is_image = !is_dir && ImageScanner::isImageFile(name);
+	
+	if (mask & IN_MOVED_FROM) {
+		if (!is_dir && !is_image) return;
+		Change change;
+		change.type = Change::REMOVED;
+		change.name = name;
+		change.is_dir = is_dir;
+		moved_from_[cookie] = change;
+		return;
+	}
+	
+	if (mask & IN_MOVED_TO) {
+		std::map<uint32_t, Change>::iterator from = moved_from_.find(cookie);
+		if (from == moved_from_.end()) {
+			// Moved in from outside the tree, e.g. the usual write-then-rename of an ingest job
+			if (is_dir) {
+				std::vector<std::string> files;
+				this->watchTree(name, &files);
+				for (size_t i=0; i<files.size(); i++) this->addFile(files[i]);
+			} else if (is_image) {
+				this->addFile(name);
+			}
+			return;
+		}
+		Change change = from->second;
+		moved_from_.erase(from);
+		if (change.is_dir != is_dir || (!is_dir && !is_image)) {
+			// Renamed to something that is no image, or not the same kind
+			this->push(change);
+			if (is_image) this->addFile(name);
+			return;
+		}
+		change.type = Change::RENAMED;
+		change.from = change.name;
+		change.name = name;
+		if (is_dir) {
+			// The watches stay with the moved directories, only their names change
+			for (std::map<int, std::string>::iterator it = dirs_.begin(); it != dirs_.end(); it++) {
+				if (it->second == change.from) {
+					it->second = name;
+				} else if (isBelow(it->second, change.from)) {
+					it->second = name + it->second.substr(change.from.size());
+				}
+			}
+		}
+		this->push(change);
+		return;
+	}
+	
+	if (is_dir) {
+		if (mask & IN_CREATE) {
+			std::vector<std::string> files;
+			this->watchTree(name, &files);
+			for (size_t i=0; i<files.size(); i++) this->addFile(files[i]);
+		} else if (mask & IN_DELETE) {
+			Change change;
+			change.type = Change::REMOVED;
+			change.name = name;
+			change.is_dir = true;
+			this->push(change);
+		}
+		return;
+	}
+	if (!is_image) return;
+	if (mask & IN_CLOSE_WRITE) {
+		this->addFile(name);
+	} else if (mask & IN_DELETE) {
+		Change change;
+		change.type = Change::REMOVED;
+		change.name = name;
+		this->push(change);
+	}
+}
+
+void DirectoryWatcher::addFile(const std::string &name)
+{
+	if (added_.count(name) > 0) return;
+	Change change;
+	change.type = Change::ADDED;
+	change.name = name;
+	added_[name] = changes_.size();
+	changes_.push_back(change);
+}
+
+void DirectoryWatcher::push(const Change &change)
+{
+	// A later write of the same name is a new ADDED, after this change
+	if (change.is_dir) {
+		added_.clear();
+	} else {
+		added_.erase(change.name);
+		added_.erase(change.from);
+	}
+	changes_.push_back(change);
+}
+
+void DirectoryWatcher::flush()
+{
+	// Moved out of the tree, the other half never came
+	for (std::map<uint32_t, Change>::iterator it = moved_from_.begin(); it != moved_from_.end(); it++) {
+		const Change &change = it->second;
+		if (change.is_dir) {
+			// Its watches would go on reporting a directory outside the tree
+			for (std::map<int, std::string>::iterator d = dirs_.begin(); d != dirs_.end(); ) {
+				if (d->second == change.name || isBelow(d->second, change.name)) {
+					inotify_rm_watch(fd_, d->first);
+					dirs_.erase(d++);
+				} else {
+					d++;
+				}
+			}
+		}
+		this->push(change);
+	}
+	moved_from_.clear();
+	
+	std::shared_ptr<Batch> batch(new Batch());
+	if (overflowed_) {
+		// Events were lost; directories created meanwhile are watched now, and the whole list is read again
+		std::cout << utils::getBashColorText("[Warning] Too many changes at once in " + root_ + ", scanning it again", 'y', 'b') << std::endl;
+		this->watchTree("", NULL);
+		ImageScanner scanner(0, probe_size_);
+		scanner.scan(root_, batch->images);
+		batch->rescanned = true;
+		// The scan cannot tell a rename from a delete and an add; the renames that did
+		// arrive go along, so that the annotations still follow their images
+		for (size_t i=0; i<changes_.size(); i++) {
+			if (changes_[i].type == Change::RENAMED) batch->changes.push_back(changes_[i]);
+		}
+	} else {
+		// The files are complete by now, so their size and header are read here, off the editor threads
+		batch->changes.reserve(changes_.size());
+		for (size_t i=0; i<changes_.size(); i++) {
+			Change &change = changes_[i];
+			if (change.type == Change::ADDED || (change.type == Change::RENAMED && !change.is_dir)) {
+				LabelImageInfo &info = change.info;
+				info.name = change.name;
+				info.filename = this->absolute(change.name);
+				if (!ImageScanner::statFile(info.filename, info.file_size, info.mtime)) {
+					// Gone again before the batch was due, a later event says so
+					if (change.type == Change::ADDED) continue;
+				} else if (probe_size_) {
+					ImageScanner::probeImageSize(info.filename, info.size);
+				}
+			}
+			batch->changes.push_back(change);
+		}
+	}
+	changes_.clear();
+	added_.clear();
+	overflowed_ = false;
+	callback_(batch);
+}
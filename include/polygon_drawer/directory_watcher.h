@@ -0,0 +1,86 @@
+#ifndef DIRECTORY_WATCHER_H
+#define DIRECTORY_WATCHER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <stdint.h>
+#include "polygon_drawer/common.h"
+
+// Follows a directory tree with inotify, so that the image list can change
+// while the editor runs. Events are collected on a thread of its own and
+// handed over in batches: once the tree has been quiet for debounce_ms, and
+// at the latest max_delay_ms after the first event of a batch, so a burst of
+// thousands of files costs a few updates. Files count once they are closed
+// after writing or moved in; a move inside the tree is reported as a rename,
+// which lets the annotations follow the image. Names are paths relative to
+// the root, as ImageScanner gives them.
+class DirectoryWatcher {
+public:
+	struct Change {
+		enum Type { ADDED, REMOVED, RENAMED };
+		
+		int type;
+		std::string name;       // the new name for RENAMED
+		std::string from;       // RENAMED
+		bool is_dir;            // REMOVED and RENAMED: everything below the directory
+		LabelImageInfo info;    // ADDED and a RENAMED file, stat and size taken when the batch is handed over
+		
+		Change() : type(ADDED), is_dir(false) {}
+	};
+	
+	// Changes in event order; ADDED also stands for an image that was written again
+	struct Batch {
+		std::vector<Change> changes;
+		bool rescanned;                     // the kernel dropped events, 'images' is the whole tree instead and 'changes' only holds the renames
+		std::vector<LabelImageInfo> images;
+		
+		Batch() : rescanned(false) {}
+	};
+	typedef std::function<void(std::shared_ptr<Batch>)> Callback;
+	
+	DirectoryWatcher(const std::string &root, Callback callback, int debounce_ms = 250, int max_delay_ms = 1000, bool probe_size = true);
+	~DirectoryWatcher();
+	bool start();
+	void stop();
+	bool running() { return fd_ >= 0; }
+
+private:
+	// Owns the inotify descriptor and the thread
+	DirectoryWatcher(const DirectoryWatcher&);
+	DirectoryWatcher& operator=(const DirectoryWatcher&);
+	
+	void loop();
+	bool watchTree(const std::string &dir, std::vector<std::string> *files);
+	void handle(int wd, uint32_t mask, uint32_t cookie, const std::string &entry);
+	void addFile(const std::string &name);
+	void push(const Change &change);
+	void flush();
+	std::string absolute(const std::string &name);
+	
+	std::string root_;
+	Callback callback_;
+	int debounce_ms_;
+	int max_delay_ms_;
+	bool probe_size_;
+	int fd_;
+	std::atomic<bool> stop_;
+	std::thread thread_;
+	
+	// Watcher thread
+	std::map<int, std::string> dirs_;           // watch descriptor -> directory relative to the root, "" for the root
+	std::map<uint32_t, Change> moved_from_;     // by cookie, until the other half of the move arrives
+	std::vector<Change> changes_;
+	std::map<std::string, size_t> added_;       // name -> its ADDED in changes_, repeated writes are reported once
+	bool overflowed_;
+	bool watch_limit_warned_;
+	int64_t first_ns_;                          // first and last event of the pending batch
+	int64_t last_ns_;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "display_cache.h"
+#include "image_scanner.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+namespace {
+	const char MAGIC[4] = {'P', 'D', 'D', 'C'};
+	const uint32_t VERSION = 1;
+	// Pixels start on a page boundary, so the mapping of the pixel rows is page aligned
+	const uint32_t HEADER_BYTES = 4096;
+	
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t rows;
+		uint32_t cols;
+		uint32_t type;
+		uint32_t full_width;
+		uint32_t full_height;
+		uint32_t path_length;   // the source path follows the header, to tell hash collisions apart
+		uint64_t file_size;
+		int64_t mtime;
+		uint64_t pixel_bytes;
+	};
+	
+	uint64_t fnv1a(const std::string &text, uint64_t hash = 14695981039346656037ull)
+	{
+		for (size_t i=0; i<text.size(); i++) {
+			hash ^= (unsigned char) text[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+	
+	bool writeAll(int fd, const char *data, size_t length)
+	{
+		while (length > 0) {
+			ssize_t n = write(fd, data, length);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) return false;
+			data += n;
+			length -= size_t(n);
+		}
+		return true;
+	}
+}
+
+DisplayCache::DisplayCache(const std::string &dir, cv::Size max_size)
+	: dir_(dir)
+	, max_size_(max_size)
+	, hits_(0)
+	, misses_(0)
+{
+	if (!dir_.empty()) {
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(dir_, ec);
+		if (ec) {
+			std::cout << utils::getBashColorText("[Warning] Display cache disabled, cannot create " + dir_, 'y', 'b') << std::endl;
+			dir_.clear();
+		}
+	}
+}
+
+int DisplayCache::reductionFor(cv::Size full_size, cv::Size max_size)
+{
+	// The copy must not be smaller than the image as shown at the fitted zoom
+	if (full_size.width <= 0 || full_size.height <= 0) return 1;
+	double zoom = std::min(1.0, std::min(double(max_size.width) / full_size.width, double(max_size.height) / full_size.height));
+	int factor = 1;
+	while (factor < 8 && 2.0 * factor * zoom <= 1.0) factor *= 2;
+	return factor;
+}
+
+std::string DisplayCache::entryPath(const std::string &filename, uint64_t file_size, int64_t mtime)
+{
+	uint64_t hash = fnv1a(filename);
+	hash = fnv1a(cv::format("|%llu|%lld|%dx%d", (unsigned long long) file_size, (long long) mtime, max_size_.width, max_size_.height), hash);
+	return cv::format("%s/%016llx.raw", dir_.c_str(), (unsigned long long) hash);
+}
+
+cv::Mat DisplayCache::load(const std::string &filename, cv::Size &full_size)
+{
+	full_size = cv::Size(0, 0);
+	uint64_t file_size = 0;
+	int64_t mtime = 0;
+	// Without a directory, or for a file that cannot be stat'ed, the copy is decoded every time and only kept in memory
+	bool keep = this->enabled() && ImageScanner::statFile(filename, file_size, mtime);
+	cv::Mat image;
+	std::string path;
+	if (keep) {
+		path = this->entryPath(filename, file_size, mtime);
+		if (this->read(path, filename, file_size, mtime, image, full_size)) {
+			hits_++;
+			return image;
+		}
+		misses_++;
+	}
+	
+	// The header gives the factor before decoding; without it, decode in full and shrink
+	cv::Size probed;
+	ImageScanner::probeImageSize(filename, probed);
+	int factor = reductionFor(probed, max_size_);
+	static const int reduced_flags[4] = {cv::IMREAD_COLOR, cv::IMREAD_REDUCED_COLOR_2, cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_8};
+	image = cv::imread(filename, reduced_flags[factor == 8 ? 3 : factor / 2]);
+	if (image.empty()) return image;
+	
+	if (probed.width > 0 && probed.height > 0) {
+		// imread applies the EXIF orientation, the header does not
+		full_size = ((image.cols > image.rows) == (probed.width > probed.height)) ? probed : cv::Size(probed.height, probed.width);
+	} else {
+		full_size = image.size();
+		factor = reductionFor(full_size, max_size_);
+		if (factor > 1) {
+			cv::resize(image, image, cv::Size((full_size.width + factor - 1) / factor, (full_size.height + factor - 1) / factor), 0, 0, cv::INTER_AREA);
+		}
+	}
+	
+	if (keep && !this->write(path, filename, file_size, mtime, image, full_size)) {
+		std::cout << utils::getBashColorText("[Warning] Failed to write the display cache entry " + path, 'y', 'b') << std::endl;
+	}
+	return image;
+}
+
+bool DisplayCache::read(const std::string &path, const std::string &filename, uint64_t file_size, int64_t mtime, cv::Mat &image, cv::Size &full_size)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)HEADER_BYTES) {
+		::close(fd);
+		return false;
+	}
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) return false;
+	// One sequential pass over the pixels
+	madvise(addr, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	
+	const char *data = static_cast<const char*>(addr);
+	const Header &h = *reinterpret_cast<const Header*>(data);
+	uint64_t row_bytes = uint64_t(h.cols) * CV_ELEM_SIZE(h.type);
+	bool ok = memcmp(h.magic, MAGIC, 4) == 0 && h.version == VERSION && h.type == CV_8UC3;
+	ok = ok && h.file_size == file_size && h.mtime == mtime && h.path_length == filename.size();
+	ok = ok && sizeof(Header) + h.path_length <= HEADER_BYTES;
+	ok = ok && h.pixel_bytes == row_bytes * h.rows && uint64_t(st.st_size) == HEADER_BYTES + h.pixel_bytes;
+	ok = ok && memcmp(data + sizeof(Header), filename.data(), filename.size()) == 0;
+	if (ok) {
+		// A copy, so that the Mat owns its pixels and the mapping can go right away
+		image.create(int(h.rows), int(h.cols), int(h.type));
+		const char *pixels = data + HEADER_BYTES;
+		for (uint32_t y=0; y<h.rows; y++) {
+			memcpy(image.ptr<uchar>(int(y)), pixels + y * row_bytes, row_bytes);
+		}
+		full_size = cv::Size(int(h.full_width), int(h.full_height));
+	}
+	munmap(addr, st.st_size);
+	return ok;
+}
+
+bool DisplayCache::write(const std::string &path, const std::string &filename, uint64_t file_size, int64_t mtime, const cv::Mat &image, cv::Size full_size)
+{
+	if (image.type() != CV_8UC3 || sizeof(Header) + filename.size() > HEADER_BYTES) return false;
+	
+	std::vector<char> header(HEADER_BYTES, 0);
+	Header &h = *reinterpret_cast<Header*>(header.data());
+	memcpy(h.magic, MAGIC, 4);
+	h.version = VERSION;
+	h.rows = uint32_t(image.rows);
+	h.cols = uint32_t(image.cols);
+	h.type = uint32_t(image.type());
+	h.full_width = uint32_t(full_size.width);
+	h.full_height = uint32_t(full_size.height);
+	h.path_length = uint32_t(filename.size());
+	h.file_size = file_size;
+	h.mtime = mtime;
+	size_t row_bytes = size_t(image.cols) * image.elemSize();
+	h.pixel_bytes = uint64_t(row_bytes) * image.rows;
+	memcpy(header.data() + sizeof(Header), filename.data(), filename.size());
+	
+	// Renamed into place, so a reader never maps a partial file. Unlike the annotations it is
+	// not synced: a torn entry after a crash fails the size check and is decoded again
+	std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+	int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+	bool ok = writeAll(fd, header.data(), header.size());
+	for (int y=0; ok && y<image.rows; y++) {
+		ok = writeAll(fd, image.ptr<char>(y), row_bytes);
+	}
+	ok = (::close(fd) == 0) && ok;
+	if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,40 @@
+#ifndef DISPLAY_CACHE_H
+#define DISPLAY_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+
+// Display-resolution copies of the source images, kept on disk across
+// sessions. An image is decoded once with the largest IMREAD_REDUCED_COLOR_*
+// factor that still fills the window at the fitted zoom, and stored as raw
+// pixels behind a page-sized header in dir/<hash of path, mtime, size>.raw;
+// a changed source file gets a new key, stale entries are simply never read
+// again. Loading maps the file and copies the rows out, so a warm start
+// costs a page-in instead of a JPEG decode. The full image size is kept in
+// the header: annotations are normalized and saved with the original w/h.
+// Without a directory the copy is made the same way on every load.
+class DisplayCache {
+public:
+	DisplayCache(const std::string &dir = "", cv::Size max_size = cv::Size(1280, 800));
+	bool enabled() { return !dir_.empty(); }
+	const std::string &dir() { return dir_; }
+	cv::Mat load(const std::string &filename, cv::Size &full_size);
+	size_t hits() { return hits_; }
+	size_t misses() { return misses_; }
+	
+	static int reductionFor(cv::Size full_size, cv::Size max_size);
+
+private:
+	std::string entryPath(const std::string &filename, uint64_t file_size, int64_t mtime);
+	bool read(const std::string &path, const std::string &filename, uint64_t file_size, int64_t mtime, cv::Mat &image, cv::Size &full_size);
+	bool write(const std::string &path, const std::string &filename, uint64_t file_size, int64_t mtime, const cv::Mat &image, cv::Size full_size);
+	
+	std::string dir_;
+	cv::Size max_size_;
+	std::atomic<size_t> hits_;
+	std::atomic<size_t> misses_;
+};
+
+#endif
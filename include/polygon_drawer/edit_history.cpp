@@ -0,0 +1,82 @@
+#include "edit_history.h"
+
+EditHistory::EditHistory()
+{
+}
+
+EditHistory::EditHistory(const EditHistory &other)
+	: undo_(other.undo_)
+	, redo_(other.redo_)
+{
+}
+
+EditHistory& EditHistory::operator=(const EditHistory &other)
+{
+	if (this != &other) {
+		std::shared_ptr<Node> undo = other.undo_, redo = other.redo_;
+		this->clear();
+		undo_ = undo;
+		redo_ = redo;
+	}
+	return *this;
+}
+
+EditHistory::~EditHistory()
+{
+	this->clear();
+}
+
+void EditHistory::push(const PolygonStore &before)
+{
+	std::shared_ptr<Node> node = std::make_shared<Node>();
+	node->polygons = before;
+	node->next = undo_;
+	node->depth = this->undoDepth() + 1;
+	undo_ = node;
+	release(redo_);
+}
+
+bool EditHistory::undo(PolygonStore &current)
+{
+	if (!undo_) return false;
+	
+	std::shared_ptr<Node> node = std::make_shared<Node>();
+	node->polygons = current;
+	node->next = redo_;
+	node->depth = this->redoDepth() + 1;
+	redo_ = node;
+	current = undo_->polygons;
+	undo_ = undo_->next;
+	return true;
+}
+
+bool EditHistory::redo(PolygonStore &current)
+{
+	if (!redo_) return false;
+	
+	std::shared_ptr<Node> node = std::make_shared<Node>();
+	node->polygons = current;
+	node->next = undo_;
+	node->depth = this->undoDepth() + 1;
+	undo_ = node;
+	current = redo_->polygons;
+	redo_ = redo_->next;
+	return true;
+}
+
+void EditHistory::clear()
+{
+	release(undo_);
+	release(redo_);
+}
+
+void EditHistory::release(std::shared_ptr<Node> &top)
+{
+	// Unlinks the nodes only this history owns one at a time; letting the shared_ptr
+	// chain destroy itself would recurse once per version
+	while (top && top.use_count() == 1) {
+		std::shared_ptr<Node> next = std::move(top->next);
+		top = std::move(next);
+	}
+	top.reset();
+}
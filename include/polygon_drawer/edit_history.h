@@ -0,0 +1,41 @@
+#ifndef EDIT_HISTORY_H
+#define EDIT_HISTORY_H
+
+#include <memory>
+#include <stddef.h>
+#include "polygon_drawer/polygon_store.h"
+
+// Undo and redo stacks of polygon versions. Each stack is an immutable
+// linked list, so copying a history (e.g. with its drawer on an image
+// switch) copies two pointers, and every version shares all pages it did
+// not change with its neighbours: the memory grows with the edits, not
+// with the number of polygons.
+class EditHistory {
+public:
+	EditHistory();
+	EditHistory(const EditHistory &other);
+	EditHistory& operator=(const EditHistory &other);
+	~EditHistory();
+	
+	// Records the state before an edit; a new edit drops what could be redone
+	void push(const PolygonStore &before);
+	bool undo(PolygonStore &current);
+	bool redo(PolygonStore &current);
+	void clear();
+	size_t undoDepth() const { return undo_ ? undo_->depth : 0; }
+	size_t redoDepth() const { return redo_ ? redo_->depth : 0; }
+
+private:
+	struct Node {
+		PolygonStore polygons;
+		std::shared_ptr<Node> next;
+		size_t depth;
+	};
+	
+	static void release(std::shared_ptr<Node> &top);
+	
+	std::shared_ptr<Node> undo_;
+	std::shared_ptr<Node> redo_;
+};
+
+#endif
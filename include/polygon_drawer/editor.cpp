@@ -1,31 +1,109 @@
 #include "editor.h"
+#include "shape.h"
 #include "utils.h"
 
 #include <yaml-cpp/yaml.h>
 #include <fstream>
+#include <climits>
+#include <algorithm>
 
 MyPolygonDrawer::MyPolygonDrawer(int N)
 	: max_n_(N)
-	, last_active_region_("")
+	, active_slot_(-1)
 	, selected_pt_index_(-1)
+	, modified_(false)
+	, drag_recorded_(false)
+	, redraw_all_(true)
+	, label_cache_(NULL)
+	, index_valid_(false)
+	, hit_radius_(40)
+	, grid_cell_px_(0)
+	, hover_slot_(-1)
+	, hover_pt_index_(-1)
 {
 	this->reset();
 }
 
+MyPolygonDrawer::MyPolygonDrawer(const MyPolygonDrawer &other)
+{
+	this->assign(other);
+}
+
+MyPolygonDrawer& MyPolygonDrawer::operator=(const MyPolygonDrawer &other)
+{
+	if (this != &other) {
+		this->assign(other);
+	}
+	return *this;
+}
+
 MyPolygonDrawer::~MyPolygonDrawer()
 {
 }
 
+void MyPolygonDrawer::assign(const MyPolygonDrawer &other, bool with_history)
+{
+	// The polygons and the history share their pages with 'other', so switching images costs
+	// a pointer per page. The vertex grid is only a cache for editing and is rebuilt on demand;
+	// without the history the label sprites stay behind as well
+	colors_ = other.colors_;
+	polygons_ = other.polygons_;
+	max_n_ = other.max_n_;
+	active_slot_ = other.active_slot_;
+	selected_pt_index_ = other.selected_pt_index_;
+	image_size_ = other.image_size_;
+	last_mouse_pt_ = other.last_mouse_pt_;
+	view_ = other.view_;
+	modified_ = other.modified_;
+	duplicate_ids_ = other.duplicate_ids_;
+	if (with_history) {
+		history_ = other.history_;
+		label_sprites_ = other.label_sprites_;
+	} else {
+		history_.clear();
+		label_sprites_.clear();
+	}
+	drag_recorded_ = other.drag_recorded_;
+	dirty_rect_ = other.dirty_rect_;
+	redraw_all_ = other.redraw_all_;
+	label_cache_ = NULL;
+	this->releaseIndex();
+	hit_radius_ = other.hit_radius_;
+	grid_cell_px_ = 0;
+	hover_slot_ = other.hover_slot_;
+	hover_pt_index_ = other.hover_pt_index_;
+}
+
 void MyPolygonDrawer::setImageSize(cv::Size size)
 {
 	image_size_ = size;
+	this->releaseIndex();
+	this->invalidate();
+}
+
+void MyPolygonDrawer::setView(const Viewport &view)
+{
+	if (view.imageSize() != view_.imageSize()) this->releaseIndex();
+	view_ = view;
+	this->invalidate();
 }
 
 void MyPolygonDrawer::reset()
 {
 	polygons_.clear();
+	duplicate_ids_.clear();
+	history_.clear();
+	drag_recorded_ = false;
+	label_sprites_.clear();
+	this->releaseIndex();
+	active_slot_ = -1;
+	hover_slot_ = -1;
+	hover_pt_index_ = -1;
 	image_size_ = cv::Size(0, 0);
-	last_mouse_pt_ = cv::Point(0, 0);
+	last_mouse_pt_ = cv::Point2d(0.0, 0.0);
+	view_ = Viewport();
+	modified_ = false;
+	this->invalidate();
 	
 	// Assume 20 regions
 	for (int i=0; i<20; i++) {
@@ -33,28 +111,49 @@ void MyPolygonDrawer::reset()
 	}
 }
 
-void MyPolygonDrawer::addRegion(std::string id)
+void MyPolygonDrawer::reserve(size_t polygons, size_t vertices)
 {
-	if (!this->isOk(2)) return;
-	
-	if (id == "") return;
-	
+	polygons_.reserve(polygons, vertices);
+}
+
+void MyPolygonDrawer::addRegion(std::string id, std::mt19937 &rng)
+{
+	// The vertices come from the caller's generator, so that they do not depend on
+	// how many drawers, each drawing its colours from rand(), were built before
+	std::uniform_int_distribution<int> coordinate(0, 49);
 	std::vector<cv::Point2f> points;
 	points.resize(max_n_);
 	for (int i=0; i<max_n_; i++) {
-		cv::Point2f pt(float(rand() % 50) / 100.0, float(rand() % 50) / 100.0);
+		cv::Point2f pt(float(coordinate(rng)) / 100.0, float(coordinate(rng)) / 100.0);
 		points[i] = pt;
 	}
+	this->placeRegion(id, points);
+}
+
+void MyPolygonDrawer::placeRegion(const std::string &id, const std::vector<cv::Point2f> &points)
+{
+	if (!this->isOk(2)) return;
 	
-	polygons_.insert(std::pair<std::string, MyPolygon>(id, MyPolygon(id, points)));
+	if (id == "") return;
 	
-	last_active_region_ = id;
+	// Unlike the loaders' addRegion, an edit by the user: undoable and active right away
+	PolygonStore before = polygons_;
+	int slot = polygons_.insert(id, points);
+	if (slot >= 0) {
+		history_.push(before);
+		// A reused slot must not show the label of its previous owner
+		this->resetLabel(slot);
+		this->indexRegion(slot);
+		this->markDirty(slot);
+		active_slot_ = slot;
+		modified_ = true;
+	}
 	
 	std::stringstream text;
-	std::map<std::string, MyPolygon>::iterator it;
+	PolygonStore::const_iterator it;
 	for (it = polygons_.begin(); it != polygons_.end(); it++) {
-		text << " |-- Id: " << it->first 
-					<< ", size: " << it->second.points.size() << std::endl;
+		text << " |-- Id: " << (*it).idRef()
+					<< ", size: " << (*it).size() << std::endl;
 	}
 	
 	std::cout << " Add a new region: " << utils::getBashColorText(id, 'g', 'b') << std::endl;
@@ -62,31 +161,66 @@ void MyPolygonDrawer::addRegion(std::string id)
 }
 
 void MyPolygonDrawer::addRegion(std::string id, MyPolygon polygon)
+{
+	this->addRegion(id, polygon.points.data(), polygon.points.size());
+}
+
+void MyPolygonDrawer::addRegion(const std::string &id, const cv::Point2f *points, size_t n)
 {
 	if (!this->isOk(2)) return;
 	
 	if (id == "") return;
 	
-	polygons_.insert(std::pair<std::string, MyPolygon>(id, polygon));
+	int slot = polygons_.insert(id, points, n);
+	if (slot >= 0) {
+		// A reused slot must not show the label of its previous owner
+		this->resetLabel(slot);
+		this->indexRegion(slot);
+		this->markDirty(slot);
+		modified_ = true;
+	} else {
+		// An id that is already taken, from a file or a mask import; the copy is dropped and kept
+		// here so that validation can report it
+		duplicate_ids_.push_back(id);
+	}
+}
+
+bool MyPolygonDrawer::eraseRegion(int slot)
+{
+	if (!polygons_.valid(slot)) return false;
+	
+	history_.push(polygons_);
+	this->markDirty(slot);
+	this->unindexRegion(slot);
+	if (active_slot_ == slot) {
+		active_slot_ = -1;
+		selected_pt_index_ = -1;
+	}
+	if (hover_slot_ == slot) {
+		hover_slot_ = -1;
+		hover_pt_index_ = -1;
+	}
+	modified_ = true;
+	return polygons_.erase(slot);
 }
 
 void MyPolygonDrawer::deleteLastRegion()
 {
 	if (!this->isOk()) return;
 	
-	std::map<std::string, MyPolygon>::iterator it = --polygons_.end();
-	std::cout << utils::getBashColorText(" Deleting the region name: " + it->first, 'y', 'b') << std::endl;
-	polygons_.erase(it);
+	PolygonStore::View last = polygons_.back();
+	std::cout << utils::getBashColorText(" Deleting the region name: " + last.id(), 'y', 'b') << std::endl;
+	this->eraseRegion(last.slot());
 }
 
 void MyPolygonDrawer::deleteRegionById(std::string id)
 {
 	if (!this->isOk()) return;
 
-	std::map<std::string, MyPolygon>::iterator it = polygons_.find(id);
-	if (it != polygons_.end()) {
-		polygons_.erase(it);
-		std::cout << utils::getBashColorText(" Deleting the region name: " + it->first, 'y', 'b') << std::endl;
+	int slot = polygons_.find(id);
+	if (slot >= 0) {
+		std::cout << utils::getBashColorText(" Deleting the region name: " + id, 'y', 'b') << std::endl;
+		this->eraseRegion(slot);
 	}
 }
 
@@ -96,141 +230,415 @@ void MyPolygonDrawer::editRegionById(std::string id, std::string name)
 
 	if (name == "") return;
 	
-	std::map<std::string, MyPolygon>::iterator it = polygons_.find(id);
-	if (it != polygons_.end()) {
-		it->second.id = name;
-		MyPolygon polygon = it->second;
-		std::string text = cv::format("id '%s' was assigned a new name '%s'", it->first.c_str(), it->second.id.c_str());
-		polygons_.erase(it);
-		polygons_.insert(std::pair<std::string, MyPolygon>(name, polygon));
+	int slot = polygons_.find(id);
+	if (slot >= 0) {
+		std::string text = cv::format("id '%s' was assigned a new name '%s'", id.c_str(), name.c_str());
+		this->markDirty(slot);
+		PolygonStore before = polygons_;
+		if (!polygons_.rename(slot, name)) {
+			std::cout << utils::getBashColorText(cv::format("[Warning] name '%s' is already used", name.c_str()), 'y', 'b') << std::endl;
+			return;
+		}
+		history_.push(before);
+		this->resetLabel(slot);
+		this->markDirty(slot);
+		modified_ = true;
 		std::cout << utils::getBashColorText(text, 'y', 'b') << std::endl;
 	}
 }
 
 void MyPolygonDrawer::setActiveRegion(std::string id)
 {
-	last_active_region_ = id;
+	active_slot_ = polygons_.find(id);
 }
 
 void MyPolygonDrawer::mouseSelectPoint(cv::Point pt)
 {
 	if (!this->isOk()) return;
 	
-	std::string selected_region("");
-	selected_pt_index_ = -1;
-	double min_dist = 40;
-	std::map<std::string, MyPolygon>::iterator it;
-	for (it = polygons_.begin(); it != polygons_.end(); it++) {
-		for (int i=0; i<it->second.points.size(); i++) {
-			cv::Point pt_i(it->second.points[i].x * image_size_.width, it->second.points[i].y * image_size_.height); 
-			double dist = sqrt(pow(pt.x - pt_i.x, 2.0) + pow(pt.y - pt_i.y, 2.0));
-			if (dist < min_dist) {
-				min_dist = dist;
-				selected_pt_index_ = i;
-				selected_region = it->first;
-			}
-		}
+	if (selected_pt_index_ >= 0) {
+		this->markDirty(active_slot_);
 	}
+	selected_pt_index_ = -1;
+	drag_recorded_ = false;
+	this->setHover(-1, -1);
 	
-	if (selected_region != "" && selected_pt_index_ != -1) {
-		last_active_region_ = selected_region;
+	this->ensureIndex();
+	cv::Point2d image_pt = this->toImage(pt);
+	uint32_t slot, vertex;
+	if (vertex_grid_.nearest(image_pt, this->hitRadius(), slot, vertex)) {
+		active_slot_ = int(slot);
+		selected_pt_index_ = int(vertex);
+		this->markDirty(active_slot_);
 	}
 	
-	last_mouse_pt_ = pt;
+	last_mouse_pt_ = image_pt;
 }
 
 void MyPolygonDrawer::mouseMovePoint(cv::Point pt)
 {
 	if (!this->isOk()) return;
 	
-	if (last_active_region_ == "" || selected_pt_index_ < 0)  return;
-	
-	std::map<std::string, MyPolygon>::iterator it = polygons_.find(last_active_region_);
-	
-	if (it == polygons_.end())	return;
+	if (!polygons_.valid(active_slot_) || selected_pt_index_ < 0) {
+		this->updateHover(pt);
+		return;
+	}
 	
-	if (selected_pt_index_ >= int(it->second.points.size())) return;
+	PolygonStore::View polygon = polygons_.view(active_slot_);
+	if (selected_pt_index_ >= int(polygon.size())) return;
 	
-	float dx = float(pt.x - last_mouse_pt_.x) / image_size_.width;
-	float dy = float(pt.y - last_mouse_pt_.y) / image_size_.height;
-	it->second.points[selected_pt_index_] += cv::Point2f(dx, dy);
+	// The delta is taken in image pixels, so a drag moves the vertex by the same amount at any zoom
+	cv::Point2d image_pt = this->toImage(pt);
+	cv::Size pixel_size = this->pixelSize();
+	float dx = float((image_pt.x - last_mouse_pt_.x) / pixel_size.width);
+	float dy = float((image_pt.y - last_mouse_pt_.y) / pixel_size.height);
+	dirty_rect_ |= this->regionBounds(polygon);
+	// One version per drag, taken before its first move
+	if (!drag_recorded_) {
+		history_.push(polygons_);
+		drag_recorded_ = true;
+	}
+	cv::Point2f &vertex = polygons_.mutablePoints(active_slot_)[selected_pt_index_];
+	cv::Point2f from = vertex;
+	vertex += cv::Point2f(dx, dy);
+	if (index_valid_) {
+		vertex_grid_.move(uint32_t(active_slot_), uint32_t(selected_pt_index_), from, vertex);
+	}
+	dirty_rect_ |= this->regionBounds(polygon);
+	modified_ = true;
 	
-	last_mouse_pt_ = pt;
+	last_mouse_pt_ = image_pt;
 }
 
 void MyPolygonDrawer::mouseRelease()
 {
+	if (selected_pt_index_ >= 0) {
+		this->markDirty(active_slot_);
+	}
 	selected_pt_index_ = -1;
+	drag_recorded_ = false;
+}
+
+bool MyPolygonDrawer::undo()
+{
+	if (!history_.undo(polygons_)) return false;
+	this->restoreVersion();
+	return true;
+}
+
+bool MyPolygonDrawer::redo()
+{
+	if (!history_.redo(polygons_)) return false;
+	this->restoreVersion();
+	return true;
+}
+
+void MyPolygonDrawer::restoreVersion()
+{
+	// Slots may now hold other regions, so nothing cached per slot survives
+	label_sprites_.clear();
+	this->releaseIndex();
+	active_slot_ = -1;
+	selected_pt_index_ = -1;
+	hover_slot_ = -1;
+	hover_pt_index_ = -1;
+	drag_recorded_ = false;
+	modified_ = true;
+	this->invalidate();
+}
+
+void MyPolygonDrawer::updateHover(cv::Point pt)
+{
+	int slot = -1;
+	int index = -1;
+	this->ensureIndex();
+	uint32_t found_slot, vertex;
+	if (vertex_grid_.nearest(this->toImage(pt), this->hitRadius(), found_slot, vertex)) {
+		slot = int(found_slot);
+		index = int(vertex);
+	}
+	this->setHover(slot, index);
+}
+
+void MyPolygonDrawer::setHover(int slot, int index)
+{
+	if (slot == hover_slot_ && index == hover_pt_index_) return;
+	
+	this->markDirty(hover_slot_);
+	hover_slot_ = slot;
+	hover_pt_index_ = index;
+	this->markDirty(hover_slot_);
+}
+
+void MyPolygonDrawer::resetLabel(int slot)
+{
+	if (slot < int(label_sprites_.size())) {
+		label_sprites_[slot] = LabelSprite();
+	}
+}
+
+void MyPolygonDrawer::indexRegion(int slot)
+{
+	if (!index_valid_) return;
+	PolygonStore::View polygon = polygons_.view(slot);
+	for (int k = 0; k < polygon.size(); k++) {
+		vertex_grid_.insert(uint32_t(slot), uint32_t(k), polygon[k]);
+	}
+}
+
+void MyPolygonDrawer::unindexRegion(int slot)
+{
+	if (!index_valid_) return;
+	PolygonStore::View polygon = polygons_.view(slot);
+	for (int k = 0; k < polygon.size(); k++) {
+		vertex_grid_.remove(uint32_t(slot), uint32_t(k), polygon[k]);
+	}
+}
+
+void MyPolygonDrawer::ensureIndex()
+{
+	// Built on first use: drawers that are only loaded and saved never pay for the grid.
+	// Zooming out widens the hit radius in image pixels; the grid is rebuilt once it no
+	// longer matches the radius within a factor of two, so a query stays around 3x3 cells
+	int cell = std::max(int(this->hitRadius()), hit_radius_);
+	if (index_valid_ && cell <= 2 * grid_cell_px_ && 2 * cell >= grid_cell_px_) return;
+	
+	vertex_grid_.reset(this->pixelSize(), cell);
+	grid_cell_px_ = cell;
+	index_valid_ = true;
+	PolygonStore::const_iterator it;
+	for (it = polygons_.begin(); it != polygons_.end(); it++) {
+		this->indexRegion((*it).slot());
+	}
+}
+
+void MyPolygonDrawer::releaseIndex()
+{
+	vertex_grid_ = VertexGrid();
+	index_valid_ = false;
 }
 
 void MyPolygonDrawer::draw(cv::Mat& image)
 {
 	if (polygons_.size() == 0) return;
 	
-	int region_index = 0;
-	std::map<std::string, MyPolygon>::iterator it;
-	for (it = polygons_.begin(); it != polygons_.end(); it++, region_index++) {
-		if (true) {
-			//cv::Scalar color = colors_[region_index % int(colors_.size())]; // cv::Scalar(255, 255, 255); //
-			cv::Scalar color(0, 255, 0);
-			
-			int min_y = image.rows;
-			int min_y_index = 0;
-			for (int k = 0; k < it->second.points.size(); k++) {
-				bool is_active_pt = (last_active_region_ == it->first) && selected_pt_index_ == k; 
-				cv::Point2f ptf_1 = it->second.points[k];
-				cv::Point2f ptf_2 = it->second.points[ (k+1) % int(it->second.points.size()) ];
-				cv::Point pt1(int(ptf_1.x * image.cols), int(ptf_1.y * image.rows));
-				cv::Point pt2(int(ptf_2.x * image.cols), int(ptf_2.y * image.rows));
-				cv::line(image, pt1, pt2, color, 2, 8, 0);
-				cv::circle(image, pt1, (is_active_pt ? 8 : 4), color, (is_active_pt ? 1 : -1));
-				if (pt1.y < min_y) {
-					min_y = pt1.y;
-					min_y_index = k;
-				}
-				min_y = std::min(min_y, pt1.y);
-			}
-			int fontFace = cv::FONT_HERSHEY_SIMPLEX;
-			double fontScale = 0.6;
-			int thickness = 1;
-			cv::Point textpt(
-				it->second.points[min_y_index].x * image.cols,
-				it->second.points[min_y_index].y * image.rows
-			);
-			int baseline = 0;
-			cv::Size textsize = cv::getTextSize(it->second.id, fontFace, fontScale, thickness, &baseline);
-			cv::Rect textRect(
-				textpt.x, textpt.y - textsize.height - baseline,
-				textsize.width, textsize.height + 2 * baseline
-			);
-			cv::rectangle(image, textRect, color, -1);
-			cv::putText(image, it->second.id, textpt, fontFace, fontScale, cv::Scalar(0, 0, 0), thickness);
+	// Regions outside the image, e.g. while zoomed in, are skipped
+	cv::Rect area(0, 0, image.cols, image.rows);
+	PolygonStore::const_iterator it;
+	for (it = polygons_.begin(); it != polygons_.end(); it++) {
+		if ((this->regionBounds(*it) & area).area() > 0) {
+			this->drawRegion(image, *it, cv::Point(0, 0));
+		}
+	}
+}
+
+bool MyPolygonDrawer::render(const cv::Mat &base, cv::Mat &frame)
+{
+	if (redraw_all_ || frame.size() != base.size() || frame.type() != base.type()) {
+		frame = base.clone();
+		this->draw(frame);
+		redraw_all_ = false;
+		dirty_rect_ = cv::Rect();
+		return true;
+	}
+	
+	cv::Rect roi = dirty_rect_ & cv::Rect(0, 0, frame.cols, frame.rows);
+	dirty_rect_ = cv::Rect();
+	if (roi.area() <= 0) return false;
+	
+	// Restore the base layer under the damaged area and repaint only the regions crossing it,
+	// drawing through a ROI header so OpenCV clips everything to the damaged area
+	base(roi).copyTo(frame(roi));
+	cv::Mat canvas = frame(roi);
+	PolygonStore::const_iterator it;
+	for (it = polygons_.begin(); it != polygons_.end(); it++) {
+		if ((this->regionBounds(*it) & roi).area() > 0) {
+			this->drawRegion(canvas, *it, roi.tl());
+		}
+	}
+	return true;
+}
+
+void MyPolygonDrawer::invalidate()
+{
+	redraw_all_ = true;
+}
+
+bool MyPolygonDrawer::needsRedraw()
+{
+	return redraw_all_ || dirty_rect_.area() > 0;
+}
+
+void MyPolygonDrawer::clearDamage()
+{
+	// The damage was handed to a copy that renders it, e.g. on another thread
+	redraw_all_ = false;
+	dirty_rect_ = cv::Rect();
+}
+
+void MyPolygonDrawer::mergeDamage(const MyPolygonDrawer &older)
+{
+	// 'older' was never rendered; its damage still has to be repainted
+	if (older.redraw_all_) {
+		redraw_all_ = true;
+	} else if (!redraw_all_) {
+		dirty_rect_ |= older.dirty_rect_;
+	}
+}
+
+void MyPolygonDrawer::copyWithoutHistory(MyPolygonDrawer &out) const
+{
+	// For a frame or a save on another thread: that copy never undoes, and dropping
+	// the history keeps the last reference to old versions on the editing thread.
+	// The sprites are not copied either, the render thread keeps its own
+	if (&out != this) out.assign(*this, false);
+}
+
+void MyPolygonDrawer::markDirty(int slot)
+{
+	// Nothing to track while a full redraw is pending, e.g. during loading
+	if (redraw_all_) return;
+	if (polygons_.valid(slot)) {
+		dirty_rect_ |= this->regionBounds(polygons_.view(slot));
+	}
+}
+
+cv::Size MyPolygonDrawer::pixelSize() const
+{
+	// The view may show a reduced copy of the image, its pixels are the ones that count on screen
+	cv::Size size = view_.imageSize();
+	return (size.width > 0 && size.height > 0) ? size : image_size_;
+}
+
+cv::Point MyPolygonDrawer::toPixel(const cv::Point2f &pt)
+{
+	cv::Size size = this->pixelSize();
+	return view_.toScreen(cv::Point2d(double(pt.x) * size.width, double(pt.y) * size.height));
+}
+
+cv::Point2d MyPolygonDrawer::toImage(cv::Point pt)
+{
+	return view_.toImage(cv::Point2d(pt.x, pt.y));
+}
+
+double MyPolygonDrawer::hitRadius()
+{
+	// The radius is fixed on screen, the grid works in image pixels
+	return hit_radius_ / view_.zoom();
+}
+
+int MyPolygonDrawer::labelAnchorIndex(const PolygonStore::View &polygon)
+{
+	int min_y = INT_MAX;
+	int min_y_index = 0;
+	for (int k = 0; k < polygon.size(); k++) {
+		int y = this->toPixel(polygon[k]).y;
+		if (y < min_y) {
+			min_y = y;
+			min_y_index = k;
 		}
-	}	
+	}
+	return min_y_index;
+}
+
+const MyPolygonDrawer::LabelSprite& MyPolygonDrawer::labelSprite(const PolygonStore::View &polygon)
+{
+	LabelCache &cache = (label_cache_ != NULL) ? *label_cache_ : label_sprites_;
+	if (polygon.slot() >= int(cache.size())) {
+		cache.resize(polygons_.slotCount());
+	}
+	LabelSprite &sprite = cache[polygon.slot()];
+	if (!sprite.image.empty() && sprite.id == polygon.idRef()) {
+		return sprite;
+	}
+	
+	std::string text = polygon.id();
+	sprite.id = text;
+	int fontFace = cv::FONT_HERSHEY_SIMPLEX;
+	double fontScale = 0.6;
+	int thickness = 1;
+	int baseline = 0;
+	cv::Size textsize = cv::getTextSize(text, fontFace, fontScale, thickness, &baseline);
+	sprite.baseline = textsize.height + baseline;
+	sprite.image = cv::Mat(textsize.height + 2 * baseline, std::max(textsize.width, 1), CV_8UC3, cv::Scalar(0, 255, 0));
+	cv::putText(sprite.image, text, cv::Point(0, sprite.baseline), fontFace, fontScale, cv::Scalar(0, 0, 0), thickness);
+	return sprite;
+}
+
+cv::Rect MyPolygonDrawer::labelRect(const PolygonStore::View &polygon)
+{
+	if (polygon.empty()) return cv::Rect();
+	
+	const LabelSprite &sprite = this->labelSprite(polygon);
+	cv::Point textpt = this->toPixel(polygon[this->labelAnchorIndex(polygon)]);
+	return cv::Rect(textpt.x, textpt.y - sprite.baseline, sprite.image.cols, sprite.image.rows);
+}
+
+cv::Rect MyPolygonDrawer::regionBounds(const PolygonStore::View &polygon)
+{
+	if (polygon.empty()) return cv::Rect();
+	
+	// The view maps each axis monotonically, so the projected corners of the normalized
+	// bounds span the projected vertices; rounding is well inside the margin below
+	cv::Rect_<float> box = shape::bounds(shape::classify(polygon.points(), polygon.size()));
+	cv::Point pt0 = this->toPixel(box.tl());
+	cv::Point pt1 = this->toPixel(cv::Point2f(box.x + box.width, box.y + box.height));
+	int x0 = pt0.x, y0 = pt0.y, x1 = pt1.x, y1 = pt1.y;
+	
+	// Margin covers the active vertex circle (radius 8) and the line thickness
+	const int margin = 10;
+	cv::Rect bounds(x0 - margin, y0 - margin, x1 - x0 + 2 * margin + 1, y1 - y0 + 2 * margin + 1);
+	return bounds | this->labelRect(polygon);
+}
+
+void MyPolygonDrawer::drawRegion(cv::Mat &canvas, const PolygonStore::View &polygon, cv::Point offset)
+{
+	if (polygon.empty()) return;
+	
+	//cv::Scalar color = colors_[region_index % int(colors_.size())]; // cv::Scalar(255, 255, 255); //
+	cv::Scalar color(0, 255, 0);
+	
+	shape::Projection projection;
+	projection.image_size = this->pixelSize();
+	projection.origin = view_.origin();
+	projection.zoom = view_.zoom();
+	projection.offset = offset;
+	int selected = (active_slot_ == polygon.slot()) ? selected_pt_index_ : -1;
+	shape::draw(shape::classify(polygon.points(), polygon.size()), projection, canvas, color, selected);
+	
+	int n = int(polygon.size());
+	if (hover_slot_ == polygon.slot() && hover_pt_index_ >= 0 && hover_pt_index_ < n) {
+		cv::Point pt = this->toPixel(polygon[hover_pt_index_]) - offset;
+		cv::circle(canvas, pt, 7, cv::Scalar(0, 255, 255), 2);
+	}
+	
+	// Blit the cached label, clipped against the canvas
+	const cv::Mat &sprite = this->labelSprite(polygon).image;
+	cv::Rect rect = this->labelRect(polygon);
+	rect.x -= offset.x;
+	rect.y -= offset.y;
+	cv::Rect visible = rect & cv::Rect(0, 0, canvas.cols, canvas.rows);
+	if (visible.area() > 0) {
+		sprite(cv::Rect(visible.x - rect.x, visible.y - rect.y, visible.width, visible.height)).copyTo(canvas(visible));
+	}
 }
 
 std::string MyPolygonDrawer::getTextInfo()
-{	
+{
 	std::string ids_str("");
 	std::string polygons_str("");
 	
-	std::map<std::string, MyPolygon>::iterator it;
-	for (it = polygons_.begin(); it != polygons_.end(); it++) {
-		std::stringstream ss;
-		ss << std::setprecision(3) << std::fixed;
-		std::vector<cv::Point2f>::iterator it2;
-		for (it2 = it->second.points.begin(); it2 != it->second.points.end(); it2++) {
-			ss << "[" << it2->x << ", " << it2->y << "]";
-			if (it2 != --it->second.points.end()) {
-				ss << ", ";
-			}
-		}
-		
-		std::string sep1 = (it != --polygons_.end()) ? ", " : "";
+	size_t index = 0;
+	PolygonStore::const_iterator it;
+	for (it = polygons_.begin(); it != polygons_.end(); it++, index++) {
+		PolygonStore::View polygon = *it;
+		std::string sep1 = (index + 1 < polygons_.size()) ? ", " : "";
 		
-		ids_str += ("'" + it->second.id + "'" + sep1);
-		polygons_str += ("[" + ss.str() + "]" + sep1);
-	}	
+		ids_str += ("'" + polygon.id() + "'" + sep1);
+		polygons_str += "[";
+		shape::write(shape::classify(polygon.points(), polygon.size()), polygons_str);
+		polygons_str += "]" + sep1;
+	}
 	return cv::format("w: %d, h: %d, ids: [%s], vertices: [%s]", image_size_.width, image_size_.height, ids_str.c_str(), polygons_str.c_str());
 }
 
@@ -248,4 +656,3 @@ bool MyPolygonDrawer::isOk(int mode)
 	
 	return false;
 }
-
@@ -3,19 +3,37 @@
 
 #include <iostream>
 #include <map>
+#include <random>
 #include <opencv2/opencv.hpp>
 #include "polygon_drawer/common.h"
+#include "polygon_drawer/edit_history.h"
+#include "polygon_drawer/polygon_store.h"
+#include "polygon_drawer/vertex_grid.h"
+#include "polygon_drawer/viewport.h"
 
 class MyPolygonDrawer {
 public:
 	
 	MyPolygonDrawer(int N = 4);
+	MyPolygonDrawer(const MyPolygonDrawer &other);
+	MyPolygonDrawer& operator=(const MyPolygonDrawer &other);
 	~MyPolygonDrawer();
 	void reset();
 	void setImageSize(cv::Size size);
-	void addRegion(std::string id);
+	cv::Size getImageSize() const { return image_size_; }
+	void setView(const Viewport &view);
+	void addRegion(std::string id, std::mt19937 &rng);
 	void addRegion(std::string id, MyPolygon polygon);
+	void addRegion(const std::string &id, const cv::Point2f *points, size_t n);
+	void placeRegion(const std::string &id, const std::vector<cv::Point2f> &points);
+	void reserve(size_t polygons, size_t vertices);
 	void draw(cv::Mat &image);
+	bool render(const cv::Mat &base, cv::Mat &frame);
+	void invalidate();
+	bool needsRedraw();
+	void clearDamage();
+	void mergeDamage(const MyPolygonDrawer &older);
+	void copyWithoutHistory(MyPolygonDrawer &out) const;
 	void deleteLastRegion();
 	void deleteRegionById(std::string id);
 	void editRegionById(std::string id, std::string name);
@@ -24,18 +42,75 @@ public:
 	void mouseSelectPoint(cv::Point pt);
 	void mouseMovePoint(cv::Point pt);
 	void mouseRelease();
+	bool undo();
+	bool redo();
 	bool isOk(int mode = 0);
+	bool isModified() { return modified_; }
+	void clearModified() { modified_ = false; }
 	
-	std::map<std::string, MyPolygon> getPolygons() { return polygons_; }
+	const PolygonStore& getPolygons() const { return polygons_; }
+	const std::vector<std::string>& getDuplicateIds() const { return duplicate_ids_; }
+	const EditHistory& getHistory() const { return history_; }
+	
+	struct LabelSprite {
+		std::string id;     // the region it was drawn for, a slot reused or renamed since makes it stale
+		cv::Mat image;
+		int baseline;   // text baseline, measured from the top of the sprite
+	};
+	typedef std::vector<LabelSprite> LabelCache;   // by store slot
+	
+	// Sprites are looked up in and added to 'cache' instead of the drawer's own, e.g. one that
+	// outlives the copies rendered on another thread; copies start with their own again
+	void useLabelCache(LabelCache *cache) { label_cache_ = cache; }
 
 private:
+	void assign(const MyPolygonDrawer &other, bool with_history = true);
+	void restoreVersion();
+	void markDirty(int slot);
+	cv::Size pixelSize() const;
+	cv::Point toPixel(const cv::Point2f &pt);
+	cv::Point2d toImage(cv::Point pt);
+	double hitRadius();
+	int labelAnchorIndex(const PolygonStore::View &polygon);
+	const LabelSprite& labelSprite(const PolygonStore::View &polygon);
+	cv::Rect labelRect(const PolygonStore::View &polygon);
+	cv::Rect regionBounds(const PolygonStore::View &polygon);
+	void drawRegion(cv::Mat &canvas, const PolygonStore::View &polygon, cv::Point offset);
+	void updateHover(cv::Point pt);
+	void setHover(int slot, int index);
+	void resetLabel(int slot);
+	void indexRegion(int slot);
+	void unindexRegion(int slot);
+	void ensureIndex();
+	void releaseIndex();
+	bool eraseRegion(int slot);
+	
 	std::vector<cv::Scalar> colors_;
-	std::map<std::string, MyPolygon> polygons_;	
+	PolygonStore polygons_;
 	int max_n_;
-	std::string last_active_region_;
+	int active_slot_;
 	int selected_pt_index_ = -1;
-	cv::Size image_size_;
-	cv::Point last_mouse_pt_;
+	cv::Size image_size_;         // of the source image, saved with the polygons
+	cv::Point2d last_mouse_pt_;   // in image pixels
+	Viewport view_;               // maps image pixels to the window, the identity unless set
+	bool modified_;     // edited since the last save
+	std::vector<std::string> duplicate_ids_;   // ids rejected by addRegion because they already exist
+	EditHistory history_;
+	bool drag_recorded_;    // the version before the current drag is in the history
+	
+	// Render state: damaged area since the last frame and label sprites cached per slot
+	cv::Rect dirty_rect_;
+	bool redraw_all_;
+	LabelCache label_sprites_;
+	LabelCache *label_cache_;     // set by useLabelCache, or NULL for label_sprites_
+	
+	// Vertex hit-testing, the grid refers to regions by their store slot
+	VertexGrid vertex_grid_;
+	bool index_valid_;
+	int hit_radius_;    // in window pixels
+	int grid_cell_px_;  // cell size the grid was built with, in image pixels
+	int hover_slot_;
+	int hover_pt_index_;
 };
 
 #endif
@@ -0,0 +1,296 @@
+#include "flow_reader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <climits>
+
+namespace {
+	const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	
+	inline bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+	
+	inline void skipSpaces(const char *&p, const char *end)
+	{
+		while (p < end && *p == ' ') p++;
+	}
+	
+	// Skips leading spaces, then consumes 'token' if it is next
+	bool expect(const char *&p, const char *end, const char *token)
+	{
+		skipSpaces(p, end);
+		size_t n = strlen(token);
+		if (size_t(end - p) < n || memcmp(p, token, n) != 0) return false;
+		p += n;
+		return true;
+	}
+	
+	bool startsWith(const char *p, const char *end, const char *token)
+	{
+		size_t n = strlen(token);
+		return size_t(end - p) >= n && memcmp(p, token, n) == 0;
+	}
+}
+
+FlowReader::FlowReader(size_t chunk_size)
+	: chunk_size_(chunk_size)
+	, in_polygons_(false)
+	, bytes_(0)
+	, images_(0)
+	, polygons_(0)
+	, elapsed_ms_(0.0)
+{
+}
+
+bool FlowReader::parseInt(const char *&p, const char *end, int &value)
+{
+	const char *s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+	if (s >= end || !isDigit(*s)) return false;
+	
+	long long v = 0;
+	while (s < end && isDigit(*s)) {
+		v = v * 10 + (*s - '0');
+		if (v > INT_MAX) return false;
+		s++;
+	}
+	value = int(negative ? -v : v);
+	p = s;
+	return true;
+}
+
+bool FlowReader::parseFloat(const char *&p, const char *end, float &value)
+{
+	const char *s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')) {
+		negative = (*s == '-');
+		s++;
+	}
+	
+	// Up to 19 significant digits in an integer mantissa, the rest only shifts the exponent
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; s < end && isDigit(*s); s++) {
+		any = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*s - '0');
+			if (mantissa > 0) digits++;
+		} else {
+			exponent++;
+		}
+	}
+	if (s < end && *s == '.') {
+		s++;
+		for (; s < end && isDigit(*s); s++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*s - '0');
+				if (mantissa > 0) digits++;
+				exponent--;
+			}
+		}
+	}
+	if (!any) return false;
+	
+	if (s < end && (*s == 'e' || *s == 'E')) {
+		s++;
+		int e = 0;
+		if (!parseInt(s, end, e)) return false;
+		exponent += e;
+	}
+	
+	// Exact for the short values written by getTextInfo: mantissa < 2^53 and |exponent| <= 22
+	double v = double(mantissa);
+	if (exponent < 0) {
+		v = (-exponent <= 22) ? v / POW10[-exponent] : v * std::pow(10.0, exponent);
+	} else if (exponent > 0) {
+		v = (exponent <= 22) ? v * POW10[exponent] : v * std::pow(10.0, exponent);
+	}
+	value = float(negative ? -v : v);
+	p = s;
+	return true;
+}
+
+bool FlowReader::read(const std::string &filename, DrawerMap &drawers)
+{
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (file == NULL) return false;
+	
+	int64 t0 = cv::getTickCount();
+	in_polygons_ = false;
+	bytes_ = images_ = polygons_ = 0;
+	buffer_.resize(chunk_size_);
+	
+	// Complete lines are parsed in place; a partial line at the end of a chunk
+	// is moved to the front and completed by the next read
+	// Entries go to a map of their own, so that a file rejected halfway leaves
+	// 'drawers' as it was for the yaml-cpp fallback
+	DrawerMap parsed;
+	bool ok = true;
+	size_t filled = 0;
+	while (ok) {
+		if (filled == buffer_.size()) {
+			buffer_.resize(buffer_.size() * 2);
+		}
+		size_t n = fread(&buffer_[filled], 1, buffer_.size() - filled, file);
+		filled += n;
+		bytes_ += n;
+		
+		const char *data = buffer_.data();
+		size_t begin = 0;
+		while (ok) {
+			const char *newline = static_cast<const char*>(memchr(data + begin, '\n', filled - begin));
+			if (newline == NULL) break;
+			ok = this->parseLine(data + begin, newline, parsed);
+			begin = size_t(newline - data) + 1;
+		}
+		
+		if (n == 0) {
+			ok = ok && !ferror(file);
+			if (ok && begin < filled) {
+				ok = this->parseLine(data + begin, data + filled, parsed);
+			}
+			break;
+		}
+		memmove(&buffer_[0], data + begin, filled - begin);
+		filled -= begin;
+	}
+	fclose(file);
+	
+	if (ok) {
+		if (drawers.empty()) {
+			drawers.swap(parsed);
+		} else {
+			for (DrawerMap::iterator it = parsed.begin(); it != parsed.end(); it++) {
+				drawers[it->first] = it->second;
+			}
+		}
+	}
+	elapsed_ms_ = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	return ok;
+}
+
+bool FlowReader::parseLine(const char *begin, const char *end, DrawerMap &drawers)
+{
+	while (end > begin && (end[-1] == '\r' || end[-1] == ' ')) end--;
+	if (begin == end) return true;
+	
+	if (*begin == ' ' || *begin == '-') {
+		const char *p = begin;
+		if (!in_polygons_ || !expect(p, end, "- ")) return false;
+		return this->parseEntry(p, end, drawers);
+	}
+	if (startsWith(begin, end, "appname:") || startsWith(begin, end, "datetime:")) {
+		return true;
+	}
+	if (startsWith(begin, end, "polygons:")) {
+		const char *p = begin + strlen("polygons:");
+		skipSpaces(p, end);
+		in_polygons_ = true;
+		return p == end;
+	}
+	return false;
+}
+
+bool FlowReader::parseEntry(const char *p, const char *end, DrawerMap &drawers)
+{
+	if (!expect(p, end, "{") || !expect(p, end, "name:")) return false;
+	skipSpaces(p, end);
+	
+	// Names are plain scalars, they run up to the "w" key. Quoted names, and names
+	// that would make the key ambiguous, are left to yaml-cpp
+	if (p < end && (*p == '"' || *p == '\'')) return false;
+	const char *name_end = p;
+	while (name_end < end && !startsWith(name_end, end, ", w:")) name_end++;
+	if (name_end == end || name_end == p) return false;
+	for (const char *q = name_end + 1; q < end; q++) {
+		if (startsWith(q, end, ", w:")) return false;
+	}
+	name_.assign(p, name_end);
+	p = name_end;
+	
+	int width = 0, height = 0;
+	if (!expect(p, end, ",") || !expect(p, end, "w:")) return false;
+	skipSpaces(p, end);
+	if (!parseInt(p, end, width)) return false;
+	if (!expect(p, end, ",") || !expect(p, end, "h:")) return false;
+	skipSpaces(p, end);
+	if (!parseInt(p, end, height)) return false;
+	
+	// Ids stay in the line buffer until their vertices are parsed
+	ids_.clear();
+	if (!expect(p, end, ",") || !expect(p, end, "ids:") || !expect(p, end, "[")) return false;
+	if (!expect(p, end, "]")) {
+		while (true) {
+			if (!expect(p, end, "'")) return false;
+			const char *id_end = static_cast<const char*>(memchr(p, '\'', end - p));
+			if (id_end == NULL) return false;
+			ids_.push_back(std::make_pair(p, size_t(id_end - p)));
+			p = id_end + 1;
+			if (expect(p, end, "]")) break;
+			if (!expect(p, end, ",")) return false;
+		}
+	}
+	
+	if (!expect(p, end, ",") || !expect(p, end, "vertices:") || !expect(p, end, "[")) return false;
+	
+	DrawerMap::iterator it = drawers.lower_bound(name_);
+	if (it == drawers.end() || it->first != name_) {
+		it = drawers.insert(it, DrawerMap::value_type(name_, MyPolygonDrawer()));
+	} else {
+		it->second = MyPolygonDrawer();
+	}
+	MyPolygonDrawer &drawer = it->second;
+	drawer.setImageSize(cv::Size(width, height));
+	drawer.reserve(ids_.size(), ids_.size() * 4);
+	
+	size_t index = 0;
+	if (!expect(p, end, "]")) {
+		while (true) {
+			if (!expect(p, end, "[")) return false;
+			points_.clear();
+			if (!expect(p, end, "]")) {
+				while (true) {
+					cv::Point2f pt;
+					if (!expect(p, end, "[")) return false;
+					skipSpaces(p, end);
+					if (!parseFloat(p, end, pt.x) || !expect(p, end, ",")) return false;
+					skipSpaces(p, end);
+					if (!parseFloat(p, end, pt.y) || !expect(p, end, "]")) return false;
+					points_.push_back(pt);
+					if (expect(p, end, "]")) break;
+					if (!expect(p, end, ",")) return false;
+				}
+			}
+			
+			// More polygons than ids is not something the writer produces
+			if (index >= ids_.size()) return false;
+			id_.assign(ids_[index].first, ids_[index].second);
+			drawer.addRegion(id_, points_.data(), points_.size());
+			index++;
+			
+			if (expect(p, end, "]")) break;
+			if (!expect(p, end, ",")) return false;
+		}
+	}
+	if (index != ids_.size() || !expect(p, end, "}")) return false;
+	skipSpaces(p, end);
+	if (p != end) return false;
+	
+	drawer.clearModified();
+	images_++;
+	polygons_ += index;
+	return true;
+}
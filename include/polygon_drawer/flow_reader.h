@@ -0,0 +1,49 @@
+#ifndef FLOW_READER_H
+#define FLOW_READER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/annotation_io.h"
+
+// Streaming reader for the exact flow layout written by annotation_io, one
+// image per line:
+//   - { name: <name>, w: <int>, h: <int>, ids: ['<id>', ...], vertices: [[[x, y], ...], ...]}
+// The file is read in fixed chunks and numbers are parsed by hand, so the
+// result does not depend on the C locale. read() returns false as soon as a
+// line does not match the layout, without touching 'drawers'; the caller then
+// falls back to yaml-cpp.
+class FlowReader {
+public:
+	FlowReader(size_t chunk_size = 1 << 20);
+	bool read(const std::string &filename, DrawerMap &drawers);
+	
+	size_t bytes() { return bytes_; }
+	size_t images() { return images_; }
+	size_t polygons() { return polygons_; }
+	double elapsedMs() { return elapsed_ms_; }
+	
+	static bool parseFloat(const char *&p, const char *end, float &value);
+	static bool parseInt(const char *&p, const char *end, int &value);
+
+private:
+	bool parseLine(const char *begin, const char *end, DrawerMap &drawers);
+	bool parseEntry(const char *p, const char *end, DrawerMap &drawers);
+	
+	size_t chunk_size_;
+	bool in_polygons_;
+	size_t bytes_;
+	size_t images_;
+	size_t polygons_;
+	double elapsed_ms_;
+	
+	// Reused across lines so that parsing does not allocate per polygon
+	std::vector<char> buffer_;
+	std::vector<std::pair<const char*, size_t> > ids_;
+	std::vector<cv::Point2f> points_;
+	std::string id_;
+	std::string name_;
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "geometry.h"
+
+#include <cfloat>
+#include <algorithm>
+#include <vector>
+
+double geometry::signedArea(const cv::Point2f *points, size_t n, float sx, float sy)
+{
+	if (n < 3) return 0.0;
+	
+	// Shoelace over (i, i + 1), the closing edge is added separately to keep the loop free of modulo
+	double sum = 0.0;
+	for (size_t i=0; i+1<n; i++) {
+		sum += double(points[i].x) * points[i + 1].y - double(points[i + 1].x) * points[i].y;
+	}
+	sum += double(points[n - 1].x) * points[0].y - double(points[0].x) * points[n - 1].y;
+	return 0.5 * sum * sx * sy;
+}
+
+size_t geometry::countOutOfRange(const cv::Point2f *points, size_t n, float lo, float hi)
+{
+	size_t count = 0;
+	for (size_t i=0; i<n; i++) {
+		count += (points[i].x < lo) | (points[i].x > hi) | (points[i].y < lo) | (points[i].y > hi);
+	}
+	return count;
+}
+
+cv::Rect_<float> geometry::bounds(const cv::Point2f *points, size_t n)
+{
+	if (n == 0) return cv::Rect_<float>();
+	
+	float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+	for (size_t i=0; i<n; i++) {
+		x0 = std::min(x0, points[i].x);
+		y0 = std::min(y0, points[i].y);
+		x1 = std::max(x1, points[i].x);
+		y1 = std::max(y1, points[i].y);
+	}
+	return cv::Rect_<float>(x0, y0, x1 - x0, y1 - y0);
+}
+
+namespace {
+	struct EdgeBox {
+		float x0, y0, x1, y1;
+	};
+	
+	inline float cross(const cv::Point2f &o, const cv::Point2f &a, const cv::Point2f &b)
+	{
+		return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+	}
+	
+	// Squared distance of every vertex in (a, b) from the segment a-b, over plain float columns;
+	// the arg-max is a separate pass. A closed chord (a == b) measures the distance to a
+	size_t farthestFromChord(const float *xs, const float *ys, size_t a, size_t b, float *dist, float &best)
+	{
+		float ax = xs[a], ay = ys[a];
+		float dx = xs[b] - ax, dy = ys[b] - ay;
+		float len2 = dx * dx + dy * dy;
+		float inv = (len2 > 0.0f) ? 1.0f / len2 : 0.0f;
+		for (size_t i=a+1; i<b; i++) {
+			float px = xs[i] - ax, py = ys[i] - ay;
+			float t = std::min(std::max((px * dx + py * dy) * inv, 0.0f), 1.0f);
+			float ex = px - t * dx, ey = py - t * dy;
+			dist[i] = ex * ex + ey * ey;
+		}
+		
+		size_t index = a + 1;
+		for (size_t i=a+2; i<b; i++) {
+			if (dist[i] > dist[index]) index = i;
+		}
+		best = dist[index];
+		return index;
+	}
+	
+	inline bool onSegment(const cv::Point2f &a, const cv::Point2f &b, const cv::Point2f &p)
+	{
+		return std::min(a.x, b.x) <= p.x && p.x <= std::max(a.x, b.x) && std::min(a.y, b.y) <= p.y && p.y <= std::max(a.y, b.y);
+	}
+}
+
+bool geometry::segmentsIntersect(const cv::Point2f &a, const cv::Point2f &b, const cv::Point2f &c, const cv::Point2f &d)
+{
+	float d1 = cross(c, d, a);
+	float d2 = cross(c, d, b);
+	float d3 = cross(a, b, c);
+	float d4 = cross(a, b, d);
+	if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
+		return true;
+	}
+	// Touching or collinear overlap also counts, the polygon is not simple either way
+	return (d1 == 0 && onSegment(c, d, a)) || (d2 == 0 && onSegment(c, d, b))
+		|| (d3 == 0 && onSegment(a, b, c)) || (d4 == 0 && onSegment(a, b, d));
+}
+
+bool geometry::selfIntersects(const cv::Point2f *points, size_t n)
+{
+	if (n < 4) return false;
+	
+	// Edge bounding boxes first; the exact test only runs on overlapping pairs
+	std::vector<EdgeBox> boxes(n);
+	for (size_t i=0; i<n; i++) {
+		const cv::Point2f &a = points[i];
+		const cv::Point2f &b = points[(i + 1) % n];
+		EdgeBox box = {std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y)};
+		boxes[i] = box;
+	}
+	
+	for (size_t i=0; i<n; i++) {
+		// Edges i and i + 1 share a vertex, as do edges 0 and n - 1
+		size_t last = (i == 0) ? n - 1 : n;
+		for (size_t j=i+2; j<last; j++) {
+			if (boxes[i].x0 > boxes[j].x1 || boxes[j].x0 > boxes[i].x1 || boxes[i].y0 > boxes[j].y1 || boxes[j].y0 > boxes[i].y1) continue;
+			if (segmentsIntersect(points[i], points[(i + 1) % n], points[j], points[(j + 1) % n])) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void geometry::simplify(const cv::Point2f *points, size_t n, float tolerance, std::vector<cv::Point2f> &out)
+{
+	out.clear();
+	if (n <= 3 || tolerance <= 0.0f) {
+		out.assign(points, points + n);
+		return;
+	}
+	
+	// Columns with the first vertex repeated at the end, so the ring is two open chains:
+	// 0 .. far and far .. n, where far is the vertex farthest from vertex 0
+	std::vector<float> xs(n + 1), ys(n + 1), dist(n + 1);
+	for (size_t i=0; i<n; i++) {
+		xs[i] = points[i].x;
+		ys[i] = points[i].y;
+	}
+	xs[n] = xs[0];
+	ys[n] = ys[0];
+	
+	float best;
+	size_t far = farthestFromChord(xs.data(), ys.data(), 0, n, dist.data(), best);
+	std::vector<uint8_t> keep(n + 1, 0);
+	keep[0] = keep[far] = 1;
+	
+	// Explicit stack instead of recursion, dense contours can be thousands of vertices long
+	float tolerance2 = tolerance * tolerance;
+	std::vector<std::pair<size_t, size_t> > stack;
+	stack.push_back(std::make_pair(size_t(0), far));
+	stack.push_back(std::make_pair(far, n));
+	while (!stack.empty()) {
+		size_t a = stack.back().first, b = stack.back().second;
+		stack.pop_back();
+		if (b - a < 2) continue;
+		
+		size_t index = farthestFromChord(xs.data(), ys.data(), a, b, dist.data(), best);
+		if (best > tolerance2) {
+			keep[index] = 1;
+			stack.push_back(std::make_pair(a, index));
+			stack.push_back(std::make_pair(index, b));
+		}
+	}
+	
+	for (size_t i=0; i<n; i++) {
+		if (keep[i]) out.push_back(points[i]);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+// Polygon kernels over the contiguous vertex runs of PolygonStore. The
+// loops are branch-free over plain float pairs so that the compiler can
+// vectorize them; callers pass a scale to work in pixels instead of the
+// normalized [0, 1] coordinates.
+namespace geometry {
+	double signedArea(const cv::Point2f *points, size_t n, float sx = 1.0f, float sy = 1.0f);
+	size_t countOutOfRange(const cv::Point2f *points, size_t n, float lo = 0.0f, float hi = 1.0f);
+	cv::Rect_<float> bounds(const cv::Point2f *points, size_t n);
+	bool selfIntersects(const cv::Point2f *points, size_t n);
+	bool segmentsIntersect(const cv::Point2f &a, const cv::Point2f &b, const cv::Point2f &c, const cv::Point2f &d);
+	// Douglas-Peucker on a closed ring: drops vertices within 'tolerance' of the simplified outline
+	void simplify(const cv::Point2f *points, size_t n, float tolerance, std::vector<cv::Point2f> &out);
+};
+
+#endif
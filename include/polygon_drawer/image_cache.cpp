@@ -0,0 +1,197 @@
+#include "image_cache.h"
+#include "display_cache.h"
+#include "profiler.h"
+
+#include <algorithm>
+
+ImageCache::ImageCache(size_t budget_mb)
+	: budget_bytes_(budget_mb * 1024 * 1024)
+	, used_bytes_(0)
+	, stop_(false)
+	, profiler_(NULL)
+	, display_cache_(NULL)
+{
+	worker_ = std::thread(&ImageCache::workerLoop, this);
+}
+
+ImageCache::~ImageCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+		pending_.clear();
+	}
+	work_cond_.notify_all();
+	if (worker_.joinable()) {
+		worker_.join();
+	}
+}
+
+void ImageCache::setBudget(size_t budget_mb)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	budget_bytes_ = budget_mb * 1024 * 1024;
+	this->evict();
+}
+
+void ImageCache::setProfiler(Profiler *profiler)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	profiler_ = profiler;
+}
+
+void ImageCache::setDisplayCache(DisplayCache *display_cache)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	display_cache_ = display_cache;
+}
+
+cv::Mat ImageCache::decode(const std::string &filename, cv::Size &full_size)
+{
+	if (display_cache_ != NULL) {
+		return display_cache_->load(filename, full_size);
+	}
+	cv::Mat image = cv::imread(filename, cv::IMREAD_COLOR);
+	full_size = image.size();
+	return image;
+}
+
+cv::Mat ImageCache::get(const std::string &filename, cv::Size *full_size)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// The worker may be decoding this file right now, wait for it instead of decoding twice
+	done_cond_.wait(lock, [&]() { return in_flight_.count(filename) == 0; });
+
+	std::unordered_map<std::string, Entry>::iterator it = entries_.find(filename);
+	if (it != entries_.end()) {
+		lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+		if (full_size != NULL) *full_size = it->second.full_size;
+		return it->second.image;
+	}
+
+	std::deque<std::string>::iterator queued = std::find(pending_.begin(), pending_.end(), filename);
+	if (queued != pending_.end()) {
+		pending_.erase(queued);
+	}
+
+	in_flight_.insert(filename);
+	Profiler *profiler = profiler_;
+	lock.unlock();
+	int64_t t0 = profiler ? Profiler::now() : 0;
+	cv::Size size;
+	cv::Mat image = this->decode(filename, size);
+	if (profiler) profiler->record(Profiler::DECODE, t0, Profiler::now());
+	lock.lock();
+	in_flight_.erase(filename);
+	if (!image.empty()) {
+		this->insert(filename, image, size);
+	}
+	done_cond_.notify_all();
+	if (full_size != NULL) *full_size = size;
+	return image;
+}
+
+void ImageCache::prefetch(const std::vector<std::string> &filenames)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		// Navigation order changed, drop whatever was queued for the previous position
+		pending_.clear();
+		for (int i=0; i<filenames.size(); i++) {
+			if (entries_.count(filenames[i]) == 0 && in_flight_.count(filenames[i]) == 0) {
+				pending_.push_back(filenames[i]);
+			}
+		}
+	}
+	work_cond_.notify_one();
+}
+
+bool ImageCache::contains(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_.count(filename) > 0;
+}
+
+// For a file that was written again; a decode already running still inserts the old pixels
+void ImageCache::erase(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::unordered_map<std::string, Entry>::iterator it = entries_.find(filename);
+	if (it == entries_.end()) return;
+	used_bytes_ -= imageBytes(it->second.image);
+	lru_.erase(it->second.lru_pos);
+	entries_.erase(it);
+}
+
+size_t ImageCache::size()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_.size();
+}
+
+size_t ImageCache::bytesUsed()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return used_bytes_;
+}
+
+void ImageCache::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	bool named = false;
+	while (true) {
+		work_cond_.wait(lock, [&]() { return stop_ || !pending_.empty(); });
+		if (stop_) break;
+
+		std::string filename = pending_.front();
+		pending_.pop_front();
+		if (entries_.count(filename) > 0) continue;
+
+		in_flight_.insert(filename);
+		Profiler *profiler = profiler_;
+		lock.unlock();
+		if (profiler && !named) {
+			profiler->nameThread("image cache");
+			named = true;
+		}
+		int64_t t0 = profiler ? Profiler::now() : 0;
+		cv::Size full_size;
+		cv::Mat image = this->decode(filename, full_size);
+		if (profiler) profiler->record(Profiler::PREFETCH, t0, Profiler::now());
+		lock.lock();
+		in_flight_.erase(filename);
+		if (!image.empty()) {
+			this->insert(filename, image, full_size);
+		}
+		done_cond_.notify_all();
+	}
+}
+
+void ImageCache::insert(const std::string &filename, const cv::Mat &image, cv::Size full_size)
+{
+	lru_.push_front(filename);
+	Entry entry;
+	entry.image = image;
+	entry.full_size = full_size;
+	entry.lru_pos = lru_.begin();
+	entries_[filename] = entry;
+	used_bytes_ += imageBytes(image);
+	this->evict();
+}
+
+void ImageCache::evict()
+{
+	// Always keep the most recent image, even if it alone exceeds the budget
+	while (used_bytes_ > budget_bytes_ && lru_.size() > 1) {
+		std::unordered_map<std::string, Entry>::iterator it = entries_.find(lru_.back());
+		used_bytes_ -= imageBytes(it->second.image);
+		entries_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+size_t ImageCache::imageBytes(const cv::Mat &image)
+{
+	return image.total() * image.elemSize();
+}
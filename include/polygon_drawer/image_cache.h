@@ -0,0 +1,67 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+class DisplayCache;
+class Profiler;
+
+// Decoded images are kept in an LRU list bounded by a memory budget.
+// A background worker decodes the prefetch queue so that navigation
+// rarely has to wait on cv::imread. With a DisplayCache the images are
+// its display-resolution copies; get() reports the original size.
+class ImageCache {
+public:
+	ImageCache(size_t budget_mb = 1024);
+	~ImageCache();
+	void setBudget(size_t budget_mb);
+	void setProfiler(Profiler *profiler);
+	void setDisplayCache(DisplayCache *display_cache);
+	cv::Mat get(const std::string &filename, cv::Size *full_size = NULL);
+	void prefetch(const std::vector<std::string> &filenames);
+	bool contains(const std::string &filename);
+	void erase(const std::string &filename);
+	size_t size();
+	size_t bytesUsed();
+	size_t budget() { return budget_bytes_; }
+
+private:
+	struct Entry {
+		cv::Mat image;
+		cv::Size full_size;
+		std::list<std::string>::iterator lru_pos;
+	};
+
+	void workerLoop();
+	cv::Mat decode(const std::string &filename, cv::Size &full_size);
+	void insert(const std::string &filename, const cv::Mat &image, cv::Size full_size);
+	void evict();
+	static size_t imageBytes(const cv::Mat &image);
+
+	std::unordered_map<std::string, Entry> entries_;
+	std::list<std::string> lru_;
+	std::deque<std::string> pending_;
+	std::set<std::string> in_flight_;
+	size_t budget_bytes_;
+	size_t used_bytes_;
+	bool stop_;
+	Profiler *profiler_;   // optional, times the decodes
+	DisplayCache *display_cache_;   // optional, set before the first get
+
+	std::mutex mutex_;
+	std::condition_variable work_cond_;
+	std::condition_variable done_cond_;
+	std::thread worker_;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "image_scanner.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <boost/filesystem.hpp>
+
+namespace {
+	uint32_t readBigEndian(const unsigned char *p, int n) {
+		uint32_t value = 0;
+		for (int i=0; i<n; i++) {
+			value = (value << 8) | p[i];
+		}
+		return value;
+	}
+
+	uint32_t readLittleEndian(const unsigned char *p, int n) {
+		uint32_t value = 0;
+		for (int i=n-1; i>=0; i--) {
+			value = (value << 8) | p[i];
+		}
+		return value;
+	}
+
+	bool probeJpeg(FILE *fp, cv::Size &size) {
+		// Walk the marker segments up to the first SOFn frame header
+		while (true) {
+			int c = fgetc(fp);
+			if (c == EOF) return false;
+			if (c != 0xFF) continue;
+
+			int marker;
+			do {
+				marker = fgetc(fp);
+			} while (marker == 0xFF);
+			if (marker == EOF) return false;
+
+			if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+			if (marker == 0xD9 || marker == 0xDA) return false;
+
+			unsigned char len_buf[2];
+			if (fread(len_buf, 1, 2, fp) != 2) return false;
+			int len = int(readBigEndian(len_buf, 2));
+			if (len < 2) return false;
+
+			bool is_sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+			if (is_sof) {
+				unsigned char sof[5];
+				if (fread(sof, 1, 5, fp) != 5) return false;
+				size = cv::Size(int(readBigEndian(sof + 3, 2)), int(readBigEndian(sof + 1, 2)));
+				return size.width > 0 && size.height > 0;
+			}
+			if (fseek(fp, len - 2, SEEK_CUR) != 0) return false;
+		}
+	}
+}
+
+ImageScanner::ImageScanner(int num_threads, bool probe_size)
+	: num_threads_(num_threads > 0 ? num_threads : ThreadPool::defaultThreads())
+	, probe_size_(probe_size)
+	, last_scan_ms_(0)
+{
+}
+
+bool ImageScanner::scan(std::string dir, std::vector<LabelImageInfo> &outputs)
+{
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+	while (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+		dir.erase(dir.size() - 1);
+	}
+
+	boost::system::error_code ec;
+	if (!boost::filesystem::is_directory(dir, ec)) {
+		last_scan_ms_ = 0;
+		return false;
+	}
+
+	results_.clear();
+	{
+		ThreadPool pool(num_threads_);
+		pool.submit([this, &pool, dir]() { this->scanDirectory(pool, dir, dir); });
+		pool.wait();
+	}
+
+	// Workers finish in any order, sort to keep navigation deterministic
+	std::sort(results_.begin(), results_.end(), [](const LabelImageInfo &a, const LabelImageInfo &b) {
+		return a.name < b.name;
+	});
+	outputs.swap(results_);
+	results_.clear();
+
+	last_scan_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	return !outputs.empty();
+}
+
+void ImageScanner::scanDirectory(ThreadPool &pool, const std::string &root, const std::string &dir)
+{
+	std::vector<LabelImageInfo> found;
+
+	boost::system::error_code ec;
+	boost::filesystem::directory_iterator it(dir, ec), it_end;
+	if (ec) {
+		std::cout << utils::getBashColorText("[Warning] Cannot read directory " + dir + ": " + ec.message(), 'y', 'b') << std::endl;
+		return;
+	}
+
+	for (; it != it_end; it.increment(ec)) {
+		if (ec) break;
+		const std::string filename = it->path().string();
+
+		// Like recursive_directory_iterator, symlinked directories are not followed
+		boost::filesystem::file_status link_status = it->symlink_status(ec);
+		if (ec) continue;
+		boost::filesystem::file_status status = boost::filesystem::is_symlink(link_status) ? it->status(ec) : link_status;
+		if (ec) continue;
+
+		if (boost::filesystem::is_directory(link_status)) {
+			pool.submit([this, &pool, root, filename]() { this->scanDirectory(pool, root, filename); });
+			continue;
+		}
+		if (!boost::filesystem::is_regular_file(status) || !isImageFile(filename)) continue;
+
+		LabelImageInfo info;
+		info.name = filename.substr(root.size() + 1);
+		info.filename = filename;
+		statFile(filename, info.file_size, info.mtime);
+		if (probe_size_) {
+			probeImageSize(filename, info.size);
+		}
+		found.push_back(info);
+	}
+
+	if (!found.empty()) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		results_.insert(results_.end(), found.begin(), found.end());
+	}
+}
+
+bool ImageScanner::isImageFile(const std::string &filename)
+{
+	std::size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos) return false;
+
+	std::string ext = filename.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == "jpg" || ext == "jpeg" || ext == "jpe" || ext == "png" || ext == "bmp"
+		|| ext == "tif" || ext == "tiff" || ext == "webp";
+}
+
+bool ImageScanner::probeImageSize(const std::string &filename, cv::Size &size)
+{
+	// Size as stored in the file, EXIF orientation is not applied
+	size = cv::Size(0, 0);
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (fp == NULL) return false;
+
+	bool ok = false;
+	unsigned char head[26];
+	size_t n = fread(head, 1, sizeof(head), fp);
+
+	if (n >= 2 && head[0] == 0xFF && head[1] == 0xD8) {
+		fseek(fp, 2, SEEK_SET);
+		ok = probeJpeg(fp, size);
+	} else if (n >= 24 && memcmp(head, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(head + 12, "IHDR", 4) == 0) {
+		size = cv::Size(int(readBigEndian(head + 16, 4)), int(readBigEndian(head + 20, 4)));
+		ok = true;
+	} else if (n >= 26 && head[0] == 'B' && head[1] == 'M') {
+		// Height is negative for top-down bitmaps
+		size = cv::Size(int(int32_t(readLittleEndian(head + 18, 4))), std::abs(int(int32_t(readLittleEndian(head + 22, 4)))));
+		ok = true;
+	}
+
+	fclose(fp);
+	return ok;
+}
+
+bool ImageScanner::statFile(const std::string &filename, uint64_t &file_size, int64_t &mtime)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) {
+		file_size = 0;
+		mtime = 0;
+		return false;
+	}
+	file_size = uint64_t(st.st_size);
+	mtime = int64_t(st.st_mtime);
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef IMAGE_SCANNER_H
+#define IMAGE_SCANNER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/common.h"
+
+class ThreadPool;
+
+// Builds the image index of a directory tree. Sub-directories are listed
+// in parallel and only image extensions are kept; width and height come
+// from the JPEG/PNG/BMP headers, so no pixel data is decoded.
+class ImageScanner {
+public:
+	ImageScanner(int num_threads = 0, bool probe_size = true);
+	bool scan(std::string dir, std::vector<LabelImageInfo> &outputs);
+	double lastScanMs() { return last_scan_ms_; }
+	int threads() { return num_threads_; }
+
+	static bool isImageFile(const std::string &filename);
+	static bool probeImageSize(const std::string &filename, cv::Size &size);
+	static bool statFile(const std::string &filename, uint64_t &file_size, int64_t &mtime);
+
+private:
+	void scanDirectory(ThreadPool &pool, const std::string &root, const std::string &dir);
+
+	int num_threads_;
+	bool probe_size_;
+	double last_scan_ms_;
+	std::mutex mutex_;
+	std::vector<LabelImageInfo> results_;
+};
+
+#endif
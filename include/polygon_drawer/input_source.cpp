@@ -0,0 +1,278 @@
+#include "input_source.h"
+#include "profiler.h"
+#include "utils.h"
+
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+	struct MouseName {
+		const char *name;
+		int event;
+	};
+	
+	// Only the events the editor handles
+	const MouseName MOUSE_NAMES[] = {
+		{"down", cv::EVENT_LBUTTONDOWN},
+		{"move", cv::EVENT_MOUSEMOVE},
+		{"up", cv::EVENT_LBUTTONUP},
+		{"rdown", cv::EVENT_RBUTTONDOWN},
+		{"rup", cv::EVENT_RBUTTONUP},
+		{"wheel", cv::EVENT_MOUSEWHEEL},
+	};
+	const int NUM_MOUSE_NAMES = sizeof(MOUSE_NAMES) / sizeof(MOUSE_NAMES[0]);
+	const int ESC = 27;
+}
+
+HighGuiInput::HighGuiInput(const std::string &winname, const std::string &record_file)
+	: winname_(winname)
+	, callback_(NULL)
+	, param_(NULL)
+{
+	cv::namedWindow(winname_, 1);
+	if (!record_file.empty()) {
+		record_.open(record_file.c_str());
+		if (record_.is_open()) {
+			record_ << "# polygon_drawer event log, replay with --replay" << std::endl;
+		} else {
+			std::cout << utils::getBashColorText("[Warning] Cannot record the events to " + record_file, 'y', 'b') << std::endl;
+		}
+	}
+}
+
+void HighGuiInput::setMouseCallback(cv::MouseCallback callback, void *param)
+{
+	callback_ = callback;
+	param_ = param;
+	cv::setMouseCallback(winname_, &HighGuiInput::onMouse, this);
+}
+
+void HighGuiInput::onMouse(int event, int x, int y, int flags, void *param)
+{
+	HighGuiInput *pThis = (HighGuiInput *) param;
+	pThis->event_seq_++;
+	if (pThis->isRecording()) {
+		for (int i=0; i<NUM_MOUSE_NAMES; i++) {
+			if (MOUSE_NAMES[i].event != event) continue;
+			if (event == cv::EVENT_MOUSEWHEEL) {
+				pThis->record(cv::format("wheel %d %d %d", x, y, cv::getMouseWheelDelta(flags)));
+			} else {
+				pThis->record(cv::format("%s %d %d", MOUSE_NAMES[i].name, x, y));
+			}
+			break;
+		}
+	}
+	if (pThis->callback_ != NULL) {
+		pThis->callback_(event, x, y, flags, pThis->param_);
+	}
+}
+
+void HighGuiInput::show(const cv::Mat &frame, const FrameInfo &info)
+{
+	cv::imshow(winname_, frame);
+}
+
+int HighGuiInput::waitKey(int delay_ms)
+{
+	int key = cv::waitKey(delay_ms);
+	if (key >= 0) {
+		event_seq_++;
+		int c = key & 0xff;
+		if (this->isRecording()) {
+			this->record(std::isgraph(c) ? cv::format("key %c", c) : cv::format("key %d", c));
+		}
+	}
+	return key;
+}
+
+bool HighGuiInput::readLine(std::string &line, const std::atomic<bool> &cancel)
+{
+	// Polls stdin so that quitting is not held up by the prompt
+	while (!cancel) {
+		struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+		int ready = poll(&fd, 1, 100);
+		if (ready < 0) return false;
+		if (ready == 0) continue;
+		
+		if (!std::getline(std::cin, line)) return false;
+		event_seq_++;
+		if (this->isRecording()) {
+			this->record("text " + line);
+		}
+		return true;
+	}
+	return false;
+}
+
+void HighGuiInput::record(const std::string &line)
+{
+	std::lock_guard<std::mutex> lock(record_mutex_);
+	record_ << line << "\n";
+}
+
+ReplayInput::ReplayInput(double timeout_ms)
+	: callback_(NULL)
+	, param_(NULL)
+	, timeout_ms_(timeout_ms)
+	, next_(0)
+	, waiting_(true)
+	, wait_ns_(Profiler::now())
+	, frames_(0)
+	, timeouts_(0)
+{
+}
+
+bool ReplayInput::parseEvent(const std::string &line, Event &event)
+{
+	std::stringstream ss(line);
+	std::string name;
+	if (!(ss >> name)) return false;
+	event = Event();
+	event.line = line;
+	
+	if (name == "key") {
+		std::string token;
+		if (!(ss >> token)) return false;
+		if (token.size() == 1) {
+			event.key = (unsigned char) token[0];
+		} else {
+			char *end = NULL;
+			long code = strtol(token.c_str(), &end, 10);
+			if (*end != '\0' || code < 0 || code > 255) return false;
+			event.key = int(code);
+		}
+		event.type = Event::KEY;
+		return true;
+	}
+	if (name == "text") {
+		// The rest of the line, as typed at the prompt
+		std::getline(ss, event.text);
+		size_t start = event.text.find_first_not_of(" \t");
+		event.text = (start == std::string::npos) ? "" : event.text.substr(start);
+		event.type = Event::TEXT;
+		return true;
+	}
+	for (int i=0; i<NUM_MOUSE_NAMES; i++) {
+		if (name != MOUSE_NAMES[i].name) continue;
+		if (!(ss >> event.pt.x >> event.pt.y)) return false;
+		event.type = Event::MOUSE;
+		event.event = MOUSE_NAMES[i].event;
+		if (event.event == cv::EVENT_MOUSEWHEEL) {
+			// HighGUI keeps the wheel delta in the upper 16 bits of the flags
+			int delta;
+			if (!(ss >> delta)) return false;
+			event.flags = int(unsigned(delta) << 16);
+		}
+		return true;
+	}
+	return false;
+}
+
+bool ReplayInput::load(const std::string &filename)
+{
+	std::ifstream reader(filename.c_str());
+	if (!reader.is_open()) {
+		std::cout << utils::getBashColorText("[Error] Cannot open the event log " + filename, 'r', 'b') << std::endl;
+		return false;
+	}
+	
+	events_.clear();
+	std::string line;
+	for (int n=1; std::getline(reader, line); n++) {
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == std::string::npos || line[start] == '#') continue;
+		line = line.substr(start, line.find_last_not_of(" \t\r") + 1 - start);
+		Event event;
+		if (!parseEvent(line, event)) {
+			std::cout << utils::getBashColorText(cv::format("[Error] %s:%d: cannot parse '%s'", filename.c_str(), n, line.c_str()), 'r', 'b') << std::endl;
+			return false;
+		}
+		events_.push_back(event);
+	}
+	
+	// The session has to end for the annotations to be saved
+	if (events_.empty() || events_.back().type != Event::KEY || events_.back().key != ESC) {
+		Event event;
+		parseEvent("key 27", event);
+		events_.push_back(event);
+	}
+	next_ = 0;
+	waiting_ = true;
+	wait_ns_ = Profiler::now();
+	return true;
+}
+
+void ReplayInput::setMouseCallback(cv::MouseCallback callback, void *param)
+{
+	callback_ = callback;
+	param_ = param;
+}
+
+void ReplayInput::show(const cv::Mat &frame, const FrameInfo &info)
+{
+	last_frame_ = frame;
+	frames_++;
+	if (!waiting_ || !info.idle || info.input_seq < next_) return;
+	
+	if (next_ > 0) {
+		Event &event = events_[next_ - 1];
+		event.latency_ms = (Profiler::now() - event.sent_ns) * 1e-6;
+	}
+	waiting_ = false;
+}
+
+int ReplayInput::waitKey(int delay_ms)
+{
+	if (waiting_) {
+		if ((Profiler::now() - wait_ns_) * 1e-6 > timeout_ms_) {
+			// Lost events would stall the replay otherwise, e.g. text without a prompt
+			std::string what = (next_ > 0) ? "'" + events_[next_ - 1].line + "'" : "the first image";
+			std::cout << utils::getBashColorText(cv::format("[Warning] Replay: no frame for %s within %.0f ms", what.c_str(), timeout_ms_), 'y', 'b') << std::endl;
+			timeouts_++;
+			waiting_ = false;
+		} else {
+			// Short, the latency is measured to the next call of show()
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			return -1;
+		}
+	}
+	if (next_ >= events_.size()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+		return -1;
+	}
+	
+	Event &event = events_[next_++];
+	event_seq_ = next_;
+	event.sent_ns = Profiler::now();
+	waiting_ = true;
+	wait_ns_ = event.sent_ns;
+	if (event.type == Event::MOUSE) {
+		if (callback_ != NULL) {
+			callback_(event.event, event.pt.x, event.pt.y, event.flags, param_);
+		}
+	} else if (event.type == Event::TEXT) {
+		std::lock_guard<std::mutex> lock(text_mutex_);
+		text_.push_back(event.text);
+		text_cond_.notify_one();
+	} else {
+		return event.key;
+	}
+	return -1;
+}
+
+bool ReplayInput::readLine(std::string &line, const std::atomic<bool> &cancel)
+{
+	std::unique_lock<std::mutex> lock(text_mutex_);
+	while (text_.empty()) {
+		if (cancel) return false;
+		text_cond_.wait_for(lock, std::chrono::milliseconds(100));
+	}
+	line = text_.front();
+	text_.pop_front();
+	return true;
+}
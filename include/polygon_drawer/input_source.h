@@ -0,0 +1,133 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+// Shown with every frame: the last input event the frame reflects, and
+// whether the editor had nothing left to finish for it (no image loading,
+// no segmentation running)
+struct FrameInfo {
+	uint64_t input_seq;
+	bool idle;
+	
+	FrameInfo() : input_seq(0), idle(false) {}
+};
+
+// Where the editor's input comes from and where its frames go. The UI
+// thread calls show() and waitKey(), mouse events arrive through the
+// callback from within waitKey() as with HighGUI, and the console thread
+// reads the answers to the rename prompt with readLine(). Every event gets
+// a sequence number, eventSeq() is the one of the last event handed out.
+class InputSource {
+public:
+	virtual ~InputSource() {}
+	virtual void setMouseCallback(cv::MouseCallback callback, void *param) = 0;
+	virtual void show(const cv::Mat &frame, const FrameInfo &info) = 0;
+	virtual int waitKey(int delay_ms) = 0;
+	virtual bool readLine(std::string &line, const std::atomic<bool> &cancel) = 0;
+	uint64_t eventSeq() { return event_seq_; }
+	
+	// The source waits for the frame of each event before it sends the next,
+	// so every event has to produce a frame even when nothing changed
+	virtual bool waitsForFrames() { return false; }
+
+protected:
+	InputSource() : event_seq_(0) {}
+	
+	std::atomic<uint64_t> event_seq_;
+};
+
+// The HighGUI window and the terminal. Optionally writes every event to a
+// log in the format ReplayInput reads.
+class HighGuiInput : public InputSource {
+public:
+	HighGuiInput(const std::string &winname, const std::string &record_file = "");
+	bool isRecording() { return record_.is_open(); }
+	void setMouseCallback(cv::MouseCallback callback, void *param);
+	void show(const cv::Mat &frame, const FrameInfo &info);
+	int waitKey(int delay_ms);
+	bool readLine(std::string &line, const std::atomic<bool> &cancel);
+
+private:
+	static void onMouse(int event, int x, int y, int flags, void *param);
+	void record(const std::string &line);
+	
+	std::string winname_;
+	cv::MouseCallback callback_;
+	void *param_;
+	std::mutex record_mutex_;   // the UI and the console thread both record
+	std::ofstream record_;
+};
+
+// Replays an event log without a window: frames stay in memory and events
+// are handed out in a closed loop, each one only after the frame that shows
+// its result has arrived, so a replay is deterministic and the time from
+// an event to that frame is its end-to-end latency. One event per line,
+// '#' starts a comment:
+//   down x y, move x y, up x y       left button, window coordinates
+//   rdown x y, rup x y               right button (panning)
+//   wheel x y delta                  positive delta zooms in
+//   key c                            a single character, or a decimal key code such as 27
+//   text line                        one answer to the rename prompt
+// An ESC is appended when the log does not end the session itself.
+class ReplayInput : public InputSource {
+public:
+	struct Event {
+		enum Type { MOUSE, KEY, TEXT };
+		
+		int type;
+		int event;          // MOUSE: cv::EVENT_*
+		int flags;
+		cv::Point pt;
+		int key;            // KEY
+		std::string text;   // TEXT
+		std::string line;   // as in the log, for the report
+		int64_t sent_ns;    // when it was handed to the editor
+		double latency_ms;  // -1 while pending or after a timeout
+		
+		Event() : type(KEY), event(0), flags(0), key(-1), sent_ns(0), latency_ms(-1.0) {}
+	};
+	
+	ReplayInput(double timeout_ms = 10000.0);
+	bool load(const std::string &filename);
+	void setMouseCallback(cv::MouseCallback callback, void *param);
+	void show(const cv::Mat &frame, const FrameInfo &info);
+	int waitKey(int delay_ms);
+	bool readLine(std::string &line, const std::atomic<bool> &cancel);
+	bool waitsForFrames() { return true; }
+	
+	const std::vector<Event>& events() { return events_; }
+	const cv::Mat& lastFrame() { return last_frame_; }
+	size_t frames() { return frames_; }
+	size_t timeouts() { return timeouts_; }
+	
+	static bool parseEvent(const std::string &line, Event &event);
+
+private:
+	cv::MouseCallback callback_;
+	void *param_;
+	double timeout_ms_;
+	std::vector<Event> events_;
+	size_t next_;           // first event not sent yet, the last sent one has the sequence number next_
+	bool waiting_;          // for the frame of the last sent event, or for the first image before any
+	int64_t wait_ns_;       // since when
+	cv::Mat last_frame_;    // the offscreen window
+	size_t frames_;
+	size_t timeouts_;
+	
+	// Answers to the rename prompt, read on the console thread
+	std::mutex text_mutex_;
+	std::condition_variable text_cond_;
+	std::deque<std::string> text_;
+};
+
+#endif
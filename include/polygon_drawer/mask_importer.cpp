@@ -0,0 +1,120 @@
+#include "mask_importer.h"
+#include "geometry.h"
+
+#include <cmath>
+#include <algorithm>
+
+MaskImporter::MaskImporter(const annotation_io::ClassMap &classes, double tolerance_px, double min_area_px, const std::string &label)
+	: tolerance_px_(tolerance_px)
+	, min_area_px_(min_area_px)
+	, label_(label)
+	, traced_vertices_(0)
+{
+	for (annotation_io::ClassMap::const_iterator it = classes.begin(); it != classes.end(); it++) {
+		if (it->second >= int(class_names_.size())) class_names_.resize(it->second + 1);
+		class_names_[it->second] = it->first;
+	}
+}
+
+int MaskImporter::kindOf(const std::string &name)
+{
+	if (name == "binary") return BINARY;
+	if (name == "instance") return INSTANCE;
+	if (name == "class") return CLASS;
+	return 0;
+}
+
+std::string MaskImporter::labelOf(int kind, int value)
+{
+	if (kind != CLASS) return label_;
+	if (value < int(class_names_.size()) && !class_names_[value].empty()) return class_names_[value];
+	return cv::format("class%d", value);
+}
+
+int MaskImporter::import(const cv::Mat &mask, int kind, MyPolygonDrawer &drawer)
+{
+	if (mask.empty() || mask.channels() != 1) return -1;
+	
+	drawer.setImageSize(mask.size());
+	int count = 0;
+	if (kind == BINARY) {
+		this->addContours(mask != 0, cv::Point(0, 0), label_, false, drawer, count);
+		return count;
+	}
+	
+	// One pass for the bounding box of every value, then each value is traced inside its own box
+	cv::Mat values;
+	mask.convertTo(values, CV_32S);
+	std::vector<cv::Rect> boxes;
+	for (int y=0; y<values.rows; y++) {
+		const int *row = values.ptr<int>(y);
+		for (int x=0; x<values.cols; x++) {
+			int v = row[x];
+			if (v <= 0) continue;
+			if (v >= int(boxes.size())) boxes.resize(v + 1);
+			cv::Rect &box = boxes[v];
+			if (box.width == 0) {
+				box = cv::Rect(x, y, 1, 1);
+			} else {
+				int x1 = std::max(box.x + box.width, x + 1), y1 = std::max(box.y + box.height, y + 1);
+				box.x = std::min(box.x, x);
+				box.y = std::min(box.y, y);
+				box.width = x1 - box.x;
+				box.height = y1 - box.y;
+			}
+		}
+	}
+	
+	for (int v=1; v<int(boxes.size()); v++) {
+		if (boxes[v].width == 0) continue;
+		cv::Mat region = values(boxes[v]) == v;
+		if (kind == INSTANCE) {
+			this->addContours(region, boxes[v].tl(), cv::format("%s_%d", label_.c_str(), v), true, drawer, count);
+		} else {
+			int numbered = 0;
+			this->addContours(region, boxes[v].tl(), this->labelOf(kind, v), false, drawer, numbered);
+			count += numbered;
+		}
+	}
+	return count;
+}
+
+void MaskImporter::addContours(const cv::Mat &region, cv::Point offset, const std::string &label, bool largest_only, MyPolygonDrawer &drawer, int &count)
+{
+	std::vector<std::vector<cv::Point> > contours;
+	cv::findContours(region, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE, offset);
+	
+	// An instance covered in part by a later region can fall apart; its id belongs to the largest piece
+	std::vector<double> areas(contours.size());
+	size_t largest = 0;
+	for (size_t i=0; i<contours.size(); i++) {
+		traced_vertices_ += contours[i].size();
+		areas[i] = std::fabs(cv::contourArea(contours[i]));
+		if (areas[i] > areas[largest]) largest = i;
+	}
+	
+	cv::Size size = drawer.getImageSize();
+	std::vector<cv::Point2f> ring, simplified;
+	for (size_t i=0; i<contours.size(); i++) {
+		const std::vector<cv::Point> &contour = contours[i];
+		if (largest_only && i != largest) continue;
+		if (contour.size() < 3 || areas[i] < min_area_px_) continue;
+		
+		// Simplified in pixels, so the tolerance does not depend on the image size
+		ring.resize(contour.size());
+		for (size_t k=0; k<contour.size(); k++) {
+			ring[k] = cv::Point2f(float(contour[k].x), float(contour[k].y));
+		}
+		geometry::simplify(ring.data(), ring.size(), float(tolerance_px_), simplified);
+		if (simplified.size() < 3) continue;
+		
+		MyPolygon polygon;
+		polygon.points.resize(simplified.size());
+		for (size_t k=0; k<simplified.size(); k++) {
+			polygon.points[k] = cv::Point2f(simplified[k].x / size.width, simplified[k].y / size.height);
+		}
+		
+		drawer.addRegion(largest_only ? label : cv::format("%s_%d", label.c_str(), count + 1), polygon);
+		count++;
+	}
+}
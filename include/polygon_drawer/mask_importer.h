@@ -0,0 +1,38 @@
+#ifndef MASK_IMPORTER_H
+#define MASK_IMPORTER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/annotation_io.h"
+
+// The inverse of MaskRasterizer: traces the outer contour of every region
+// of a mask and adds it to a drawer as a simplified polygon.
+//   binary    any non-zero pixel; each connected blob becomes "<label>_<k>"
+//   instance  one region per pixel value (its largest blob), "<label>_<value>"
+//   class     one region per blob of a class value, "<class>_<k>", with
+//             the class names from the ClassMap ("class<value>" if unknown)
+// Holes are not kept, polygons have no inner rings.
+class MaskImporter {
+public:
+	enum Kind { BINARY = 1, INSTANCE = 2, CLASS = 4 };
+	
+	MaskImporter(const annotation_io::ClassMap &classes = annotation_io::ClassMap(), double tolerance_px = 1.0, double min_area_px = 4.0, const std::string &label = "object");
+	int import(const cv::Mat &mask, int kind, MyPolygonDrawer &drawer);
+	size_t tracedVertices() { return traced_vertices_; }
+	
+	static int kindOf(const std::string &name);
+
+private:
+	void addContours(const cv::Mat &region, cv::Point offset, const std::string &label, bool largest_only, MyPolygonDrawer &drawer, int &count);
+	std::string labelOf(int kind, int value);
+	
+	std::vector<std::string> class_names_;   // by class index
+	double tolerance_px_;
+	double min_area_px_;
+	std::string label_;
+	size_t traced_vertices_;
+};
+
+#endif
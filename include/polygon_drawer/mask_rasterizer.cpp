@@ -0,0 +1,47 @@
+#include "mask_rasterizer.h"
+
+#include <cmath>
+
+MaskRasterizer::MaskRasterizer(const annotation_io::ClassMap &classes)
+	: classes_(classes)
+	, class_type_(classes.size() > 255 ? CV_16UC1 : CV_8UC1)
+{
+}
+
+int MaskRasterizer::classOf(const std::string &id)
+{
+	return annotation_io::classOf(classes_, id);
+}
+
+void MaskRasterizer::toPixels(const PolygonStore::View &polygon, cv::Size size, std::vector<cv::Point> &pixels)
+{
+	pixels.resize(polygon.size());
+	for (size_t k=0; k<polygon.size(); k++) {
+		pixels[k] = cv::Point(int(std::floor(polygon[k].x * size.width + 0.5f)), int(std::floor(polygon[k].y * size.height + 0.5f)));
+	}
+}
+
+int MaskRasterizer::rasterize(const MyPolygonDrawer &drawer, int kinds, cv::Mat &binary, cv::Mat &instance, cv::Mat &classes)
+{
+	cv::Size size = drawer.getImageSize();
+	if (size.width <= 0 || size.height <= 0) return -1;
+	
+	if (kinds & BINARY) binary = cv::Mat::zeros(size, CV_8UC1);
+	if (kinds & INSTANCE) instance = cv::Mat::zeros(size, CV_16UC1);
+	if (kinds & CLASS) classes = cv::Mat::zeros(size, class_type_);
+	
+	const PolygonStore &polygons = drawer.getPolygons();
+	std::vector<std::vector<cv::Point> > contour(1);
+	int index = 0;
+	for (PolygonStore::const_iterator it = polygons.begin(); it != polygons.end(); ++it) {
+		PolygonStore::View polygon = *it;
+		index++;
+		if (polygon.size() < 3) continue;
+		
+		this->toPixels(polygon, size, contour[0]);
+		if (kinds & BINARY) cv::fillPoly(binary, contour, cv::Scalar(255));
+		if (kinds & INSTANCE) cv::fillPoly(instance, contour, cv::Scalar(index));
+		if (kinds & CLASS) cv::fillPoly(classes, contour, cv::Scalar(this->classOf(polygon.id())));
+	}
+	return index;
+}
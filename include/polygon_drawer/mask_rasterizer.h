@@ -0,0 +1,31 @@
+#ifndef MASK_RASTERIZER_H
+#define MASK_RASTERIZER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/annotation_io.h"
+
+// Turns the polygons of one drawer into segmentation masks at the stored
+// image size. Regions are filled in id order, later ones on top:
+//   binary    CV_8UC1, 255 inside any region
+//   instance  CV_16UC1, 1-based index of the region in id order
+//   class     CV_8UC1 (CV_16UC1 above 255 classes), 1-based class index
+class MaskRasterizer {
+public:
+	enum Kind { BINARY = 1, INSTANCE = 2, CLASS = 4, ALL = 7 };
+	
+	MaskRasterizer(const annotation_io::ClassMap &classes = annotation_io::ClassMap());
+	int rasterize(const MyPolygonDrawer &drawer, int kinds, cv::Mat &binary, cv::Mat &instance, cv::Mat &classes);
+	int classOf(const std::string &id);
+	const annotation_io::ClassMap& classes() { return classes_; }
+	
+	static void toPixels(const PolygonStore::View &polygon, cv::Size size, std::vector<cv::Point> &pixels);
+
+private:
+	annotation_io::ClassMap classes_;
+	int class_type_;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "polygon_store.h"
+
+#include <atomic>
+#include <algorithm>
+
+PolygonStore::Page::Page()
+	: dead_vertices(0)
+	, dead_chars(0)
+{
+	for (int i=0; i<PAGE_SLOTS; i++) {
+		vertex_begin[i] = 0;
+		vertex_count[i] = 0;
+		id_begin[i] = 0;
+		id_length[i] = 0;
+		alive[i] = 0;
+	}
+}
+
+void PolygonStore::Page::compact()
+{
+	// Rewrite both buffers in slot order; slots keep their numbers
+	std::vector<cv::Point2f> new_vertices;
+	std::vector<char> new_chars;
+	new_vertices.reserve(vertices.size() - dead_vertices);
+	new_chars.reserve(chars.size() - dead_chars);
+	
+	for (int i=0; i<PAGE_SLOTS; i++) {
+		if (!alive[i]) continue;
+		const cv::Point2f *pts = vertices.data() + vertex_begin[i];
+		uint32_t begin = uint32_t(new_vertices.size());
+		new_vertices.insert(new_vertices.end(), pts, pts + vertex_count[i]);
+		vertex_begin[i] = begin;
+		
+		const char *text = chars.data() + id_begin[i];
+		begin = uint32_t(new_chars.size());
+		new_chars.insert(new_chars.end(), text, text + id_length[i]);
+		id_begin[i] = begin;
+	}
+	
+	vertices.swap(new_vertices);
+	chars.swap(new_chars);
+	dead_vertices = 0;
+	dead_chars = 0;
+}
+
+PolygonStore::PolygonStore()
+	: order_(std::make_shared<std::vector<uint32_t> >())
+	, slot_count_(0)
+	, vertex_count_(0)
+{
+}
+
+void PolygonStore::clear()
+{
+	// Other copies keep their pages, this store just lets go of them
+	pages_.clear();
+	order_ = std::make_shared<std::vector<uint32_t> >();
+	free_slots_.clear();
+	slot_count_ = 0;
+	vertex_count_ = 0;
+}
+
+void PolygonStore::reserve(size_t polygons, size_t vertices)
+{
+	// Vertex buffers grow per page; only the tables that span every polygon are reserved
+	pages_.reserve((polygons + PAGE_SLOTS - 1) / PAGE_SLOTS);
+	this->mutableOrder().reserve(polygons);
+}
+
+PolygonStore::Page& PolygonStore::mutablePage(int slot)
+{
+	std::shared_ptr<Page> &page = pages_[slot >> PAGE_BITS];
+	if (page.use_count() != 1) {
+		// Another copy, e.g. an undo version or a frame being rendered, still reads it
+		page = std::make_shared<Page>(*page);
+	} else {
+		// Orders the write after the reads of an owner that just let go on another thread
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	return *page;
+}
+
+std::vector<uint32_t>& PolygonStore::mutableOrder()
+{
+	if (order_.use_count() != 1) {
+		order_ = std::make_shared<std::vector<uint32_t> >(*order_);
+	} else {
+		std::atomic_thread_fence(std::memory_order_acquire);
+	}
+	return *order_;
+}
+
+boost::string_ref PolygonStore::idRef(int slot) const
+{
+	const Page &page = *pages_[slot >> PAGE_BITS];
+	int i = slot & PAGE_MASK;
+	return boost::string_ref(page.chars.data() + page.id_begin[i], page.id_length[i]);
+}
+
+const cv::Point2f* PolygonStore::points(int slot) const
+{
+	const Page &page = *pages_[slot >> PAGE_BITS];
+	return page.vertices.data() + page.vertex_begin[slot & PAGE_MASK];
+}
+
+cv::Point2f* PolygonStore::mutablePoints(int slot)
+{
+	Page &page = this->mutablePage(slot);
+	return page.vertices.data() + page.vertex_begin[slot & PAGE_MASK];
+}
+
+bool PolygonStore::valid(int slot) const
+{
+	return slot >= 0 && size_t(slot) < slot_count_ && pages_[slot >> PAGE_BITS]->alive[slot & PAGE_MASK];
+}
+
+size_t PolygonStore::lowerBound(boost::string_ref id) const
+{
+	const std::vector<uint32_t> &order = *order_;
+	size_t lo = 0, hi = order.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (this->idRef(int(order[mid])) < id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+int PolygonStore::find(const std::string &id) const
+{
+	size_t pos = this->lowerBound(id);
+	if (pos < order_->size() && this->idRef(int((*order_)[pos])) == boost::string_ref(id)) {
+		return int((*order_)[pos]);
+	}
+	return -1;
+}
+
+uint32_t PolygonStore::allocateSlot()
+{
+	if (!free_slots_.empty()) {
+		uint32_t slot = free_slots_.back();
+		free_slots_.pop_back();
+		return slot;
+	}
+	if (slot_count_ == pages_.size() * PAGE_SLOTS) {
+		pages_.push_back(std::make_shared<Page>());
+	}
+	return uint32_t(slot_count_++);
+}
+
+int PolygonStore::insert(const std::string &id, const cv::Point2f *points, size_t n)
+{
+	// Loading writes ids in sorted order, so appending is the common case
+	const std::vector<uint32_t> &order = *order_;
+	size_t pos = order.size();
+	if (!order.empty() && !(this->idRef(int(order.back())) < boost::string_ref(id))) {
+		pos = this->lowerBound(id);
+		if (pos < order.size() && this->idRef(int(order[pos])) == boost::string_ref(id)) {
+			return -1;
+		}
+	}
+	
+	uint32_t slot = this->allocateSlot();
+	Page &page = this->mutablePage(int(slot));
+	int i = slot & PAGE_MASK;
+	page.vertex_begin[i] = uint32_t(page.vertices.size());
+	page.vertex_count[i] = uint32_t(n);
+	page.vertices.insert(page.vertices.end(), points, points + n);
+	page.id_begin[i] = uint32_t(page.chars.size());
+	page.id_length[i] = uint32_t(id.size());
+	page.chars.insert(page.chars.end(), id.begin(), id.end());
+	page.alive[i] = 1;
+	vertex_count_ += n;
+	
+	std::vector<uint32_t> &new_order = this->mutableOrder();
+	new_order.insert(new_order.begin() + pos, slot);
+	return int(slot);
+}
+
+int PolygonStore::insert(const std::string &id, const std::vector<cv::Point2f> &points)
+{
+	return this->insert(id, points.data(), points.size());
+}
+
+bool PolygonStore::erase(int slot)
+{
+	if (!this->valid(slot)) return false;
+	
+	size_t pos = this->lowerBound(this->idRef(slot));
+	std::vector<uint32_t> &order = this->mutableOrder();
+	order.erase(order.begin() + pos);
+	
+	Page &page = this->mutablePage(slot);
+	int i = slot & PAGE_MASK;
+	page.alive[i] = 0;
+	page.dead_vertices += page.vertex_count[i];
+	page.dead_chars += page.id_length[i];
+	vertex_count_ -= page.vertex_count[i];
+	page.vertex_count[i] = 0;
+	page.id_length[i] = 0;
+	free_slots_.push_back(uint32_t(slot));
+	
+	if (page.dead_vertices > page.vertices.size() / 2 || page.dead_chars > page.chars.size() / 2) {
+		page.compact();
+	}
+	return true;
+}
+
+bool PolygonStore::rename(int slot, const std::string &id)
+{
+	if (!this->valid(slot)) return false;
+	if (this->find(id) >= 0) return false;
+	
+	size_t pos = this->lowerBound(this->idRef(slot));
+	std::vector<uint32_t> &order = this->mutableOrder();
+	order.erase(order.begin() + pos);
+	
+	// The old id stays in the buffer as garbage until the next compaction
+	Page &page = this->mutablePage(slot);
+	int i = slot & PAGE_MASK;
+	page.dead_chars += page.id_length[i];
+	page.id_begin[i] = uint32_t(page.chars.size());
+	page.id_length[i] = uint32_t(id.size());
+	page.chars.insert(page.chars.end(), id.begin(), id.end());
+	order.insert(order.begin() + this->lowerBound(id), uint32_t(slot));
+
+	if (page.dead_chars > page.chars.size() / 2) {
+		page.compact();
+	}
+	return true;
+}
@@ -0,0 +1,128 @@
+#ifndef POLYGON_STORE_H
+#define POLYGON_STORE_H
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <memory>
+#include <stdint.h>
+#include <boost/utility/string_ref.hpp>
+#include <opencv2/opencv.hpp>
+
+// Structure-of-arrays polygon container. Slots are grouped into pages of
+// 32; the vertices of a page live in one buffer and its ids in one
+// character buffer, and each slot holds offsets into both. Slots are stable
+// handles until the polygon is erased. Iteration follows id order, like the
+// std::map it replaces.
+//
+// Pages and the id order are shared between copies and copied on the first
+// write, so copying a store costs one pointer per page and an edit copies
+// only the page it touches (and the order on insert, erase and rename).
+// Old copies stay valid and unchanged, which is what the undo history keeps.
+class PolygonStore {
+public:
+	class View {
+	public:
+		View() : store_(NULL), slot_(-1) {}
+		View(const PolygonStore *store, int slot) : store_(store), slot_(slot) {}
+		
+		int slot() const { return slot_; }
+		boost::string_ref idRef() const { return store_->idRef(slot_); }
+		std::string id() const { return store_->idRef(slot_).to_string(); }
+		const cv::Point2f* points() const { return store_->points(slot_); }
+		size_t size() const { return store_->pointCount(slot_); }
+		bool empty() const { return this->size() == 0; }
+		const cv::Point2f& operator[](size_t i) const { return this->points()[i]; }
+		const cv::Point2f* begin() const { return this->points(); }
+		const cv::Point2f* end() const { return this->points() + this->size(); }
+	
+	private:
+		const PolygonStore *store_;
+		int slot_;
+	};
+	
+	class const_iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef View value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const View* pointer;
+		typedef View reference;
+		
+		const_iterator() : store_(NULL), pos_(0) {}
+		const_iterator(const PolygonStore *store, size_t pos) : store_(store), pos_(pos) {}
+		
+		View operator*() const { return View(store_, int((*store_->order_)[pos_])); }
+		const_iterator& operator++() { pos_++; return *this; }
+		const_iterator operator++(int) { const_iterator tmp = *this; pos_++; return tmp; }
+		const_iterator& operator--() { pos_--; return *this; }
+		const_iterator operator--(int) { const_iterator tmp = *this; pos_--; return tmp; }
+		bool operator==(const const_iterator &other) const { return pos_ == other.pos_; }
+		bool operator!=(const const_iterator &other) const { return pos_ != other.pos_; }
+	
+	private:
+		const PolygonStore *store_;
+		size_t pos_;
+	};
+	
+	PolygonStore();
+	void clear();
+	void reserve(size_t polygons, size_t vertices);
+	
+	int insert(const std::string &id, const cv::Point2f *points, size_t n);
+	int insert(const std::string &id, const std::vector<cv::Point2f> &points);
+	bool erase(int slot);
+	bool rename(int slot, const std::string &id);
+	int find(const std::string &id) const;
+	bool valid(int slot) const;
+	
+	size_t size() const { return order_->size(); }
+	bool empty() const { return order_->empty(); }
+	size_t vertexCount() const { return vertex_count_; }
+	size_t slotCount() const { return slot_count_; }
+	
+	View view(int slot) const { return View(this, slot); }
+	View back() const { return View(this, int(order_->back())); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, order_->size()); }
+	
+	boost::string_ref idRef(int slot) const;
+	size_t pointCount(int slot) const { return pages_[slot >> PAGE_BITS]->vertex_count[slot & PAGE_MASK]; }
+	const cv::Point2f* points(int slot) const;
+	cv::Point2f* mutablePoints(int slot);
+
+private:
+	enum { PAGE_BITS = 5, PAGE_SLOTS = 1 << PAGE_BITS, PAGE_MASK = PAGE_SLOTS - 1 };
+	
+	struct Page {
+		// Buffers shared by the polygons of the page
+		std::vector<cv::Point2f> vertices;
+		std::vector<char> chars;
+		
+		// Per-slot columns
+		uint32_t vertex_begin[PAGE_SLOTS];
+		uint32_t vertex_count[PAGE_SLOTS];
+		uint32_t id_begin[PAGE_SLOTS];
+		uint32_t id_length[PAGE_SLOTS];
+		uint8_t alive[PAGE_SLOTS];
+		
+		size_t dead_vertices;
+		size_t dead_chars;
+		
+		Page();
+		void compact();
+	};
+	
+	size_t lowerBound(boost::string_ref id) const;
+	uint32_t allocateSlot();
+	Page& mutablePage(int slot);
+	std::vector<uint32_t>& mutableOrder();
+	
+	std::vector<std::shared_ptr<Page> > pages_;
+	std::shared_ptr<std::vector<uint32_t> > order_;   // live slots sorted by id
+	std::vector<uint32_t> free_slots_;
+	size_t slot_count_;
+	size_t vertex_count_;
+};
+
+#endif
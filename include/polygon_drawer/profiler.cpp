@@ -0,0 +1,222 @@
+#include "profiler.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+namespace {
+	std::atomic<unsigned> next_serial(1);
+	
+	struct ThreadCache {
+		unsigned serial;
+		void *data;
+	};
+	thread_local ThreadCache thread_cache = {0, NULL};
+}
+
+Profiler::Profiler(bool enabled, size_t trace_events)
+	: enabled_(enabled)
+	, serial_(next_serial++)
+	, trace_capacity_(trace_events)
+	, start_ns_(now())
+{
+}
+
+int64_t Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* Profiler::stageName(int stage)
+{
+	static const char *names[NUM_STAGES] = {
+		"frame", "image", "decode", "prefetch", "compose", "draw", "imshow", "waitKey", "load", "save", "autosave", "input", "proposal"
+	};
+	return (stage >= 0 && stage < NUM_STAGES) ? names[stage] : "unknown";
+}
+
+Profiler::ThreadData* Profiler::threadData()
+{
+	if (thread_cache.serial == serial_) {
+		return static_cast<ThreadData*>(thread_cache.data);
+	}
+	
+	// First sample of this thread: the only time the lock is taken on the recording path
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::thread::id id = std::this_thread::get_id();
+	ThreadData *data = NULL;
+	for (size_t i=0; i<threads_.size() && data == NULL; i++) {
+		if (threads_[i]->id == id) data = threads_[i].get();
+	}
+	if (data == NULL) {
+		threads_.push_back(std::unique_ptr<ThreadData>(new ThreadData()));
+		data = threads_.back().get();
+		data->id = id;
+		data->tid = int(threads_.size());
+		data->name = cv::format("thread %d", data->tid);
+		for (int s=0; s<NUM_STAGES; s++) {
+			for (int b=0; b<NUM_BUCKETS; b++) data->buckets[s][b] = 0;
+			data->count[s] = 0;
+			data->total_ns[s] = 0;
+			data->max_ns[s] = 0;
+			data->last_ns[s] = 0;
+		}
+		data->events.resize(trace_capacity_);
+		data->n_events = 0;
+	}
+	thread_cache.serial = serial_;
+	thread_cache.data = data;
+	return data;
+}
+
+void Profiler::nameThread(const std::string &name)
+{
+	if (!enabled_) return;
+	ThreadData *data = this->threadData();
+	std::lock_guard<std::mutex> lock(mutex_);
+	data->name = name;
+}
+
+int Profiler::bucketOf(int64_t ns)
+{
+	if (ns < 4) return int(std::max(ns, int64_t(0)));
+	
+	// Octave from the leading bit, then the two bits below it select the sub-bucket
+	int e = 63 - __builtin_clzll(uint64_t(ns));
+	int bucket = 4 * (e - 1) + int((ns >> (e - 2)) & 3);
+	return std::min(bucket, int(NUM_BUCKETS) - 1);
+}
+
+double Profiler::bucketValue(int bucket)
+{
+	if (bucket < 4) return double(bucket);
+	
+	// Middle of the bucket
+	int e = bucket / 4 + 1;
+	double width = double(int64_t(1) << (e - 2));
+	return (4 + bucket % 4) * width + 0.5 * width;
+}
+
+void Profiler::record(int stage, int64_t start_ns, int64_t end_ns)
+{
+	if (!enabled_ || stage < 0 || stage >= NUM_STAGES) return;
+	
+	ThreadData *data = this->threadData();
+	int64_t ns = end_ns - start_ns;
+	
+	// Single writer per thread: plain load/store pairs instead of read-modify-write
+	std::atomic<uint64_t> &bucket = data->buckets[stage][bucketOf(ns)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	data->count[stage].store(data->count[stage].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	data->total_ns[stage].store(data->total_ns[stage].load(std::memory_order_relaxed) + uint64_t(ns), std::memory_order_relaxed);
+	if (ns > data->max_ns[stage].load(std::memory_order_relaxed)) {
+		data->max_ns[stage].store(ns, std::memory_order_relaxed);
+	}
+	data->last_ns[stage].store(ns, std::memory_order_relaxed);
+	
+	// Ring buffer: a long session keeps its most recent events
+	if (!data->events.empty()) {
+		size_t n = data->n_events.load(std::memory_order_relaxed);
+		Event &event = data->events[n % data->events.size()];
+		event.start_ns = start_ns;
+		event.duration_ns = ns;
+		event.stage = stage;
+		data->n_events.store(n + 1, std::memory_order_release);
+	}
+}
+
+Profiler::Summary Profiler::summary(int stage)
+{
+	Summary out = {0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	if (stage < 0 || stage >= NUM_STAGES) return out;
+	
+	// Merge the threads; the writers keep going, so the result is a snapshot within a few samples
+	std::vector<uint64_t> buckets(NUM_BUCKETS, 0);
+	uint64_t total_ns = 0;
+	int64_t max_ns = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (size_t i=0; i<threads_.size(); i++) {
+			ThreadData &data = *threads_[i];
+			uint64_t count = data.count[stage].load(std::memory_order_relaxed);
+			if (count == 0) continue;
+			for (int b=0; b<NUM_BUCKETS; b++) {
+				buckets[b] += data.buckets[stage][b].load(std::memory_order_relaxed);
+			}
+			out.count += count;
+			total_ns += data.total_ns[stage].load(std::memory_order_relaxed);
+			max_ns = std::max(max_ns, data.max_ns[stage].load(std::memory_order_relaxed));
+			out.last_ms = data.last_ns[stage].load(std::memory_order_relaxed) * 1e-6;
+		}
+	}
+	if (out.count == 0) return out;
+	
+	uint64_t n = 0;
+	for (int b=0; b<NUM_BUCKETS; b++) n += buckets[b];
+	uint64_t rank50 = (n + 1) / 2, rank99 = std::max(uint64_t(1), (n * 99 + 99) / 100);
+	uint64_t seen = 0;
+	out.p50_ms = out.p99_ms = -1.0;
+	for (int b=0; b<NUM_BUCKETS; b++) {
+		seen += buckets[b];
+		if (out.p50_ms < 0.0 && seen >= rank50) out.p50_ms = bucketValue(b) * 1e-6;
+		if (out.p99_ms < 0.0 && seen >= rank99) out.p99_ms = bucketValue(b) * 1e-6;
+	}
+	out.mean_ms = total_ns * 1e-6 / out.count;
+	out.max_ms = max_ns * 1e-6;
+	// A bucket midpoint can exceed the largest sample
+	out.p50_ms = std::min(out.p50_ms, out.max_ms);
+	out.p99_ms = std::min(out.p99_ms, out.max_ms);
+	return out;
+}
+
+size_t Profiler::droppedEvents()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	size_t dropped = 0;
+	for (size_t i=0; i<threads_.size(); i++) {
+		size_t n = threads_[i]->n_events.load(std::memory_order_relaxed);
+		dropped += n - std::min(n, threads_[i]->events.size());
+	}
+	return dropped;
+}
+
+bool Profiler::writeTrace(const std::string &filename)
+{
+	// Chrome trace event format, complete ("X") events in microseconds; opens in chrome://tracing and Perfetto.
+	// Meant for the end of a session: an event being overwritten while it is read would come out garbled.
+	// Streamed to a temporary file and renamed at the end, like the exports
+	std::string tmp = filename + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL) return false;
+	std::vector<char> file_buffer(1 << 20);
+	setvbuf(file, file_buffer.data(), _IOFBF, file_buffer.size());
+	
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	bool first = true;
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (size_t i=0; i<threads_.size(); i++) {
+		ThreadData &data = *threads_[i];
+		fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", 
+			first ? "\n" : ",\n", data.tid, utils::jsonEscape(data.name).c_str());
+		first = false;
+		
+		size_t n = data.n_events.load(std::memory_order_acquire);
+		size_t capacity = data.events.size();
+		for (size_t k=n-std::min(n, capacity); k<n; k++) {
+			const Event &event = data.events[k % capacity];
+			fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"editor\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				stageName(event.stage), data.tid, (event.start_ns - start_ns_) * 1e-3, event.duration_ns * 1e-3);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	
+	bool ok = !ferror(file);
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), filename.c_str()) != 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,112 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+// Low-overhead stage timing for the editor. Every thread records into its
+// own histograms and trace buffer, registered once under a lock; after that
+// a sample costs two clock reads and a few relaxed atomic stores, and the
+// HUD can read the histograms at any time without stopping the writers.
+// Histograms use four sub-buckets per power of two of nanoseconds, so a
+// percentile is accurate to within about 12%. The trace keeps the last
+// trace_events samples of each thread, 24 bytes each: 384 KB per thread
+// that records, a few seconds of the busiest loops.
+class Profiler {
+public:
+	enum Stage {
+		FRAME,      // one iteration of the UI loop
+		IMAGE,      // getting the current image on the I/O pool, including waiting for a prefetch
+		DECODE,     // cv::imread on the I/O pool
+		PREFETCH,   // cv::imread on the cache worker
+		COMPOSE,    // tiles and header of the base layer
+		DRAW,       // polygon layer
+		IMSHOW,
+		WAITKEY,
+		LOAD,
+		SAVE,
+		AUTOSAVE,
+		INPUT,      // from queuing an input event to the model applying it
+		PROPOSAL,   // edge proposals for one image or one GrabCut, on the proposal pool
+		NUM_STAGES
+	};
+	
+	struct Summary {
+		uint64_t count;
+		double last_ms;
+		double mean_ms;
+		double p50_ms;
+		double p99_ms;
+		double max_ms;
+	};
+	
+	Profiler(bool enabled = true, size_t trace_events = 1 << 14);
+	bool enabled() { return enabled_; }
+	void nameThread(const std::string &name);
+	void record(int stage, int64_t start_ns, int64_t end_ns);
+	Summary summary(int stage);
+	bool writeTrace(const std::string &filename);
+	size_t droppedEvents();
+	
+	static int64_t now();
+	static const char* stageName(int stage);
+
+private:
+	enum { NUM_BUCKETS = 160 };
+	
+	struct Event {
+		int64_t start_ns;
+		int64_t duration_ns;
+		int stage;
+	};
+	
+	// Written only by its own thread
+	struct ThreadData {
+		std::thread::id id;
+		std::string name;
+		int tid;
+		std::atomic<uint64_t> buckets[NUM_STAGES][NUM_BUCKETS];
+		std::atomic<uint64_t> count[NUM_STAGES];
+		std::atomic<uint64_t> total_ns[NUM_STAGES];
+		std::atomic<int64_t> max_ns[NUM_STAGES];
+		std::atomic<int64_t> last_ns[NUM_STAGES];
+		std::vector<Event> events;      // ring of the most recent samples
+		std::atomic<size_t> n_events;   // total recorded, published with release
+	};
+	
+	ThreadData* threadData();
+	static int bucketOf(int64_t ns);
+	static double bucketValue(int bucket);
+	
+	bool enabled_;
+	unsigned serial_;    // tells profilers apart in the per-thread lookup cache
+	size_t trace_capacity_;
+	int64_t start_ns_;
+	std::mutex mutex_;   // guards threads_ while a thread registers
+	std::vector<std::unique_ptr<ThreadData> > threads_;
+};
+
+// Records the lifetime of the scope as one sample of 'stage'
+class ScopedTimer {
+public:
+	ScopedTimer(Profiler &profiler, int stage)
+		: profiler_(profiler), stage_(stage), start_ns_(profiler.enabled() ? Profiler::now() : 0) {}
+	~ScopedTimer() {
+		if (profiler_.enabled()) profiler_.record(stage_, start_ns_, Profiler::now());
+	}
+
+private:
+	ScopedTimer(const ScopedTimer&);
+	ScopedTimer& operator=(const ScopedTimer&);
+	
+	Profiler &profiler_;
+	int stage_;
+	int64_t start_ns_;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "proposal_cache.h"
+#include "geometry.h"
+#include "image_cache.h"
+#include "profiler.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+	// Proposals are computed at most this large; edges of a full-resolution photo are mostly texture
+	const int EDGE_MAX_SIZE = 512;
+	const int GRABCUT_MAX_SIZE = 256;
+	
+	// Simplifies a pixel contour of an image scaled by 'scale' and normalizes it to the image
+	void toRing(const std::vector<cv::Point> &contour, cv::Point2f offset, double scale, cv::Size size, double tolerance_px, ProposalCache::Ring &ring)
+	{
+		std::vector<cv::Point2f> pixels(contour.size());
+		for (size_t i=0; i<contour.size(); i++) {
+			pixels[i] = cv::Point2f(float(contour[i].x), float(contour[i].y));
+		}
+		geometry::simplify(pixels.data(), pixels.size(), float(tolerance_px * scale), ring);
+		for (size_t i=0; i<ring.size(); i++) {
+			ring[i] = cv::Point2f(float((offset.x + ring[i].x / scale) / size.width), float((offset.y + ring[i].y / scale) / size.height));
+		}
+	}
+}
+
+ProposalCache::ProposalCache(ImageCache &images, int num_threads, size_t max_images, double tolerance_px)
+	: images_(images)
+	, max_images_(std::max(max_images, size_t(1)))
+	, tolerance_px_(tolerance_px)
+	, profiler_(NULL)
+	, stop_(false)
+	, pool_(std::max(num_threads, 1))
+{
+}
+
+ProposalCache::~ProposalCache()
+{
+	// The pool drains its queue before it joins; the tasks see stop_ and return at once
+	stop_ = true;
+}
+
+void ProposalCache::setProfiler(Profiler *profiler)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	profiler_ = profiler;
+}
+
+void ProposalCache::prepare(const std::vector<std::string> &filenames)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (size_t i=0; i<filenames.size(); i++) {
+		const std::string &filename = filenames[i];
+		std::unordered_map<std::string, Entry>::iterator it = entries_.find(filename);
+		if (it != entries_.end()) {
+			// Still wanted, keep it away from the eviction end
+			lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+			continue;
+		}
+		if (!in_flight_.insert(filename).second) continue;
+		pool_.submit([this, filename]() { this->compute(filename); });
+	}
+}
+
+void ProposalCache::compute(const std::string &filename)
+{
+	std::vector<Proposal> proposals;
+	if (!stop_) {
+		Profiler *profiler;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			profiler = profiler_;
+		}
+		int64_t t0 = profiler ? Profiler::now() : 0;
+		
+		// Usually a hit, the image cache prefetches the same neighbors
+		cv::Mat image = images_.get(filename);
+		std::vector<Ring> rings;
+		if (!image.empty()) {
+			edgeProposals(image, tolerance_px_, rings);
+		}
+		proposals.resize(rings.size());
+		for (size_t i=0; i<rings.size(); i++) {
+			proposals[i].ring.swap(rings[i]);
+			proposals[i].bounds = geometry::bounds(proposals[i].ring.data(), proposals[i].ring.size());
+			proposals[i].area = std::fabs(geometry::signedArea(proposals[i].ring.data(), proposals[i].ring.size()));
+		}
+		if (profiler) profiler->record(Profiler::PROPOSAL, t0, Profiler::now());
+	}
+	
+	std::lock_guard<std::mutex> lock(mutex_);
+	in_flight_.erase(filename);
+	if (stop_) return;
+	
+	lru_.push_front(filename);
+	Entry &entry = entries_[filename];
+	entry.proposals.swap(proposals);
+	entry.lru_pos = lru_.begin();
+	while (lru_.size() > max_images_) {
+		entries_.erase(lru_.back());
+		lru_.pop_back();
+	}
+}
+
+bool ProposalCache::find(const std::string &filename, const cv::Point2f &pt, Ring &out)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::unordered_map<std::string, Entry>::iterator it = entries_.find(filename);
+	if (it == entries_.end()) return false;
+	
+	// Edge regions nest, e.g. a window inside a car; the innermost one is the likely target
+	const Proposal *best = NULL;
+	const std::vector<Proposal> &proposals = it->second.proposals;
+	for (size_t i=0; i<proposals.size(); i++) {
+		const Proposal &proposal = proposals[i];
+		const cv::Rect_<float> &b = proposal.bounds;
+		if (pt.x < b.x || pt.y < b.y || pt.x > b.x + b.width || pt.y > b.y + b.height) continue;
+		if (best != NULL && proposal.area >= best->area) continue;
+		if (cv::pointPolygonTest(proposal.ring, pt, false) >= 0) best = &proposal;
+	}
+	if (best == NULL) return false;
+	out = best->ring;
+	return true;
+}
+
+bool ProposalCache::ready(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_.count(filename) > 0;
+}
+
+void ProposalCache::segment(const cv::Mat &image, const cv::Point2f &pt, Callback done)
+{
+	// The Mat header shares the pixels; nobody writes to a decoded image
+	pool_.submit([this, image, pt, done]() {
+		Ring ring;
+		if (!stop_) {
+			int64_t t0 = Profiler::now();
+			grabCutProposal(image, pt, tolerance_px_, ring);
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (profiler_) profiler_->record(Profiler::PROPOSAL, t0, Profiler::now());
+		}
+		done(ring);
+	});
+}
+
+size_t ProposalCache::size()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return entries_.size();
+}
+
+void ProposalCache::edgeProposals(const cv::Mat &image, double tolerance_px, std::vector<Ring> &rings)
+{
+	rings.clear();
+	double scale = std::min(1.0, double(EDGE_MAX_SIZE) / std::max(image.cols, image.rows));
+	cv::Mat gray, edges;
+	if (image.channels() == 3) {
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+	} else {
+		gray = image;
+	}
+	if (scale < 1.0) {
+		cv::resize(gray, gray, cv::Size(), scale, scale, cv::INTER_AREA);
+	}
+	cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+	cv::Canny(gray, edges, 40, 120);
+	cv::dilate(edges, edges, cv::Mat());
+	
+	// A region enclosed by edges is a hole of the edge map: the inner contours of a two-level hierarchy
+	std::vector<std::vector<cv::Point> > contours;
+	std::vector<cv::Vec4i> hierarchy;
+	cv::findContours(edges, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
+	
+	double total = double(edges.cols) * edges.rows;
+	Ring ring;
+	for (size_t i=0; i<contours.size(); i++) {
+		if (hierarchy[i][3] < 0 || contours[i].size() < 3) continue;
+		double area = std::fabs(cv::contourArea(contours[i]));
+		if (area < 0.002 * total || area > 0.9 * total) continue;
+		toRing(contours[i], cv::Point2f(0, 0), scale, image.size(), tolerance_px, ring);
+		if (ring.size() >= 3) rings.push_back(ring);
+	}
+}
+
+bool ProposalCache::grabCutProposal(const cv::Mat &image, const cv::Point2f &pt, double tolerance_px, Ring &ring)
+{
+	ring.clear();
+	if (image.empty() || image.type() != CV_8UC3) return false;
+	
+	// A window around the seed; an object larger than that is cut at the window border
+	cv::Point seed(int(pt.x * image.cols), int(pt.y * image.rows));
+	int radius = std::max(32, int(0.2 * std::max(image.cols, image.rows)));
+	cv::Rect window = cv::Rect(seed.x - radius, seed.y - radius, 2 * radius, 2 * radius) & cv::Rect(0, 0, image.cols, image.rows);
+	if (!window.contains(seed)) return false;
+	
+	cv::Mat roi;
+	double scale = std::min(1.0, double(GRABCUT_MAX_SIZE) / std::max(window.width, window.height));
+	if (scale < 1.0) {
+		cv::resize(image(window), roi, cv::Size(), scale, scale, cv::INTER_AREA);
+	} else {
+		roi = image(window);
+	}
+	
+	// Probably background at the border, probably foreground inside, certainly foreground at the seed
+	cv::Mat mask(roi.size(), CV_8UC1, cv::Scalar(cv::GC_PR_BGD));
+	cv::Rect inner(roi.cols / 8, roi.rows / 8, roi.cols - roi.cols / 4, roi.rows - roi.rows / 4);
+	mask(inner).setTo(cv::Scalar(cv::GC_PR_FGD));
+	cv::Point local(int((seed.x - window.x) * scale), int((seed.y - window.y) * scale));
+	cv::circle(mask, local, std::max(2, roi.cols / 32), cv::Scalar(cv::GC_FGD), -1);
+	
+	cv::Mat bgd_model, fgd_model;
+	cv::grabCut(roi, mask, cv::Rect(), bgd_model, fgd_model, 3, cv::GC_INIT_WITH_MASK);
+	
+	// GC_FGD and GC_PR_FGD are the odd labels
+	cv::Mat foreground(mask.size(), CV_8UC1);
+	for (int y=0; y<mask.rows; y++) {
+		const uchar *src = mask.ptr<uchar>(y);
+		uchar *dst = foreground.ptr<uchar>(y);
+		for (int x=0; x<mask.cols; x++) {
+			dst[x] = (src[x] & 1) ? 255 : 0;
+		}
+	}
+	
+	std::vector<std::vector<cv::Point> > contours;
+	cv::findContours(foreground, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+	int chosen = -1;
+	double chosen_area = 0.0;
+	for (size_t i=0; i<contours.size(); i++) {
+		if (cv::pointPolygonTest(contours[i], cv::Point2f(float(local.x), float(local.y)), false) >= 0) {
+			chosen = int(i);
+			break;
+		}
+		double area = std::fabs(cv::contourArea(contours[i]));
+		if (area > chosen_area) {
+			chosen = int(i);
+			chosen_area = area;
+		}
+	}
+	if (chosen < 0) return false;
+	
+	toRing(contours[chosen], cv::Point2f(float(window.x), float(window.y)), scale, image.size(), tolerance_px, ring);
+	return ring.size() >= 3;
+}
@@ -0,0 +1,72 @@
+#ifndef PROPOSAL_CACHE_H
+#define PROPOSAL_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/thread_pool.h"
+
+class ImageCache;
+class Profiler;
+
+// Object proposals to snap polygons onto, computed on a small pool of its
+// own so that no image processing runs on the thread that asks for them.
+//   prepare()  edge proposals for the current and upcoming images: Canny
+//              edges closed by a dilation, every blob they enclose traced
+//              and simplified, kept per image in an LRU list
+//   find()     the smallest cached proposal around a point, never waits
+//   segment()  GrabCut in a window around a seed point, for objects without
+//              a closed outline; the result is handed to a callback on the pool
+// Rings are normalized to [0, 1] like MyPolygon.
+class ProposalCache {
+public:
+	typedef std::vector<cv::Point2f> Ring;
+	typedef std::function<void(const Ring&)> Callback;
+	
+	ProposalCache(ImageCache &images, int num_threads = 1, size_t max_images = 32, double tolerance_px = 1.5);
+	~ProposalCache();
+	void setProfiler(Profiler *profiler);
+	void prepare(const std::vector<std::string> &filenames);
+	bool find(const std::string &filename, const cv::Point2f &pt, Ring &out);
+	bool ready(const std::string &filename);
+	void segment(const cv::Mat &image, const cv::Point2f &pt, Callback done);
+	size_t size();
+	
+	static void edgeProposals(const cv::Mat &image, double tolerance_px, std::vector<Ring> &rings);
+	static bool grabCutProposal(const cv::Mat &image, const cv::Point2f &pt, double tolerance_px, Ring &ring);
+
+private:
+	struct Proposal {
+		Ring ring;
+		cv::Rect_<float> bounds;
+		double area;
+	};
+	
+	struct Entry {
+		std::vector<Proposal> proposals;
+		std::list<std::string>::iterator lru_pos;
+	};
+	
+	void compute(const std::string &filename);
+	
+	ImageCache &images_;
+	size_t max_images_;
+	double tolerance_px_;
+	Profiler *profiler_;        // optional, times the computations
+	std::atomic<bool> stop_;    // queued work is skipped once the owner goes away
+	
+	std::mutex mutex_;
+	std::unordered_map<std::string, Entry> entries_;
+	std::list<std::string> lru_;
+	std::set<std::string> in_flight_;
+	ThreadPool pool_;           // declared last, its tasks use everything above
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include "shape.h"
+#include "geometry.h"
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+namespace {
+	struct SizeKernel : public boost::static_visitor<size_t> {
+		template<int N>
+		size_t operator()(const shape::Fixed<N> &) const { return N; }
+		size_t operator()(const shape::Box &) const { return 4; }
+		size_t operator()(const shape::Polygon &shape) const { return shape.n; }
+	};
+	
+	struct AreaKernel : public boost::static_visitor<double> {
+		template<int N>
+		double operator()(const shape::Fixed<N> &shape) const {
+			// Same summation order as geometry::signedArea, so both give the same bits
+			const cv::Point2f *p = shape.points;
+			double sum = 0.0;
+			for (int i=0; i+1<N; i++) {
+				sum += double(p[i].x) * p[i + 1].y - double(p[i + 1].x) * p[i].y;
+			}
+			sum += double(p[N - 1].x) * p[0].y - double(p[0].x) * p[N - 1].y;
+			return 0.5 * sum;
+		}
+		double operator()(const shape::Box &shape) const {
+			return (*this)(shape::Quad(shape.points));
+		}
+		double operator()(const shape::Polygon &shape) const {
+			return geometry::signedArea(shape.points, shape.n);
+		}
+	};
+	
+	struct BoundsKernel : public boost::static_visitor<cv::Rect_<float> > {
+		template<int N>
+		cv::Rect_<float> operator()(const shape::Fixed<N> &shape) const {
+			const cv::Point2f *p = shape.points;
+			float x0 = p[0].x, y0 = p[0].y, x1 = p[0].x, y1 = p[0].y;
+			for (int i=1; i<N; i++) {
+				x0 = std::min(x0, p[i].x);
+				y0 = std::min(y0, p[i].y);
+				x1 = std::max(x1, p[i].x);
+				y1 = std::max(y1, p[i].y);
+			}
+			return cv::Rect_<float>(x0, y0, x1 - x0, y1 - y0);
+		}
+		cv::Rect_<float> operator()(const shape::Box &shape) const {
+			// Opposite corners span the box in either winding
+			const cv::Point2f &a = shape.points[0], &b = shape.points[2];
+			return cv::Rect_<float>(std::min(a.x, b.x), std::min(a.y, b.y), std::fabs(b.x - a.x), std::fabs(b.y - a.y));
+		}
+		cv::Rect_<float> operator()(const shape::Polygon &shape) const {
+			return geometry::bounds(shape.points, shape.n);
+		}
+	};
+	
+	struct SelfIntersectionKernel : public boost::static_visitor<bool> {
+		template<int N>
+		bool operator()(const shape::Fixed<N> &shape) const {
+			// Same pairs as geometry::selfIntersects: edges that share no vertex
+			const cv::Point2f *p = shape.points;
+			for (int i=0; i<N; i++) {
+				int last = (i == 0) ? N - 1 : N;
+				for (int j=i+2; j<last; j++) {
+					if (geometry::segmentsIntersect(p[i], p[(i + 1) % N], p[j], p[(j + 1) % N])) return true;
+				}
+			}
+			return false;
+		}
+		bool operator()(const shape::Box &shape) const {
+			// Opposite edges of a rectangle only meet when it has collapsed to a line or a point
+			const cv::Point2f &a = shape.points[0], &b = shape.points[2];
+			if (a.x != b.x && a.y != b.y) return false;
+			return (*this)(shape::Quad(shape.points));
+		}
+		bool operator()(const shape::Polygon &shape) const {
+			return geometry::selfIntersects(shape.points, shape.n);
+		}
+	};
+	
+	inline void appendVertex(const cv::Point2f &pt, bool last, std::string &out)
+	{
+		char buf[96];
+		int n = snprintf(buf, sizeof(buf), last ? "[%.3f, %.3f]" : "[%.3f, %.3f], ", pt.x, pt.y);
+		out.append(buf, std::min(n, int(sizeof(buf)) - 1));
+	}
+	
+	struct WriteKernel : public boost::static_visitor<void> {
+		std::string &out;
+		explicit WriteKernel(std::string &text) : out(text) {}
+		
+		template<int N>
+		void operator()(const shape::Fixed<N> &shape) const {
+			// One buffer for the whole shape, appended once
+			std::array<char, 96 * N> buf;
+			size_t used = 0;
+			for (int i=0; i<N; i++) {
+				int n = snprintf(buf.data() + used, buf.size() - used, (i + 1 < N) ? "[%.3f, %.3f], " : "[%.3f, %.3f]",
+					shape.points[i].x, shape.points[i].y);
+				used += std::min(size_t(std::max(n, 0)), buf.size() - used - 1);
+			}
+			out.append(buf.data(), used);
+		}
+		void operator()(const shape::Box &shape) const {
+			(*this)(shape::Quad(shape.points));
+		}
+		void operator()(const shape::Polygon &shape) const {
+			for (size_t i=0; i<shape.n; i++) {
+				appendVertex(shape.points[i], i + 1 == shape.n, out);
+			}
+		}
+	};
+	
+	inline void drawVertex(cv::Mat &canvas, const cv::Point &pt, const cv::Scalar &color, bool selected)
+	{
+		cv::circle(canvas, pt, (selected ? 8 : 4), color, (selected ? 1 : -1));
+	}
+	
+	struct DrawKernel : public boost::static_visitor<void> {
+		const shape::Projection &projection;
+		cv::Mat &canvas;
+		const cv::Scalar &color;
+		int selected;
+		DrawKernel(const shape::Projection &proj, cv::Mat &image, const cv::Scalar &c, int index)
+			: projection(proj), canvas(image), color(c), selected(index) {}
+		
+		// Edges first, then the dots on top, in the order of the generic per-edge loop
+		void drawProjected(const cv::Point *pts, int n) const {
+			for (int i=0; i<n; i++) {
+				cv::line(canvas, pts[i], pts[(i + 1) % n], color, 2, 8, 0);
+				drawVertex(canvas, pts[i], color, i == selected);
+			}
+		}
+		
+		template<int N>
+		void operator()(const shape::Fixed<N> &shape) const {
+			std::array<cv::Point, N> pts;
+			for (int i=0; i<N; i++) pts[i] = projection(shape.points[i]);
+			this->drawProjected(pts.data(), N);
+		}
+		void operator()(const shape::Box &shape) const {
+			// The projection is separable, so the other two corners take their
+			// coordinates from the projections of 0 and 2
+			const cv::Point2f *p = shape.points;
+			std::array<cv::Point, 4> pts;
+			pts[0] = projection(p[0]);
+			pts[2] = projection(p[2]);
+			pts[1] = cv::Point((p[1].x == p[0].x) ? pts[0].x : pts[2].x, (p[1].y == p[0].y) ? pts[0].y : pts[2].y);
+			pts[3] = cv::Point((p[3].x == p[0].x) ? pts[0].x : pts[2].x, (p[3].y == p[0].y) ? pts[0].y : pts[2].y);
+			this->drawProjected(pts.data(), 4);
+		}
+		void operator()(const shape::Polygon &shape) const {
+			// No scratch buffer: each vertex is projected once and carried to the next edge
+			if (shape.n == 0) return;
+			int n = int(shape.n);
+			cv::Point first = projection(shape.points[0]);
+			cv::Point pt1 = first;
+			for (int i=0; i<n; i++) {
+				cv::Point pt2 = (i + 1 < n) ? projection(shape.points[i + 1]) : first;
+				cv::line(canvas, pt1, pt2, color, 2, 8, 0);
+				drawVertex(canvas, pt1, color, i == selected);
+				pt1 = pt2;
+			}
+		}
+	};
+}
+
+shape::View shape::classify(const cv::Point2f *points, size_t n)
+{
+	if (n == 3) return Triangle(points);
+	if (n != 4) return Polygon(points, n);
+	
+	const cv::Point2f *p = points;
+	bool horizontal_first = p[0].y == p[1].y && p[1].x == p[2].x && p[2].y == p[3].y && p[3].x == p[0].x;
+	bool vertical_first = p[0].x == p[1].x && p[1].y == p[2].y && p[2].x == p[3].x && p[3].y == p[0].y;
+	if (horizontal_first || vertical_first) return Box(points);
+	return Quad(points);
+}
+
+size_t shape::size(const View &shape)
+{
+	return boost::apply_visitor(SizeKernel(), shape);
+}
+
+double shape::signedArea(const View &shape)
+{
+	return boost::apply_visitor(AreaKernel(), shape);
+}
+
+cv::Rect_<float> shape::bounds(const View &shape)
+{
+	return boost::apply_visitor(BoundsKernel(), shape);
+}
+
+bool shape::selfIntersects(const View &shape)
+{
+	return boost::apply_visitor(SelfIntersectionKernel(), shape);
+}
+
+void shape::write(const View &shape, std::string &out)
+{
+	WriteKernel kernel(out);
+	boost::apply_visitor(kernel, shape);
+}
+
+void shape::draw(const View &shape, const Projection &projection, cv::Mat &canvas, const cv::Scalar &color, int selected)
+{
+	DrawKernel kernel(projection, canvas, color, selected);
+	boost::apply_visitor(kernel, shape);
+}
@@ -0,0 +1,64 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <string>
+#include <boost/variant.hpp>
+#include <opencv2/opencv.hpp>
+
+// Typed views over the vertex runs of PolygonStore. Most labels are quads
+// or axis-aligned boxes; classify() tags a run with its shape once, and the
+// kernels dispatch on the tag through a variant so that the fixed-arity
+// cases run fully unrolled loops, with scratch space in std::array on the
+// stack. Polygon falls back to the general kernels of geometry.h.
+namespace shape {
+	template<int N>
+	struct Fixed {
+		enum { ARITY = N };
+		const cv::Point2f *points;
+		explicit Fixed(const cv::Point2f *pts = NULL) : points(pts) {}
+	};
+	
+	typedef Fixed<3> Triangle;
+	typedef Fixed<4> Quad;
+	
+	// Four corners of an axis-aligned rectangle, in either winding
+	struct Box {
+		const cv::Point2f *points;
+		explicit Box(const cv::Point2f *pts = NULL) : points(pts) {}
+	};
+	
+	struct Polygon {
+		const cv::Point2f *points;
+		size_t n;
+		Polygon(const cv::Point2f *pts = NULL, size_t count = 0) : points(pts), n(count) {}
+	};
+	
+	typedef boost::variant<Polygon, Triangle, Quad, Box> View;
+	
+	// Normalized vertex to window pixel, the arithmetic of Viewport::toScreen
+	// on the vertex scaled to image pixels, less the canvas offset
+	struct Projection {
+		cv::Size image_size;
+		cv::Point2d origin;
+		double zoom;
+		cv::Point offset;
+		
+		cv::Point operator()(const cv::Point2f &pt) const {
+			return cv::Point(cvFloor((double(pt.x) * image_size.width - origin.x) * zoom) - offset.x,
+				cvFloor((double(pt.y) * image_size.height - origin.y) * zoom) - offset.y);
+		}
+	};
+	
+	View classify(const cv::Point2f *points, size_t n);
+	size_t size(const View &shape);
+	
+	double signedArea(const View &shape);
+	cv::Rect_<float> bounds(const View &shape);
+	bool selfIntersects(const View &shape);
+	// Appends the vertices as "[x, y], [x, y], ..." with three decimals, the layout of polygon_drawer.yaml
+	void write(const View &shape, std::string &out);
+	// Closed outline with a dot on every vertex; the 'selected' vertex gets a ring instead
+	void draw(const View &shape, const Projection &projection, cv::Mat &canvas, const cv::Scalar &color, int selected);
+}
+
+#endif
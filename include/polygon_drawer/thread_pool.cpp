@@ -0,0 +1,156 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+	// Identifies the pool and queue of the calling thread when it is a worker
+	thread_local ThreadPool *tls_pool = NULL;
+	thread_local int tls_index = -1;
+}
+
+ThreadPool::ThreadPool(int num_threads)
+	: queued_(0)
+	, pending_(0)
+	, next_queue_(0)
+	, stop_(false)
+{
+	if (num_threads <= 0) {
+		num_threads = defaultThreads();
+	}
+	for (int i=0; i<num_threads; i++) {
+		queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+	for (int i=0; i<num_threads; i++) {
+		workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+		stop_ = true;
+	}
+	wake_cond_.notify_all();
+	for (int i=0; i<workers_.size(); i++) {
+		workers_[i].join();
+	}
+}
+
+int ThreadPool::defaultThreads()
+{
+	int n = int(std::thread::hardware_concurrency());
+	return n > 0 ? n : 4;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	int index = (tls_pool == this) ? tls_index : int(next_queue_++ % queues_.size());
+	pending_++;
+	{
+		std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+		queues_[index]->tasks.push_back(std::move(task));
+		queued_++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex_);
+	}
+	wake_cond_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(wake_mutex_);
+	idle_cond_.wait(lock, [&]() { return pending_ == 0; });
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &fn, size_t grain)
+{
+	if (n == 0) return;
+	if (grain == 0) grain = 1;
+
+	// Self-scheduling chunks. The caller takes part as well, so a nested call
+	// from inside a task cannot deadlock; helpers that start after all chunks
+	// were claimed return without touching the caller's state.
+	struct State {
+		std::atomic<size_t> next;
+		size_t done;
+		std::mutex mutex;
+		std::condition_variable cond;
+	};
+	std::shared_ptr<State> state(new State());
+	state->next = 0;
+	state->done = 0;
+	const std::function<void(size_t)> *body = &fn;
+
+	auto run_chunks = [state, body, n, grain]() {
+		size_t begin;
+		while ((begin = state->next.fetch_add(grain)) < n) {
+			size_t end = std::min(n, begin + grain);
+			for (size_t i=begin; i<end; i++) {
+				(*body)(i);
+			}
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->done += (end - begin);
+			if (state->done == n) {
+				state->cond.notify_all();
+			}
+		}
+	};
+
+	int n_helpers = std::min(int(workers_.size()), int((n + grain - 1) / grain) - 1);
+	for (int t=0; t<n_helpers; t++) {
+		this->submit(run_chunks);
+	}
+	run_chunks();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->cond.wait(lock, [&]() { return state->done == n; });
+}
+
+bool ThreadPool::popTask(int index, std::function<void()> &task)
+{
+	{
+		Queue &own = *queues_[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queued_--;
+			return true;
+		}
+	}
+	for (int k=1; k<queues_.size(); k++) {
+		Queue &victim = *queues_[(index + k) % queues_.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			queued_--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::workerLoop(int index)
+{
+	tls_pool = this;
+	tls_index = index;
+
+	while (true) {
+		std::function<void()> task;
+		if (this->popTask(index, task)) {
+			task();
+			if (--pending_ == 0) {
+				std::lock_guard<std::mutex> lock(wake_mutex_);
+				idle_cond_.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wake_mutex_);
+		wake_cond_.wait(lock, [&]() { return stop_ || queued_ > 0; });
+		if (stop_ && queued_ == 0) break;
+	}
+}
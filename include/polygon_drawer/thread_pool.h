@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// Work-stealing pool: each worker pops its own queue from the back and
+// steals from the front of the others. Tasks submitted from inside a task
+// go to the submitting worker's queue, which keeps recursive work local.
+// wait() blocks until every submitted task has finished and must not be
+// called from inside a task; parallelFor() is safe to nest.
+class ThreadPool {
+public:
+	ThreadPool(int num_threads = 0);
+	~ThreadPool();
+	void submit(std::function<void()> task);
+	void wait();
+	void parallelFor(size_t n, const std::function<void(size_t)> &fn, size_t grain = 1);
+	int size() { return int(workers_.size()); }
+
+	static int defaultThreads();
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	void workerLoop(int index);
+	bool popTask(int index, std::function<void()> &task);
+
+	std::vector<std::unique_ptr<Queue> > queues_;
+	std::vector<std::thread> workers_;
+	std::atomic<size_t> queued_;
+	std::atomic<size_t> pending_;
+	std::atomic<unsigned> next_queue_;
+	bool stop_;
+
+	std::mutex wake_mutex_;
+	std::condition_variable wake_cond_;
+	std::condition_variable idle_cond_;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "tile_pyramid.h"
+#include "utils.h"
+
+#include <algorithm>
+
+TilePyramid::TilePyramid(int tile_size, size_t budget_mb)
+	: type_(CV_8UC3)
+	, tile_size_(std::max(tile_size, 16))
+	, n_levels_(0)
+	, budget_bytes_(budget_mb * 1024 * 1024)
+	, used_bytes_(0)
+{
+}
+
+void TilePyramid::setBudget(size_t budget_mb)
+{
+	budget_bytes_ = budget_mb * 1024 * 1024;
+	this->evict();
+}
+
+void TilePyramid::setImage(const cv::Mat &image)
+{
+	// Shares the pixels with the caller, nothing is built until the first frame
+	source_ = image;
+	paged_.reset();
+	this->reset(image.size(), image.empty() ? CV_8UC3 : image.type());
+}
+
+void TilePyramid::setImage(const std::shared_ptr<TiledImage> &image)
+{
+	source_ = cv::Mat();
+	paged_ = image;
+	if (paged_ && paged_->tileSize() != tile_size_) {
+		std::cout << utils::getBashColorText("[Warning] Tile size of the paged image does not match the pyramid", 'y', 'b') << std::endl;
+		paged_.reset();
+	}
+	this->reset(paged_ ? paged_->size() : cv::Size(0, 0), paged_ ? paged_->type() : CV_8UC3);
+}
+
+void TilePyramid::reset(cv::Size size, int type)
+{
+	size_ = size;
+	type_ = type;
+	tiles_.clear();
+	lru_.clear();
+	used_bytes_ = 0;
+	
+	n_levels_ = (size_.area() == 0) ? 0 : 1;
+	while (n_levels_ > 0) {
+		cv::Size size = this->levelSize(n_levels_ - 1);
+		if (size.width <= tile_size_ && size.height <= tile_size_) break;
+		n_levels_++;
+	}
+}
+
+int TilePyramid::levelFor(double zoom)
+{
+	// Coarsest level that still has at least one pixel per screen pixel
+	int level = 0;
+	while (level + 1 < n_levels_ && zoom * (1 << (level + 1)) <= 1.0) {
+		level++;
+	}
+	return level;
+}
+
+void TilePyramid::render(const Viewport &view, cv::Mat &out, cv::Point2d scale)
+{
+	out.create(view.size(), type_);
+	out.setTo(cv::Scalar::all(0));
+	if (n_levels_ == 0 || out.empty()) return;
+	
+	double zoom = view.zoom() / scale.x;
+	int level = this->levelFor(zoom);
+	int f = 1 << level;
+	cv::Size size = this->levelSize(level);
+	
+	// Visible part of the level, widened to whole level pixels
+	cv::Point2d tl = view.toImage(cv::Point2d(0.0, 0.0));
+	cv::Point2d br = view.toImage(cv::Point2d(out.cols, out.rows));
+	tl = cv::Point2d(tl.x * scale.x, tl.y * scale.y);
+	br = cv::Point2d(br.x * scale.x, br.y * scale.y);
+	int x0 = std::max(cvFloor(tl.x / f), 0);
+	int y0 = std::max(cvFloor(tl.y / f), 0);
+	int x1 = std::min(cvCeil(br.x / f), size.width);
+	int y1 = std::min(cvCeil(br.y / f), size.height);
+	if (x0 >= x1 || y0 >= y1) return;
+	
+	cv::Rect window(x0, y0, x1 - x0, y1 - y0);
+	cv::Rect frame(0, 0, out.cols, out.rows);
+	int interpolation = (zoom * f >= 1.0) ? cv::INTER_NEAREST : cv::INTER_LINEAR;
+	for (int ty = y0 / tile_size_; ty <= (y1 - 1) / tile_size_; ty++) {
+		for (int tx = x0 / tile_size_; tx <= (x1 - 1) / tile_size_; tx++) {
+			cv::Rect rect = this->tileRect(level, tx, ty);
+			cv::Rect visible = rect & window;
+			if (visible.area() <= 0) continue;
+			
+			// Both edges go through the same mapping, so neighboring tiles meet without gaps
+			cv::Point p0 = view.toScreen(cv::Point2d(visible.x * f / scale.x, visible.y * f / scale.y));
+			cv::Point p1 = view.toScreen(cv::Point2d(std::min(visible.br().x * f, size_.width) / scale.x, std::min(visible.br().y * f, size_.height) / scale.y));
+			cv::Rect dst(p0, p1);
+			cv::Rect clipped = dst & frame;
+			if (clipped.area() <= 0) continue;
+			
+			cv::Mat src = this->tile(level, tx, ty)(visible - rect.tl());
+			if (clipped == dst) {
+				cv::Mat target = out(dst);
+				cv::resize(src, target, dst.size(), 0, 0, interpolation);
+			} else {
+				cv::Mat scaled;
+				cv::resize(src, scaled, dst.size(), 0, 0, interpolation);
+				scaled(clipped - dst.tl()).copyTo(out(clipped));
+			}
+		}
+	}
+}
+
+cv::Size TilePyramid::levelSize(int level)
+{
+	int f = 1 << level;
+	return cv::Size((size_.width + f - 1) / f, (size_.height + f - 1) / f);
+}
+
+cv::Rect TilePyramid::tileRect(int level, int tx, int ty)
+{
+	cv::Size size = this->levelSize(level);
+	cv::Rect rect(tx * tile_size_, ty * tile_size_, tile_size_, tile_size_);
+	return rect & cv::Rect(0, 0, size.width, size.height);
+}
+
+cv::Mat TilePyramid::tile(int level, int tx, int ty)
+{
+	cv::Rect rect = this->tileRect(level, tx, ty);
+	if (level == 0 && !paged_) {
+		return source_(rect);
+	}
+	
+	uint64_t k = key(level, tx, ty);
+	std::unordered_map<uint64_t, Tile>::iterator it = tiles_.find(k);
+	if (it != tiles_.end()) {
+		lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+		return it->second.image;
+	}
+	
+	cv::Mat image;
+	if (level == 0) {
+		// A failed read shows black and is tried again by the next frame
+		if (!paged_->readTile(tx, ty, image)) {
+			return cv::Mat::zeros(rect.size(), type_);
+		}
+	} else {
+		// Level sizes round up, so the halved area of the level below always matches this tile
+		cv::Size below = this->levelSize(level - 1);
+		cv::Rect src_rect = cv::Rect(rect.x * 2, rect.y * 2, rect.width * 2, rect.height * 2) & cv::Rect(0, 0, below.width, below.height);
+		cv::resize(this->region(level - 1, src_rect), image, rect.size(), 0, 0, cv::INTER_AREA);
+	}
+	
+	lru_.push_front(k);
+	Tile entry;
+	entry.image = image;
+	entry.lru_pos = lru_.begin();
+	tiles_[k] = entry;
+	used_bytes_ += image.total() * image.elemSize();
+	this->evict();
+	return image;
+}
+
+cv::Mat TilePyramid::region(int level, const cv::Rect &rect)
+{
+	if (level == 0 && !paged_) {
+		return source_(rect);
+	}
+	
+	int tx0 = rect.x / tile_size_, tx1 = (rect.x + rect.width - 1) / tile_size_;
+	int ty0 = rect.y / tile_size_, ty1 = (rect.y + rect.height - 1) / tile_size_;
+	if (tx0 == tx1 && ty0 == ty1) {
+		return this->tile(level, tx0, ty0)(rect - this->tileRect(level, tx0, ty0).tl());
+	}
+	
+	cv::Mat out(rect.size(), type_);
+	for (int ty=ty0; ty<=ty1; ty++) {
+		for (int tx=tx0; tx<=tx1; tx++) {
+			cv::Rect tile_rect = this->tileRect(level, tx, ty);
+			cv::Rect part = tile_rect & rect;
+			this->tile(level, tx, ty)(part - tile_rect.tl()).copyTo(out(part - rect.tl()));
+		}
+	}
+	return out;
+}
+
+void TilePyramid::evict()
+{
+	// Always keep the most recent tile, even if it alone exceeds the budget
+	while (used_bytes_ > budget_bytes_ && lru_.size() > 1) {
+		std::unordered_map<uint64_t, Tile>::iterator it = tiles_.find(lru_.back());
+		used_bytes_ -= it->second.image.total() * it->second.image.elemSize();
+		tiles_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+uint64_t TilePyramid::key(int level, int tx, int ty)
+{
+	return (uint64_t(level) << 48) | (uint64_t(uint32_t(ty) & 0xffffff) << 24) | uint64_t(uint32_t(tx) & 0xffffff);
+}
@@ -0,0 +1,63 @@
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include <iostream>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "polygon_drawer/viewport.h"
+#include "polygon_drawer/tiled_image.h"
+
+// Multi-resolution view of one image for the viewport. Level 0 is the
+// source image itself; level k halves level k - 1 and is cut into square
+// tiles that are only built when a frame first needs them, each from the
+// (at most four) tiles below it. Built tiles live in an LRU list bounded
+// by a memory budget, so zooming back out is free until they are evicted.
+// A Mat source stays whole in memory as level 0; a TiledImage source is
+// paged in one tile at a time into the same list and budget, so then the
+// whole pyramid is bounded by it. Its tile size must match this one.
+// render() takes the view of another copy of the same image: 'scale' is
+// the number of pixels of this one per pixel of that copy, in x and y.
+class TilePyramid {
+public:
+	TilePyramid(int tile_size = 256, size_t budget_mb = 256);
+	void setBudget(size_t budget_mb);
+	void setImage(const cv::Mat &image);
+	void setImage(const std::shared_ptr<TiledImage> &image);
+	void render(const Viewport &view, cv::Mat &out, cv::Point2d scale = cv::Point2d(1.0, 1.0));
+	int levelFor(double zoom);
+	
+	int levels() { return n_levels_; }
+	size_t size() { return tiles_.size(); }
+	size_t bytesUsed() { return used_bytes_; }
+	int tileSize() { return tile_size_; }
+
+private:
+	struct Tile {
+		cv::Mat image;
+		std::list<uint64_t>::iterator lru_pos;
+	};
+	
+	cv::Size levelSize(int level);
+	cv::Rect tileRect(int level, int tx, int ty);
+	cv::Mat tile(int level, int tx, int ty);
+	cv::Mat region(int level, const cv::Rect &rect);
+	void reset(cv::Size size, int type);
+	void evict();
+	static uint64_t key(int level, int tx, int ty);
+	
+	cv::Mat source_;
+	std::shared_ptr<TiledImage> paged_;   // instead of source_, see setImage()
+	cv::Size size_;
+	int type_;
+	int tile_size_;
+	int n_levels_;
+	std::unordered_map<uint64_t, Tile> tiles_;
+	std::list<uint64_t> lru_;
+	size_t budget_bytes_;
+	size_t used_bytes_;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "tiled_image.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+namespace {
+	bool writeAll(int fd, const char *data, size_t length)
+	{
+		while (length > 0) {
+			ssize_t n = write(fd, data, length);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) return false;
+			data += n;
+			length -= size_t(n);
+		}
+		return true;
+	}
+	
+	bool readAll(int fd, char *data, size_t length, off_t offset)
+	{
+		while (length > 0) {
+			ssize_t n = pread(fd, data, length, offset);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			data += n;
+			length -= size_t(n);
+			offset += n;
+		}
+		return true;
+	}
+}
+
+TiledImage::TiledImage(int fd, cv::Size size, int type, int tile_size)
+	: fd_(fd)
+	, size_(size)
+	, type_(type)
+	, tile_size_(tile_size)
+{
+}
+
+TiledImage::~TiledImage()
+{
+	::close(fd_);
+}
+
+std::shared_ptr<TiledImage> TiledImage::create(const cv::Mat &image, int tile_size, const std::string &dir)
+{
+	if (image.empty() || tile_size <= 0) return std::shared_ptr<TiledImage>();
+	
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(dir, ec);
+	std::string pattern = dir + "/tiles.XXXXXX";
+	std::vector<char> path(pattern.begin(), pattern.end());
+	path.push_back('\0');
+	int fd = mkstemp(path.data());
+	if (fd < 0) {
+		std::cout << utils::getBashColorText("[Warning] Cannot create a tile file in " + dir, 'y', 'b') << std::endl;
+		return std::shared_ptr<TiledImage>();
+	}
+	unlink(path.data());
+	std::shared_ptr<TiledImage> tiled(new TiledImage(fd, image.size(), image.type(), tile_size));
+	
+	// In the order readTile() expects; a copy per tile makes its rows contiguous
+	cv::Mat tile;
+	int tiles_x = (image.cols + tile_size - 1) / tile_size;
+	int tiles_y = (image.rows + tile_size - 1) / tile_size;
+	for (int ty=0; ty<tiles_y; ty++) {
+		for (int tx=0; tx<tiles_x; tx++) {
+			image(tiled->tileRect(tx, ty)).copyTo(tile);
+			if (!writeAll(fd, tile.ptr<char>(), tile.total() * tile.elemSize())) {
+				std::cout << utils::getBashColorText("[Warning] Failed to write a tile file in " + dir, 'y', 'b') << std::endl;
+				return std::shared_ptr<TiledImage>();
+			}
+		}
+	}
+	return tiled;
+}
+
+cv::Rect TiledImage::tileRect(int tx, int ty)
+{
+	cv::Rect rect(tx * tile_size_, ty * tile_size_, tile_size_, tile_size_);
+	return rect & cv::Rect(0, 0, size_.width, size_.height);
+}
+
+bool TiledImage::readTile(int tx, int ty, cv::Mat &tile)
+{
+	cv::Rect rect = this->tileRect(tx, ty);
+	if (rect.area() <= 0) return false;
+	
+	// Every row of tiles above is tile_size_ rows high; within a row, the tiles to the left are as high as this one
+	size_t elem_size = CV_ELEM_SIZE(type_);
+	off_t offset = off_t(rect.y) * size_.width * elem_size + off_t(rect.x) * rect.height * elem_size;
+	tile.create(rect.size(), type_);
+	return readAll(fd_, tile.ptr<char>(), tile.total() * elem_size, offset);
+}
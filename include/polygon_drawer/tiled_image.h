@@ -0,0 +1,36 @@
+#ifndef TILED_IMAGE_H
+#define TILED_IMAGE_H
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+// A decoded image moved out of memory into square tiles on disk, for
+// images too large to keep resident. The tiles are written back to back,
+// row of tiles after row of tiles, each with the rows of its own pixels
+// contiguous, so readTile() is a single pread into a fresh Mat. The file
+// is unlinked as soon as it is created: it lives as long as the object
+// and leaves nothing behind after a crash.
+class TiledImage {
+public:
+	static std::shared_ptr<TiledImage> create(const cv::Mat &image, int tile_size, const std::string &dir);
+	~TiledImage();
+	bool readTile(int tx, int ty, cv::Mat &tile);
+	cv::Size size() { return size_; }
+	int type() { return type_; }
+	int tileSize() { return tile_size_; }
+
+private:
+	TiledImage(int fd, cv::Size size, int type, int tile_size);
+	TiledImage(const TiledImage&);
+	TiledImage &operator=(const TiledImage&);
+	cv::Rect tileRect(int tx, int ty);
+	
+	int fd_;
+	cv::Size size_;
+	int type_;
+	int tile_size_;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "vertex_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+VertexGrid::VertexGrid()
+	: image_size_(0, 0)
+	, cols_(0)
+	, rows_(0)
+	, count_(0)
+{
+}
+
+void VertexGrid::reset(cv::Size image_size, int cell_px)
+{
+	image_size_ = image_size;
+	cell_px = std::max(cell_px, 1);
+	cols_ = std::max(1, (image_size.width + cell_px - 1) / cell_px);
+	rows_ = std::max(1, (image_size.height + cell_px - 1) / cell_px);
+
+	// Bound the number of cells for very large images
+	while (size_t(cols_) * size_t(rows_) > (1 << 20)) {
+		cols_ = (cols_ + 1) / 2;
+		rows_ = (rows_ + 1) / 2;
+	}
+
+	cells_.clear();
+	cells_.resize(size_t(cols_) * size_t(rows_));
+	count_ = 0;
+}
+
+void VertexGrid::clear()
+{
+	for (size_t i=0; i<cells_.size(); i++) {
+		cells_[i].clear();
+	}
+	count_ = 0;
+}
+
+int VertexGrid::cellIndex(const cv::Point2f &pt)
+{
+	// Vertices dragged outside the image end up in the border cells
+	int cx = std::min(std::max(int(std::floor(pt.x * cols_)), 0), cols_ - 1);
+	int cy = std::min(std::max(int(std::floor(pt.y * rows_)), 0), rows_ - 1);
+	return cy * cols_ + cx;
+}
+
+void VertexGrid::insert(uint32_t region, uint32_t vertex, const cv::Point2f &pt)
+{
+	if (cells_.empty()) return;
+
+	Entry entry;
+	entry.region = region;
+	entry.vertex = vertex;
+	entry.pt = pt;
+	cells_[this->cellIndex(pt)].push_back(entry);
+	count_++;
+}
+
+void VertexGrid::remove(uint32_t region, uint32_t vertex, const cv::Point2f &pt)
+{
+	if (cells_.empty()) return;
+
+	std::vector<Entry> &cell = cells_[this->cellIndex(pt)];
+	for (size_t i=0; i<cell.size(); i++) {
+		if (cell[i].region == region && cell[i].vertex == vertex) {
+			cell[i] = cell.back();
+			cell.pop_back();
+			count_--;
+			return;
+		}
+	}
+}
+
+void VertexGrid::move(uint32_t region, uint32_t vertex, const cv::Point2f &from, const cv::Point2f &to)
+{
+	if (cells_.empty()) return;
+
+	int from_index = this->cellIndex(from);
+	int to_index = this->cellIndex(to);
+	if (from_index == to_index) {
+		std::vector<Entry> &cell = cells_[from_index];
+		for (size_t i=0; i<cell.size(); i++) {
+			if (cell[i].region == region && cell[i].vertex == vertex) {
+				cell[i].pt = to;
+				return;
+			}
+		}
+		return;
+	}
+
+	this->remove(region, vertex, from);
+	this->insert(region, vertex, to);
+}
+
+bool VertexGrid::nearest(const cv::Point2f &pt, double radius, uint32_t &region, uint32_t &vertex)
+{
+	if (cells_.empty() || count_ == 0) return false;
+
+	float sx = float(image_size_.width);
+	float sy = float(image_size_.height);
+	cv::Point2f lo((pt.x - radius) / sx, (pt.y - radius) / sy);
+	cv::Point2f hi((pt.x + radius) / sx, (pt.y + radius) / sy);
+	int c0 = this->cellIndex(lo);
+	int c1 = this->cellIndex(hi);
+	int x0 = c0 % cols_, y0 = c0 / cols_;
+	int x1 = c1 % cols_, y1 = c1 / cols_;
+
+	// Squared distances in pixels, no sqrt in the inner loop
+	float best = float(radius * radius);
+	bool found = false;
+	for (int cy=y0; cy<=y1; cy++) {
+		for (int cx=x0; cx<=x1; cx++) {
+			const std::vector<Entry> &cell = cells_[cy * cols_ + cx];
+			for (size_t i=0; i<cell.size(); i++) {
+				float dx = cell[i].pt.x * sx - pt.x;
+				float dy = cell[i].pt.y * sy - pt.y;
+				float d2 = dx * dx + dy * dy;
+				if (d2 < best) {
+					best = d2;
+					region = cell[i].region;
+					vertex = cell[i].vertex;
+					found = true;
+				}
+			}
+		}
+	}
+	return found;
+}
@@ -0,0 +1,38 @@
+#ifndef VERTEX_GRID_H
+#define VERTEX_GRID_H
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+// Uniform grid over the normalized vertex positions of every region.
+// The cell size is given in image pixels and is normally the hit radius,
+// so a query only visits the 3x3 cells around the mouse position.
+class VertexGrid {
+public:
+	VertexGrid();
+	void reset(cv::Size image_size, int cell_px);
+	void clear();
+	void insert(uint32_t region, uint32_t vertex, const cv::Point2f &pt);
+	void remove(uint32_t region, uint32_t vertex, const cv::Point2f &pt);
+	void move(uint32_t region, uint32_t vertex, const cv::Point2f &from, const cv::Point2f &to);
+	bool nearest(const cv::Point2f &pt, double radius, uint32_t &region, uint32_t &vertex);
+	size_t size() { return count_; }
+
+private:
+	struct Entry {
+		uint32_t region;
+		uint32_t vertex;
+		cv::Point2f pt;
+	};
+
+	int cellIndex(const cv::Point2f &pt);
+
+	std::vector<std::vector<Entry> > cells_;
+	cv::Size image_size_;
+	int cols_;
+	int rows_;
+	size_t count_;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#include "viewport.h"
+
+#include <algorithm>
+
+Viewport::Viewport()
+	: zoom_(1.0)
+	, min_zoom_(1.0)
+	, max_zoom_(32.0)
+	, origin_(0.0, 0.0)
+{
+}
+
+void Viewport::fit(cv::Size image_size, cv::Size max_size)
+{
+	image_size_ = image_size;
+	if (image_size.width <= 0 || image_size.height <= 0) {
+		size_ = cv::Size(0, 0);
+		zoom_ = min_zoom_ = 1.0;
+		origin_ = cv::Point2d(0.0, 0.0);
+		return;
+	}
+	
+	// Small images keep their native size, as before the viewport existed
+	double fit = std::min(double(max_size.width) / image_size.width, double(max_size.height) / image_size.height);
+	fit = std::min(fit, 1.0);
+	size_ = cv::Size(std::max(int(image_size.width * fit), 1), std::max(int(image_size.height * fit), 1));
+	zoom_ = min_zoom_ = fit;
+	origin_ = cv::Point2d(0.0, 0.0);
+	this->clamp();
+}
+
+void Viewport::zoomAt(cv::Point pt, double factor)
+{
+	// The image point under the cursor stays under the cursor
+	cv::Point2d anchor = this->toImage(pt);
+	zoom_ = std::min(std::max(zoom_ * factor, min_zoom_), max_zoom_);
+	origin_ = cv::Point2d(anchor.x - pt.x / zoom_, anchor.y - pt.y / zoom_);
+	this->clamp();
+}
+
+void Viewport::pan(cv::Point delta)
+{
+	origin_.x -= delta.x / zoom_;
+	origin_.y -= delta.y / zoom_;
+	this->clamp();
+}
+
+cv::Point2d Viewport::toImage(const cv::Point2d &pt) const
+{
+	return cv::Point2d(origin_.x + pt.x / zoom_, origin_.y + pt.y / zoom_);
+}
+
+cv::Point Viewport::toScreen(const cv::Point2d &pt) const
+{
+	return cv::Point(cvFloor((pt.x - origin_.x) * zoom_), cvFloor((pt.y - origin_.y) * zoom_));
+}
+
+void Viewport::clamp()
+{
+	double w = size_.width / zoom_;
+	double h = size_.height / zoom_;
+	if (w >= image_size_.width) {
+		origin_.x = (image_size_.width - w) / 2.0;
+	} else {
+		origin_.x = std::min(std::max(origin_.x, 0.0), image_size_.width - w);
+	}
+	if (h >= image_size_.height) {
+		origin_.y = (image_size_.height - h) / 2.0;
+	} else {
+		origin_.y = std::min(std::max(origin_.y, 0.0), image_size_.height - h);
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+// Maps image pixels to window pixels: screen = (image - origin) * zoom.
+// The window size is fixed per image by fit(); zooming and panning only
+// change the zoom and the origin, which is clamped so that the image never
+// leaves the window and is centered when it is smaller than the window.
+class Viewport {
+public:
+	Viewport();
+	void fit(cv::Size image_size, cv::Size max_size);
+	void zoomAt(cv::Point pt, double factor);
+	void pan(cv::Point delta);
+	
+	cv::Point2d toImage(const cv::Point2d &pt) const;
+	cv::Point toScreen(const cv::Point2d &pt) const;
+	
+	double zoom() const { return zoom_; }
+	cv::Point2d origin() const { return origin_; }
+	cv::Size size() const { return size_; }
+	cv::Size imageSize() const { return image_size_; }
+
+private:
+	void clamp();
+	
+	cv::Size image_size_;
+	cv::Size size_;
+	double zoom_;
+	double min_zoom_;
+	double max_zoom_;
+	cv::Point2d origin_;
+};
+
+#endif
@@ -16,6 +16,11 @@
 #include <unistd.h>     //STDIN_FILENO
 
 #include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
 #include <boost/filesystem.hpp>
 
 namespace utils {
@@ -139,7 +144,9 @@ char utils::nonBlockingKeyboardEvent()
 
 std::string utils::getLocaltime(int mode) {
 	time_t now = time(0);
-	tm *mytime = localtime(&now);
+	// Reentrant, the editor calls this from the render thread and the autosave pool
+	tm buf;
+	tm *mytime = localtime_r(&now, &buf);
 		
 	std::string day_sep("-");
 	std::string time_sep("-");
@@ -157,3 +164,91 @@ std::string utils::getLocaltime(int mode) {
 	ss << "T" << (mytime->tm_hour + 1) << time_sep << (mytime->tm_min + 1) << time_sep << (mytime->tm_sec + 1);
 	return ss.str();
 }
+
+bool utils::writeFileAtomic(const std::string &filename, const std::string &content)
+{
+	// Write a temporary file next to the target, flush it to disk and rename it over the target,
+	// so readers and crashes only ever see the old or the new file
+	std::string tmp_filename = filename + ".tmp." + std::to_string(getpid());
+	int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+	
+	const char *data = content.data();
+	size_t remaining = content.size();
+	while (remaining > 0) {
+		ssize_t n = write(fd, data, remaining);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			close(fd);
+			unlink(tmp_filename.c_str());
+			return false;
+		}
+		data += n;
+		remaining -= size_t(n);
+	}
+	
+	bool synced = fsync(fd) == 0;
+	if (close(fd) != 0 || !synced) {
+		unlink(tmp_filename.c_str());
+		return false;
+	}
+	if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		unlink(tmp_filename.c_str());
+		return false;
+	}
+	
+	// The rename itself is only durable once the directory entry is on disk. The file is replaced
+	// either way, so a failure here is a warning; EINVAL comes from file systems that cannot sync
+	// a directory
+	std::string::size_type slash = filename.find_last_of('/');
+	std::string dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : filename.substr(0, slash));
+	int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	synced = dir_fd >= 0 && (fsync(dir_fd) == 0 || errno == EINVAL);
+	int error = errno;
+	if (dir_fd >= 0) close(dir_fd);
+	if (!synced) {
+		std::cout << getBashColorText("[Warning] Saved " + filename + ", but could not sync " + dir + ": " + strerror(error), 'y', 'b') << std::endl;
+	}
+	return true;
+}
+
+std::string utils::jsonEscape(const std::string &text)
+{
+	std::string out;
+	out.reserve(text.size() + 2);
+	for (size_t i=0; i<text.size(); i++) {
+		unsigned char c = text[i];
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += char(c);
+		} else if (c < 0x20) {
+			char buffer[8];
+			snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+			out += buffer;
+		} else {
+			out += char(c);
+		}
+	}
+	return out;
+}
+
+utils::FileLock::FileLock(const std::string &filename)
+{
+	fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0) return;
+	
+	int rc;
+	do {
+		rc = flock(fd_, LOCK_EX);
+	} while (rc != 0 && errno == EINTR);
+	if (rc != 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+}
+
+utils::FileLock::~FileLock()
+{
+	// Closing the descriptor drops the lock
+	if (fd_ >= 0) close(fd_);
+}
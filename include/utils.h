@@ -19,6 +19,25 @@ namespace utils {
 	char nonBlockingKeyboardEvent();
 	
 	std::string getLocaltime(int mode);
+	
+	bool writeFileAtomic(const std::string &filename, const std::string &content);
+	
+	std::string jsonEscape(const std::string &text);
+	
+	// Exclusive flock() on 'filename' (created if missing) for the lifetime of the object. Blocks
+	// while another process holds it; the kernel releases it when a process dies
+	class FileLock {
+	public:
+		FileLock(const std::string &filename);
+		~FileLock();
+		bool locked() const { return fd_ >= 0; }
+	
+	private:
+		FileLock(const FileLock&);
+		FileLock& operator=(const FileLock&);
+		
+		int fd_;
+	};
 };
 
 #endif
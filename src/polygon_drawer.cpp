@@ -6,17 +6,40 @@
 #include <thread>
 #include <chrono>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <ctime>
 #include <fstream>
 #include <map>
+#include <set>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include <yaml-cpp/yaml.h>
 #include <boost/filesystem.hpp>
 #include <polygon_drawer/editor.h>
+#include <polygon_drawer/annotation_io.h>
+#include <polygon_drawer/annotation_binary.h>
+#include <polygon_drawer/annotation_index.h>
+#include <polygon_drawer/bounded_queue.h>
+#include <polygon_drawer/directory_watcher.h>
+#include <polygon_drawer/display_cache.h>
+#include <polygon_drawer/image_cache.h>
+#include <polygon_drawer/image_scanner.h>
+#include <polygon_drawer/input_source.h>
+#include <polygon_drawer/profiler.h>
+#include <polygon_drawer/proposal_cache.h>
+#include <polygon_drawer/thread_pool.h>
+#include <polygon_drawer/tile_pyramid.h>
+#include <polygon_drawer/tiled_image.h>
+#include <polygon_drawer/viewport.h>
 
 #include "utils.h"
 
 const std::string CONFIG_FILE = "../config/polygon_drawer.yaml";
+const unsigned REPLAY_SEED = 20170101;
 
 void checkResultDir(std::string target_dir) {
 	boost::filesystem::path path(target_dir);
@@ -27,14 +50,94 @@ void checkResultDir(std::string target_dir) {
 	}
 }
 
+// Input event or I/O result handed to the model thread
+struct EditorCommand {
+	enum Type { NONE, MOUSE, KEY, RENAME, FIND, IMAGE_READY, DETAIL_READY, PROPOSAL, SOURCE_CHANGED };
+	
+	int type;
+	int event;          // MOUSE: cv::EVENT_* and the HighGUI flags
+	int flags;
+	cv::Point pt;
+	int key;            // KEY
+	std::string id;     // RENAME, empty when the prompt was cancelled
+	std::string name;   // RENAME, and FIND: the label, empty for the previous one
+	uint64_t load_seq;  // IMAGE_READY, DETAIL_READY and PROPOSAL, ignored unless it answers the latest request
+	cv::Mat image;
+	cv::Size full_size; // IMAGE_READY, the source size when the image is a reduced display copy
+	std::shared_ptr<TiledImage> detail;   // DETAIL_READY, empty when the decode failed
+	std::vector<cv::Point2f> points;   // PROPOSAL, empty when nothing was found
+	std::shared_ptr<DirectoryWatcher::Batch> changes;   // SOURCE_CHANGED
+	int64_t time_ns;    // when it was queued, for the input latency
+	uint64_t input_seq; // InputSource::eventSeq() of the event behind it, 0 for I/O results
+	
+	EditorCommand() : type(NONE), event(0), flags(0), key(-1), load_seq(0), time_ns(0), input_seq(0) {}
+};
+
+// Everything the render thread needs for one frame; it is never modified after publishing
+struct FrameSnapshot {
+	MyPolygonDrawer drawer;     // without the vertex index, carries the damage since the previous snapshot
+	Viewport view;
+	cv::Mat image;
+	std::shared_ptr<TiledImage> detail;   // the full image behind a reduced display copy, once zoomed past its scale
+	uint64_t image_seq;
+	uint64_t view_seq;          // changes whenever the base layer has to be recomposed
+	std::string name;
+	std::string status;         // drawn over the frame, e.g. while the next image loads
+	bool show_hud;
+	FrameInfo info;
+};
+
+// A finished frame on its way from the render thread to the UI thread
+struct DisplayFrame {
+	cv::Mat image;
+	FrameInfo info;
+};
+
+// Runs on four threads that never wait on each other's work:
+//   UI (the caller of run)  the InputSource only, shows finished frames and queues keys and mouse events
+//   model                   owns the drawers and the view, applies the commands, publishes snapshots
+//   render                  composes tiles and polygons from the latest snapshot
+//   console                 the blocking rename prompt
+// Decoding and saving run on a small I/O pool that answers through the command
+// queue, so a slow disk delays the next image but never the handling of input.
+// Object proposals for snapping are computed on a pool of their own in the same way.
 class ImageEditor {
 public:
-	ImageEditor(std::string source_image_dir, std::string results_dir, std::string winname) 
-		: appname_(winname), results_dir_(results_dir)
+	ImageEditor(std::string source_image_dir, std::string results_dir, std::string winname, InputSource &input, EditorOptions options = EditorOptions()) 
+		: appname_(winname), input_(input), results_dir_(results_dir), options_(options), profiler_(options.profile)
+		, display_cache_(!options.display_cache ? "" : options.display_cache_dir.empty() ? results_dir + "/display_cache" : options.display_cache_dir, 
+			cv::Size(options.viewport_width, options.viewport_height))
+		, image_cache_(options.image_cache_mb)
+		, io_pool_(2), commands_(4096), prompts_(4), snapshot_(NULL), display_(NULL), quit_(false), quit_requested_(false)
+		, proposals_(image_cache_, options.proposal_threads)
+		, index_(0), image_seq_(0), view_seq_(0), load_seq_(0), input_seq_(0), loading_(false), detail_requested_(false), detail_loading_(false), pending_proposals_(0), panning_(false), show_hud_(options.show_hud)
+		, prompt_pending_(false), dirty_(true), pyramid_(options.tile_size, options.tile_cache_mb), detail_pyramid_(options.tile_size, options.tile_cache_mb)
+		, rendered_image_seq_(0), rendered_view_seq_(0), render_show_hud_(false), hud_refresh_ns_(0)
 	{
 		polygon_data_filename_ = cv::format("%s/polygon_drawer.yaml", results_dir_.c_str());
+		binary_filename_ = cv::format("%s/polygon_drawer.bin", results_dir_.c_str());
+		shard_dir_ = cv::format("%s/shards", results_dir_.c_str());
+		trace_filename_ = cv::format("%s/polygon_drawer_trace.json", results_dir_.c_str());
+		if (options_.worker_count > 1) {
+			// Everything this process writes is its own; polygon_drawer.yaml is only read
+			std::string worker = annotation_io::workerDir(results_dir_) + "/" + annotation_io::workerName(options_.worker_index, options_.worker_count);
+			worker_filename_ = worker + ".yaml";
+			shard_dir_ = worker;
+			trace_filename_ = worker + "_trace.json";
+		}
+		// A replay creates the same ids and vertices on every run
+		id_rng_.seed(input_.waitsForFrames() ? REPLAY_SEED : std::random_device()());
 		is_ok_ = true;
+		profiler_.nameThread("ui");
+		image_cache_.setProfiler(&profiler_);
+		// Also without a directory: large images are then reduced in memory on every decode
+		image_cache_.setDisplayCache(&display_cache_);
+		proposals_.setProfiler(&profiler_);
 		
+		// Before the scan, so that nothing written in between is missed; changes queue up until the model runs
+		if (options_.watch_source_dir) {
+			this->startWatcher(source_image_dir);
+		}
 		if (!this->setImageList(source_image_dir)) {
 			std::cout << utils::getBashColorText("[Error] Failed loading images from " + source_image_dir, 'r', 'b') << std::endl;
 			is_ok_ = false;
@@ -42,209 +145,833 @@ public:
 		}
 		
 		this->loadPreviousPolygonData(polygon_data_filename_);
-		cv::namedWindow(appname_, 1);
-		cv::setMouseCallback(appname_, &ImageEditor::onMouse, this);
+		this->buildIndex();
+		input_.setMouseCallback(&ImageEditor::onMouse, this);
+	}
+	
+	~ImageEditor() {
+		delete snapshot_.exchange(NULL);
+		delete display_.exchange(NULL);
 	}
 	
 	static void onMouse(int event, int x, int y, int flags, void *param) {
 		ImageEditor *pThis = (ImageEditor *) param;
-		if (event == cv::EVENT_LBUTTONDOWN) {
-			pThis->mouseClick(cv::Point(x, y));
-		} else if (event == cv::EVENT_MOUSEMOVE) {
-			pThis->mouseMove(cv::Point(x, y));
-		} else if (event == cv::EVENT_LBUTTONUP) {
-			pThis->mouseRelease();
+		EditorCommand command;
+		command.type = EditorCommand::MOUSE;
+		command.event = event;
+		command.flags = flags;
+		command.pt = cv::Point(x, y);
+		command.input_seq = pThis->input_.eventSeq();
+		pThis->post(command);
+	}
+	
+	void loadPreviousPolygonData(std::string file) {
+		ScopedTimer timer(profiler_, Profiler::LOAD);
+		if (this->isBinaryCurrent(file) && binary_.open(binary_filename_)) {
+			// Drawers are built from the mapping when their image is first opened
+			std::cout << utils::getBashColorText(cv::format("[Ok] Mapped %d annotated images from ", int(binary_.size())) + binary_filename_, 'g', 'b') << std::endl;
+		} else if (!annotation_io::loadYaml(file, drawer_list_, true)) {
+			std::cout << utils::getBashColorText("[Warning] Polygon data file is not available: " + file, 'y', 'b') << std::endl;
+			std::cout << "[Ok] Skip initialization of polygon data" << std::endl;
+		} else {
+			std::cout << "[Ok] Initialized polygon data" << std::endl;
+		}
+		
+		if (!worker_filename_.empty() && annotation_io::loadYaml(worker_filename_, drawer_list_)) {
+			std::cout << utils::getBashColorText("[Ok] Loaded the results of this worker from " + worker_filename_, 'g', 'b') << std::endl;
+		} else if (worker_filename_.empty() && this->hasWorkerResults()) {
+			std::cout << utils::getBashColorText("[Warning] Worker results are not merged yet, run 'polygon_tools merge " + results_dir_ + "' first", 'y', 'b') << std::endl;
 		}
+		
+		// Shards left by autosave are newer than the combined file, e.g. after a crash
+		int n_shards = annotation_io::loadShards(shard_dir_, drawer_list_);
+		if (n_shards > 0) {
+			std::cout << utils::getBashColorText(cv::format("[Ok] Restored %d autosaved images from ", n_shards) + shard_dir_, 'g', 'b') << std::endl;
+		}
+	
+		std::cout << utils::getBashColorText(cv::format("[Ok] Successfully set %d drawers", int(drawer_list_.size())), 'g', 'b') << std::endl;
+
 	}
 	
-	void mouseClick(cv::Point pt) {
-		current_drawer_.mouseSelectPoint(pt);
+	// Images that are only in the mapped file are indexed from their ids, without building the drawers
+	void buildIndex() {
+		int64 t0 = cv::getTickCount();
+		annotation_index_.reset(image_list_.size());
+		std::vector<std::string> ids;
+		for (size_t i=0; i<image_list_.size(); i++) {
+			const std::string &name = image_list_[i].name;
+			DrawerMap::iterator it = drawer_list_.find(name);
+			if (it != drawer_list_.end()) {
+				annotation_index_.update(int(i), it->second.getPolygons());
+				continue;
+			}
+			int index = binary_.isOpen() ? binary_.find(name) : -1;
+			if (index >= 0) {
+				binary_.loadIds(index, ids);
+				annotation_index_.update(int(i), ids);
+			}
+		}
+		double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+		std::cout << utils::getBashColorText(cv::format("[Ok] Indexed %d labels, %d of %d images unlabeled, in %.1f ms", 
+			int(annotation_index_.labels().size()), int(annotation_index_.count(AnnotationIndex::EMPTY)), 
+			int(annotation_index_.size()), elapsed_ms), 'g', 'b') << std::endl;
+		// The open image may have edits that are not in drawer_list_ yet
+		this->indexCurrent();
 	}
 	
-	void mouseMove(cv::Point pt) {
-		current_drawer_.mouseMovePoint(pt);
+	void run() {
+		if (!is_ok_) { return; }
+		
+		std::thread model(&ImageEditor::modelLoop, this);
+		std::thread render(&ImageEditor::renderLoop, this);
+		std::thread console(&ImageEditor::consoleLoop, this);
+		
+		// HighGUI has to stay on this thread; it only shows what the render thread finished
+		while (!quit_) {
+			ScopedTimer frame_timer(profiler_, Profiler::FRAME);
+			
+			DisplayFrame *display = display_.exchange(NULL);
+			if (display != NULL) {
+				ScopedTimer timer(profiler_, Profiler::IMSHOW);
+				input_.show(display->image, display->info);
+				delete display;
+			}
+			int key;
+			{
+				ScopedTimer timer(profiler_, Profiler::WAITKEY);
+				key = input_.waitKey(10);
+			}
+			if (key >= 0) {
+				EditorCommand command;
+				command.type = EditorCommand::KEY;
+				command.key = key & 0xff;
+				command.input_seq = input_.eventSeq();
+				this->post(command);
+			}
+		}
+		
+		model.join();
+		render.join();
+		console.join();
+		if (watcher_) watcher_->stop();
+		this->writeProfile();
 	}
 	
-	void mouseRelease() {
-		current_drawer_.mouseRelease();
+	void savePolygons() {
+		ScopedTimer timer(profiler_, Profiler::SAVE);
+		// Images never opened in this session are still only in the mapped file
+		if (binary_.isOpen()) {
+			binary_.loadAll(drawer_list_);
+			binary_.close();
+		}
+		if (!worker_filename_.empty()) {
+			// The empty entries of renamed images are kept, the merge replaces the old names with them
+			if (drawer_list_.size() > 0) this->saveWorkerPolygons();
+			return;
+		}
+		// Names whose annotations moved with a renamed image are left out, unless annotated again
+		for (std::set<std::string>::iterator it = renamed_from_.begin(); it != renamed_from_.end(); it++) {
+			DrawerMap::iterator drawer = drawer_list_.find(*it);
+			if (drawer != drawer_list_.end() && drawer->second.getPolygons().size() == 0) {
+				drawer_list_.erase(drawer);
+			}
+		}
+		if (drawer_list_.size() == 0) { return; }
+		
+		// A merge or another editor on the same results_dir waits until both files are written
+		utils::FileLock lock(annotation_io::lockPath(results_dir_));
+		if (!lock.locked()) {
+			std::cout << utils::getBashColorText("[Warning] Saving without the lock: " + annotation_io::lockPath(results_dir_), 'y', 'b') << std::endl;
+		}
+		
+		std::cout << "\nAvailable of " << utils::getBashColorText(cv::format("%d drawer-sets", int(drawer_list_.size())), 'g', 'b') << std::endl;
+		if (!annotation_io::saveYaml(polygon_data_filename_, appname_, drawer_list_)) {
+			std::cout << utils::getBashColorText("[Error] Failed to save polygon data: " + polygon_data_filename_, 'r', 'b') << std::endl;
+			return;
+		}
+		
+		// The combined file now holds every autosaved image, the shards are no longer needed
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(shard_dir_, ec);
+		
+		std::cout << utils::getBashColorText("[Ok] Saved polygon data successfully: " + polygon_data_filename_, 'g', 'b') << std::endl;
+		
+		// Written after the YAML so that its timestamp marks it as current on the next start
+		if (AnnotationBinary::save(binary_filename_, drawer_list_)) {
+			std::cout << utils::getBashColorText("[Ok] Saved binary polygon data: " + binary_filename_, 'g', 'b') << std::endl;
+		} else {
+			std::cout << utils::getBashColorText("[Warning] Failed to save binary polygon data: " + binary_filename_, 'y', 'b') << std::endl;
+		}
 	}
 	
-	void loadPreviousPolygonData(std::string file) {
-		std::ifstream reader(file);
-		if (!reader.is_open()) {
-			std::cout << utils::getBashColorText("[Warning] Polygon data file is not available: " + file, 'y', 'b') << std::endl;
-			std::cout << "[Ok] Skip initialization of polygon data" << std::endl;
+	// Only the images of this worker's partition, including those it left empty, so that the
+	// merge replaces exactly them and never touches what the other workers annotated
+	void saveWorkerPolygons() {
+		DrawerMap own;
+		for (DrawerMap::iterator it = drawer_list_.begin(); it != drawer_list_.end(); it++) {
+			if (annotation_io::workerOf(it->first, options_.worker_count) == options_.worker_index) {
+				own.insert(*it);
+			}
+		}
+		
+		// A merge moves the worker files aside; while it holds the lock, this save waits, so
+		// that a file written in between is never moved away unapplied
+		utils::FileLock lock(annotation_io::lockPath(results_dir_));
+		if (!lock.locked()) {
+			std::cout << utils::getBashColorText("[Warning] Saving without the lock: " + annotation_io::lockPath(results_dir_), 'y', 'b') << std::endl;
+		}
+		
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(annotation_io::workerDir(results_dir_), ec);
+		if (!annotation_io::saveYaml(worker_filename_, appname_, own)) {
+			std::cout << utils::getBashColorText("[Error] Failed to save polygon data: " + worker_filename_, 'r', 'b') << std::endl;
 			return;
 		}
-		reader.close();
+		boost::filesystem::remove_all(shard_dir_, ec);
+		std::cout << utils::getBashColorText(cv::format("[Ok] Saved %d images of worker %d/%d: ", int(own.size()), 
+			options_.worker_index, options_.worker_count) + worker_filename_, 'g', 'b') << std::endl;
+	}
+	
+	bool hasWorkerResults() {
+		boost::system::error_code ec;
+		boost::filesystem::directory_iterator it(annotation_io::workerDir(results_dir_), ec), end;
+		for (; !ec && it != end; it.increment(ec)) {
+			if (it->path().extension() == ".yaml") return true;
+		}
+		return false;
+	}
+	
+	void saveShard(std::string name) {
+		// Written from a copy on the I/O pool; the flag is cleared right away, so a failed
+		// write is covered by the final save rather than retried
+		std::shared_ptr<MyPolygonDrawer> drawer(new MyPolygonDrawer());
+		current_drawer_.copyWithoutHistory(*drawer);
+		current_drawer_.clearModified();
+		io_pool_.submit([this, name, drawer]() {
+			ScopedTimer timer(profiler_, Profiler::AUTOSAVE);
+			// Two writes of the same image must not share the temporary file
+			std::lock_guard<std::mutex> lock(shard_mutex_);
+			if (annotation_io::saveShard(shard_dir_, appname_, name, *drawer)) {
+				std::cout << " .. Autosaved: " << utils::getBashColorText(annotation_io::shardPath(shard_dir_, name), 'g', 'b') << std::endl;
+			} else {
+				std::cout << utils::getBashColorText("[Error] Failed to autosave " + name, 'r', 'b') << std::endl;
+			}
+		});
+	}
+	
+	// Latency of every replayed event and a digest of the saved annotations, so that two runs can be compared
+	bool writeReplayReport(ReplayInput &replay, const std::string &filename) {
+		const std::vector<ReplayInput::Event> &events = replay.events();
+		std::vector<double> latencies;
+		std::stringstream per_event;
+		for (size_t i=0; i<events.size(); i++) {
+			const ReplayInput::Event &event = events[i];
+			per_event << (i == 0 ? "\n" : ",\n") << "  {\"seq\": " << i + 1 << ", \"event\": \"" << utils::jsonEscape(event.line) << "\", \"latency_ms\": ";
+			if (event.latency_ms >= 0.0) {
+				per_event << cv::format("%.3f}", event.latency_ms);
+				latencies.push_back(event.latency_ms);
+			} else {
+				per_event << "null}";
+			}
+		}
+		std::sort(latencies.begin(), latencies.end());
+		double mean = 0.0;
+		for (size_t i=0; i<latencies.size(); i++) {
+			mean += latencies[i] / latencies.size();
+		}
+		double p50 = latencies.empty() ? 0.0 : latencies[latencies.size() / 2];
+		double p99 = latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+		double max = latencies.empty() ? 0.0 : latencies.back();
+		
+		// FNV-1a over the same text that is saved, equal annotations give equal checksums
+		int images = 0, regions = 0, vertices = 0;
+		uint64_t checksum = 14695981039346656037ull;
+		for (DrawerMap::iterator it = drawer_list_.begin(); it != drawer_list_.end(); it++) {
+			const PolygonStore &polygons = it->second.getPolygons();
+			if (polygons.size() == 0) continue;
+			images++;
+			regions += int(polygons.size());
+			for (PolygonStore::const_iterator p = polygons.begin(); p != polygons.end(); p++) {
+				vertices += int((*p).size());
+			}
+			std::string text = it->first + ": " + it->second.getTextInfo() + "\n";
+			for (size_t i=0; i<text.size(); i++) {
+				checksum ^= (unsigned char) text[i];
+				checksum *= 1099511628211ull;
+			}
+		}
 		
-		std::cout << "[Ok] Initialized polygon data" << std::endl;
-		YAML::Node node = YAML::LoadFile(polygon_data_filename_);
-		if (node["polygons"]) {
-			if (node["polygons"].size() > 0) {
-				for (int i=0; i<(int)node["polygons"].size(); i++) {
-					MyPolygonDrawer drawer;
+		std::stringstream ss;
+		ss << "{\"events\": " << events.size() << ", \"completed\": " << latencies.size() << ", \"timeouts\": " << replay.timeouts()
+			<< ", \"frames\": " << replay.frames() << ",\n";
+		ss << cv::format("\"latency_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n", mean, p50, p99, max);
+		ss << cv::format("\"annotations\": {\"images\": %d, \"regions\": %d, \"vertices\": %d, \"checksum\": \"%016llx\"},\n", 
+			images, regions, vertices, (unsigned long long) checksum);
+		ss << "\"per_event\": [" << per_event.str() << "\n]}\n";
+		
+		std::cout << "\nReplay:" << std::endl;
+		std::cout << cv::format(" |-- %d events, %d frames, %d timed out", int(events.size()), int(replay.frames()), int(replay.timeouts())) << std::endl;
+		std::cout << cv::format(" |-- latency (ms)  mean: %8.3f  p50: %8.3f  p99: %8.3f  max: %8.3f", mean, p50, p99, max) << std::endl;
+		std::cout << cv::format(" |-- %d images, %d regions, %d vertices, checksum %016llx", images, regions, vertices, (unsigned long long) checksum) << std::endl;
+		if (!utils::writeFileAtomic(filename, ss.str())) {
+			std::cout << utils::getBashColorText("[Error] Failed to save the replay report: " + filename, 'r', 'b') << std::endl;
+			return false;
+		}
+		std::cout << utils::getBashColorText("[Ok] Saved the replay report: " + filename, 'g', 'b') << std::endl;
+		return true;
+	}
 
-					auto data = node["polygons"][i];
-					std::string name = data["name"].as<std::string>();
-					cv::Size image_size(data["w"].as<int>(), data["h"].as<int>());
-					
-					drawer.setImageSize(image_size);
-					
-					std::cout << " " << name << ", Size: " << image_size.width << " x " << image_size.height << std::endl;
-					if (data["ids"] && data["vertices"]) {
-						if (data["ids"].size() == data["vertices"].size()) {
-							
-							int index = 0;
-							for (auto single_box : data["vertices"]) {
-								std::stringstream ss;
-								ss << std::setprecision(3) << std::fixed;
-								std::vector<cv::Point2f> points;
-								for (auto vertice : single_box) {
-									cv::Point2f pt(vertice[0].as<double>(), vertice[1].as<double>());
-									points.push_back(pt);
-									ss << "(" << pt.x << ", " << pt.y << ") ";
-								}
-								std::string id = data["ids"][index].as<std::string>();
-								std::cout << "    >> " << id << ": " << ss.str() << std::endl;
-								index++;
-								drawer.addRegion(id, MyPolygon(id, points));
-							}
-						}	
-					}
-					
-					drawer_list_.insert(std::pair<std::string, MyPolygonDrawer>(name, drawer));
+private:
+	
+	// Any thread. When the queue is full only mouse moves are dropped, the next one supersedes them
+	void post(EditorCommand &command) {
+		command.time_ns = Profiler::now();
+		bool droppable = (command.type == EditorCommand::MOUSE && command.event == cv::EVENT_MOUSEMOVE);
+		while (!commands_.push(command)) {
+			if (droppable || quit_requested_) return;
+			std::this_thread::yield();
+		}
+		model_cond_.notify_one();
+	}
+	
+	void modelLoop() {
+		profiler_.nameThread("model");
+		this->openImage(0);
+		
+		while (!quit_requested_) {
+			bool applied = false;
+			EditorCommand command;
+			while (!quit_requested_ && commands_.pop(command)) {
+				this->apply(command);
+				profiler_.record(Profiler::INPUT, command.time_ns, Profiler::now());
+				applied = true;
+				if (command.input_seq > input_seq_) {
+					input_seq_ = command.input_seq;
+					// A replay waits for the frame of each event, also when it changed nothing
+					if (input_.waitsForFrames()) dirty_ = true;
 				}
 			}
+			// One snapshot per batch, so a burst of mouse moves costs a single frame
+			if (dirty_ || current_drawer_.needsRedraw()) {
+				this->publish();
+			}
+			if (!applied) {
+				// Producers notify without the lock, the timeout bounds a missed wake-up
+				std::unique_lock<std::mutex> lock(model_mutex_);
+				model_cond_.wait_for(lock, std::chrono::milliseconds(5));
+			}
 		}
+		
+		this->leaveImage();
+		status_ = "Saving ...";
+		this->publish();
+		io_pool_.wait();
+		this->savePolygons();
+		quit_ = true;
+		render_cond_.notify_all();
+	}
 	
-		std::cout << utils::getBashColorText(cv::format("[Ok] Successfully set %d drawers", int(drawer_list_.size())), 'g', 'b') << std::endl;
-
+	void apply(const EditorCommand &command) {
+		if (command.type == EditorCommand::MOUSE) {
+			this->applyMouse(command);
+		} else if (command.type == EditorCommand::KEY) {
+			this->applyKey(command.key);
+			this->indexCurrent();
+		} else if (command.type == EditorCommand::RENAME) {
+			prompt_pending_ = false;
+			if (!command.id.empty() && !current_image_.empty()) {
+				current_drawer_.editRegionById(command.id, command.name);
+				this->indexCurrent();
+			}
+		} else if (command.type == EditorCommand::FIND) {
+			prompt_pending_ = false;
+			if (!command.name.empty()) find_label_ = command.name;
+			if (find_label_.empty()) {
+				std::cout << utils::getBashColorText("[Warning] No label to look for", 'y', 'b') << std::endl;
+				return;
+			}
+			AnnotationIndex::Filter filter;
+			filter.label = find_label_;
+			this->jumpTo(filter, "image with '" + find_label_ + "'");
+		} else if (command.type == EditorCommand::IMAGE_READY && command.load_seq == load_seq_) {
+			loading_ = false;
+			this->showImage(command.image, command.full_size);
+		} else if (command.type == EditorCommand::DETAIL_READY && command.load_seq == load_seq_) {
+			detail_loading_ = false;
+			if (status_ == "Loading full resolution ...") status_ = "";
+			dirty_ = true;
+			if (!command.detail) {
+				std::cout << utils::getBashColorText("[Warning] Cannot decode the full image, showing the display copy: " + current_name_, 'y', 'b') << std::endl;
+				return;
+			}
+			detail_image_ = command.detail;
+			image_seq_++;
+		} else if (command.type == EditorCommand::SOURCE_CHANGED) {
+			this->applySourceChanges(*command.changes);
+		} else if (command.type == EditorCommand::PROPOSAL) {
+			pending_proposals_--;
+			if (command.load_seq != load_seq_ || current_image_.empty()) return;
+			status_ = "";
+			dirty_ = true;
+			if (command.points.empty()) {
+				std::cout << utils::getBashColorText("[Warning] No object found around the cursor", 'y', 'b') << std::endl;
+			} else {
+				std::cout << " >> Action: " << utils::getBashColorText("snap to the segmented object", 'g', 'b') << std::endl;
+				current_drawer_.placeRegion(randomId(), command.points);
+				this->indexCurrent();
+			}
+		}
 	}
 	
-	void run() {
-		if (!is_ok_) { return; }
+	void applyMouse(const EditorCommand &command) {
+		if (current_image_.empty()) return;
 		
-		int index = 0;		
-		while (is_ok_) {
-					
-			std::cout << "\n------------------------- " << std::endl;
-			std::cout << "Index: " << index << std::endl;
-			auto item = image_list_[index];
-			cv::Mat image = item.image.clone();
-			
-			if (image.empty()) { 
-				std::cout << " .. Error: Invalid image for " << utils::getBashColorText(image_list_[index].name, 'r', 'b') << std::endl;
-				sleep(1);
-				continue; 
-			}
-			
-			bool is_drawing_ = true;
-			
-			std::map<std::string, MyPolygonDrawer>::iterator it = drawer_list_.find(item.name);
-			if (it != drawer_list_.end()) {
-				std::cout << "Found previous polygons: " << utils::getBashColorText(item.name, 'g', 'b') << std::endl;
-				current_drawer_ = it->second;
+		cursor_pt_ = command.pt;
+		if (command.event == cv::EVENT_LBUTTONDOWN) {
+			current_drawer_.mouseSelectPoint(command.pt);
+		} else if (command.event == cv::EVENT_MOUSEMOVE) {
+			if (panning_) {
+				view_.pan(command.pt - pan_pt_);
+				pan_pt_ = command.pt;
+				this->viewChanged();
 			} else {
-				std::cout << "Created a new polygon" << std::endl;
-				current_drawer_ = MyPolygonDrawer();
+				current_drawer_.mouseMovePoint(command.pt);
 			}
+		} else if (command.event == cv::EVENT_LBUTTONUP) {
+			current_drawer_.mouseRelease();
+		} else if (command.event == cv::EVENT_RBUTTONDOWN) {
+			panning_ = true;
+			pan_pt_ = command.pt;
+		} else if (command.event == cv::EVENT_RBUTTONUP) {
+			panning_ = false;
+		} else if (command.event == cv::EVENT_MOUSEWHEEL) {
+			view_.zoomAt(command.pt, cv::getMouseWheelDelta(command.flags) > 0 ? 1.25 : 0.8);
+			this->viewChanged();
+		}
+	}
 	
-			current_drawer_.setImageSize(image.size());
-			this->drawImageHeader(image, item.name);
-			
-			while (is_drawing_) {
-				
-				cv::Mat frame = image.clone();
-				current_drawer_.draw(frame);
-				cv::imshow(appname_, frame);
-				char key = cv::waitKey(10);
-
-				
-				if (key == 27) {
-					is_ok_ = false;
-					is_drawing_ = false;
-					std::cout << " >> Action: " << utils::getBashColorText("Quiting the software ...", 'y', 'b') << std::endl;
-				} else if (key == '0') {
-					std::cout << " >> Action: " << utils::getBashColorText("go to the first image", 'g', 'b') << std::endl;
-					index = 0;
-					is_drawing_ = false;
-				} else if (key == '1') {
-					std::cout << " >> Action: " << utils::getBashColorText("go back to previous image", 'y', 'b') << std::endl;			
-					index = (index + 1) % int(image_list_.size());
-					is_drawing_ = false;
-				} else if (key == '2') {
-					std::cout << " >> Action: " << utils::getBashColorText("proceed to next image", 'g', 'b') << std::endl;
-					index = (int(image_list_.size()) + (index - 1)) % int(image_list_.size());
-					is_drawing_ = false;
-				}	else {				
-					switch (key) {
-						case 'a': {
-							current_drawer_.addRegion(randomId());
-							break;
-						}
-						case 'd': {
-							current_drawer_.deleteLastRegion();
-							break;
-						}
-						case 'e': {
-							std::string id, name;
-							std::cout << "Enter a region id: ";
-							std::cin >> id;
-							std::cout << "Enter a new name (spacebar is not allowed !!!) : ";
-							std::cin >> name;
-							current_drawer_.editRegionById(id, name);
-							break;
-						}
+	void applyKey(int key) {
+		int n = int(image_list_.size());
+		if (key == 27) {
+			quit_requested_ = true;
+			std::cout << " >> Action: " << utils::getBashColorText("Quiting the software ...", 'y', 'b') << std::endl;
+		} else if (key == '0') {
+			std::cout << " >> Action: " << utils::getBashColorText("go to the first image", 'g', 'b') << std::endl;
+			this->leaveImage();
+			this->openImage(0);
+		} else if (key == '1') {
+			std::cout << " >> Action: " << utils::getBashColorText("go back to previous image", 'y', 'b') << std::endl;
+			this->leaveImage();
+			this->openImage((index_ + 1) % n);
+		} else if (key == '2') {
+			std::cout << " >> Action: " << utils::getBashColorText("proceed to next image", 'g', 'b') << std::endl;
+			this->leaveImage();
+			this->openImage((n + (index_ - 1)) % n);
+		} else if (key == 'u' || key == 'n') {
+			AnnotationIndex::Filter filter;
+			filter.labeled = (key == 'n') ? 1 : 0;
+			this->jumpTo(filter, (key == 'n') ? "labeled image" : "unlabeled image");
+		} else if (key == 'h') {
+			show_hud_ = !show_hud_;
+			if (show_hud_ && !profiler_.enabled()) {
+				std::cout << utils::getBashColorText("[Warning] Set 'profile: true' in the config to fill the HUD", 'y', 'b') << std::endl;
+			}
+			dirty_ = true;
+		} else if (key == 'e' || key == 'l') {
+			// Answered by the console thread with a RENAME or FIND command; the window stays live meanwhile
+			if (prompt_pending_) {
+				std::cout << utils::getBashColorText("[Warning] Finish the prompt in the terminal first", 'y', 'b') << std::endl;
+			} else if (prompts_.push(key)) {
+				prompt_pending_ = true;
+			}
+		} else if (!current_image_.empty()) {
+			cv::Point center(view_.size().width / 2, view_.size().height / 2);
+			switch (key) {
+				case 'a': {
+					current_drawer_.addRegion(randomId(), id_rng_);
+					break;
+				}
+				case 'd': {
+					current_drawer_.deleteLastRegion();
+					break;
+				}
+				case 's': {
+					this->snapProposal();
+					break;
+				}
+				case 'z': {
+					if (current_drawer_.undo()) {
+						std::cout << " >> Action: " << utils::getBashColorText(cv::format("undo (%d more)", int(current_drawer_.getHistory().undoDepth())), 'y', 'b') << std::endl;
 					}
+					break;
 				}
-			}
-			
-			std::map<std::string, MyPolygonDrawer>::iterator it2 = drawer_list_.find(item.name);
-			if (it2 == drawer_list_.end()) {
-				if (current_drawer_.getPolygons().size() > 0) {
-					drawer_list_.insert(std::pair<std::string, MyPolygonDrawer>(item.name, current_drawer_));
-					std::cout << " Added a new drawer: " << utils::getBashColorText(item.name, 'g', 'b') << std::endl;
-					for (it2 = drawer_list_.begin(); it2 != drawer_list_.end(); it2++) {
-						std::cout << " |-- " << it2->first << ", Polygons: " << it2->second.getPolygons().size() << std::endl;
+				case 'y': {
+					if (current_drawer_.redo()) {
+						std::cout << " >> Action: " << utils::getBashColorText(cv::format("redo (%d more)", int(current_drawer_.getHistory().redoDepth())), 'g', 'b') << std::endl;
 					}
+					break;
+				}
+				case '+':
+				case '=': {
+					view_.zoomAt(center, 1.25);
+					this->viewChanged();
+					break;
+				}
+				case '-': {
+					view_.zoomAt(center, 0.8);
+					this->viewChanged();
+					break;
+				}
+				case 'f': {
+					view_.fit(current_image_.size(), cv::Size(options_.viewport_width, options_.viewport_height));
+					this->viewChanged();
+					break;
 				}
-			} else {
-				it2->second = current_drawer_;
-				std::cout << " .. Updated drawer: " << utils::getBashColorText(item.name, 'g', 'b') << std::endl;
 			}
 		}
+	}
+	
+	// The innermost edge proposal under the cursor if it is ready, otherwise GrabCut around the cursor
+	void snapProposal() {
+		if (!options_.proposals) {
+			std::cout << utils::getBashColorText("[Warning] Set 'proposals: true' in the config to snap polygons", 'y', 'b') << std::endl;
+			return;
+		}
+		cv::Point2d px = view_.toImage(cv::Point2d(cursor_pt_.x, cursor_pt_.y));
+		cv::Point2f pt(float(px.x / current_image_.cols), float(px.y / current_image_.rows));
 		
-		this->savePolygons();
+		ProposalCache::Ring ring;
+		if (proposals_.find(image_list_[index_].filename, pt, ring)) {
+			std::cout << " >> Action: " << utils::getBashColorText("snap to the outline under the cursor", 'g', 'b') << std::endl;
+			current_drawer_.placeRegion(randomId(), ring);
+			return;
+		}
+		
+		status_ = "Segmenting ...";
+		dirty_ = true;
+		pending_proposals_++;
+		uint64_t seq = load_seq_;
+		proposals_.segment(current_image_, pt, [this, seq](const ProposalCache::Ring &ring) {
+			EditorCommand command;
+			command.type = EditorCommand::PROPOSAL;
+			command.load_seq = seq;
+			command.points = ring;
+			this->post(command);
+		});
 	}
 	
-	void savePolygons() {
-		if (drawer_list_.size() == 0) { return; }
+	// To the nearest match in the direction of '2'
+	void jumpTo(const AnnotationIndex::Filter &filter, const std::string &what) {
+		int next = annotation_index_.next(filter, index_, -1);
+		if (next < 0 || next == index_) {
+			std::cout << utils::getBashColorText("[Warning] No other " + what, 'y', 'b') << std::endl;
+			return;
+		}
+		std::cout << " >> Action: " << utils::getBashColorText("go to the next " + what, 'g', 'b') << std::endl;
+		this->leaveImage();
+		this->openImage(next);
+	}
+	
+	// After every edit that can change the ids of the open image
+	void indexCurrent() {
+		if (current_image_.empty()) return;
+		annotation_index_.update(index_, current_drawer_.getPolygons());
+	}
+	
+	void viewChanged() {
+		view_seq_++;
+		current_drawer_.setView(view_);
+		dirty_ = true;
+		this->requestDetail();
+	}
+	
+	// A reduced display copy shows its own pixels enlarged once the view zooms past them; from
+	// then on the full image is decoded once on the I/O pool and drawn instead, while the copy
+	// keeps the coordinates, fitting and proposals. The decode is only held until it is written
+	// out as tiles, which the detail pyramid pages in within tile_cache_mb until another image
+	// is opened. OpenCV has no region decode, so the decode itself is bounded by image_cache_mb:
+	// a larger image is decoded at the finest reduction that fits
+	void requestDetail() {
+		if (detail_requested_ || current_image_.empty() || view_.zoom() <= 1.0) return;
+		cv::Size full_size = current_drawer_.getImageSize();
+		int factor = 1;
+		while (factor < 8 && 3.0 * full_size.width * full_size.height / (factor * factor) > image_cache_.budget()) factor *= 2;
+		cv::Size size((full_size.width + factor - 1) / factor, (full_size.height + factor - 1) / factor);
+		if (size.width <= current_image_.cols && size.height <= current_image_.rows) return;
 		
-		std::cout << "\nAvailable of " << utils::getBashColorText(cv::format("%d drawer-sets", int(drawer_list_.size())), 'g', 'b') << std::endl;
-		std::map<std::string, MyPolygonDrawer>::iterator it;
-		std::stringstream ss;
-		ss << "polygons:" << std::endl;
-		for (it = drawer_list_.begin(); it != drawer_list_.end(); it++) {
-			ss << " - { name: " << it->first << ", " << it->second.getTextInfo() << "}" << std::endl;
+		detail_requested_ = true;
+		detail_loading_ = true;
+		status_ = "Loading full resolution ...";
+		uint64_t seq = load_seq_;
+		std::string filename = image_list_[index_].filename;
+		int tile_size = detail_pyramid_.tileSize();
+		std::string dir = display_cache_.enabled() ? display_cache_.dir() : results_dir_;
+		io_pool_.submit([this, seq, filename, factor, size, tile_size, dir]() {
+			EditorCommand command;
+			command.type = EditorCommand::DETAIL_READY;
+			command.load_seq = seq;
+			cv::Mat image;
+			{
+				ScopedTimer timer(profiler_, Profiler::DECODE);
+				static const int reduced_flags[4] = {cv::IMREAD_COLOR, cv::IMREAD_REDUCED_COLOR_2, cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_8};
+				image = cv::imread(filename, reduced_flags[factor == 8 ? 3 : factor / 2]);
+			}
+			// A reduced decode of a format other than JPEG may round the other way
+			if (!image.empty() && std::abs(image.cols - size.width) <= 1 && std::abs(image.rows - size.height) <= 1) {
+				command.detail = TiledImage::create(image, tile_size, dir);
+			}
+			this->post(command);
+		});
+	}
+	
+	// The image becomes editable when the I/O pool answers with IMAGE_READY
+	void openImage(int index) {
+		const LabelImageInfo &item = image_list_[index];
+		std::cout << "\n------------------------- " << std::endl;
+		std::cout << "Index: " << index << std::endl;
+		
+		index_ = index;
+		current_name_ = item.name;
+		current_image_ = cv::Mat();
+		current_drawer_ = MyPolygonDrawer();
+		detail_image_.reset();
+		detail_requested_ = false;
+		detail_loading_ = false;
+		panning_ = false;
+		status_ = "Loading " + item.name + " ...";
+		loading_ = true;
+		dirty_ = true;
+		
+		uint64_t seq = ++load_seq_;
+		std::string filename = item.filename;
+		io_pool_.submit([this, seq, filename]() {
+			EditorCommand command;
+			command.type = EditorCommand::IMAGE_READY;
+			command.load_seq = seq;
+			{
+				ScopedTimer timer(profiler_, Profiler::IMAGE);
+				command.image = image_cache_.get(filename, &command.full_size);
+			}
+			this->post(command);
+		});
+		this->prefetchNeighbors(index);
+	}
+	
+	void showImage(const cv::Mat &image, cv::Size full_size) {
+		if (image.empty()) { 
+			std::cout << " .. Error: Invalid image for " << utils::getBashColorText(current_name_, 'r', 'b') << std::endl;
+			status_ = "Invalid image " + current_name_;
+			dirty_ = true;
+			return;
 		}
-		std::cout << utils::getBashColorText(ss.str(), 'y', '0') << std::endl;
 		
-		std::ofstream writer;
-		writer.open(polygon_data_filename_);
-		writer << "appname: " << appname_ << std::endl;
-		writer << "\ndatetime: " << utils::getLocaltime(0) << std::endl;
-		writer << "\n" << ss.str();
-		writer.close();
+		MyPolygonDrawer *previous = this->findDrawer(current_name_);
+		if (previous != NULL) {
+			std::cout << "Found previous polygons: " << utils::getBashColorText(current_name_, 'g', 'b') << std::endl;
+			current_drawer_ = *previous;
+		} else {
+			std::cout << "Created a new polygon" << std::endl;
+			current_drawer_ = MyPolygonDrawer();
+		}
 		
-		std::cout << utils::getBashColorText("[Ok] Saved polygon data successfully: " + polygon_data_filename_, 'g', 'b') << std::endl;
+		// Shared with the cache, the pyramid only reads it
+		current_image_ = image;
+		current_drawer_.setImageSize((full_size.width > 0 && full_size.height > 0) ? full_size : image.size());
+		view_.fit(image.size(), cv::Size(options_.viewport_width, options_.viewport_height));
+		image_seq_++;
+		this->viewChanged();
+		status_ = "";
+		std::cout << cv::format("Cache: %d images, %.1f / %d MB", int(image_cache_.size()), 
+			image_cache_.bytesUsed() / (1024.0 * 1024.0), options_.image_cache_mb) << std::endl;
+		if (display_cache_.enabled()) {
+			std::cout << cv::format("Display cache: %d x %d of %d x %d, %d hits, %d misses", image.cols, image.rows, 
+				current_drawer_.getImageSize().width, current_drawer_.getImageSize().height, 
+				int(display_cache_.hits()), int(display_cache_.misses())) << std::endl;
+		}
 	}
 	
-private:
+	void leaveImage() {
+		if (current_image_.empty()) return;
+		
+		std::map<std::string, MyPolygonDrawer>::iterator it2 = drawer_list_.find(current_name_);
+		if (options_.autosave && current_drawer_.isModified()) {
+			if (it2 != drawer_list_.end() || current_drawer_.getPolygons().size() > 0) {
+				this->saveShard(current_name_);
+			}
+		}
+		if (it2 == drawer_list_.end()) {
+			if (current_drawer_.getPolygons().size() > 0) {
+				drawer_list_.insert(std::pair<std::string, MyPolygonDrawer>(current_name_, current_drawer_));
+				std::cout << " Added a new drawer: " << utils::getBashColorText(current_name_, 'g', 'b') << std::endl;
+				for (it2 = drawer_list_.begin(); it2 != drawer_list_.end(); it2++) {
+					std::cout << " |-- " << it2->first << ", Polygons: " << it2->second.getPolygons().size() << std::endl;
+				}
+			}
+		} else {
+			it2->second = current_drawer_;
+			std::cout << " .. Updated drawer: " << utils::getBashColorText(current_name_, 'g', 'b') << std::endl;
+		}
+	}
+	
+	void publish() {
+		FrameSnapshot *snapshot = new FrameSnapshot();
+		current_drawer_.copyWithoutHistory(snapshot->drawer);
+		current_drawer_.clearDamage();
+		snapshot->view = view_;
+		snapshot->image = current_image_;
+		snapshot->detail = detail_image_;
+		snapshot->image_seq = image_seq_;
+		snapshot->view_seq = view_seq_;
+		snapshot->name = current_name_;
+		snapshot->status = status_;
+		snapshot->show_hud = show_hud_;
+		snapshot->info.input_seq = input_seq_;
+		snapshot->info.idle = !loading_ && !detail_loading_ && pending_proposals_ == 0;
+		dirty_ = false;
+		
+		// A snapshot the render thread has not taken yet is replaced, its damage carries over
+		FrameSnapshot *pending = snapshot_.exchange(NULL);
+		if (pending != NULL) {
+			snapshot->drawer.mergeDamage(pending->drawer);
+			delete pending;
+		}
+		snapshot_.store(snapshot);
+		render_cond_.notify_one();
+	}
+	
+	void renderLoop() {
+		profiler_.nameThread("render");
+		while (!quit_) {
+			std::unique_ptr<FrameSnapshot> snapshot(snapshot_.exchange(NULL));
+			if (!snapshot) {
+				// Only the HUD changes without a new snapshot, 4 times a second
+				if (render_show_hud_ && Profiler::now() >= hud_refresh_ns_) {
+					this->present();
+				} else {
+					std::unique_lock<std::mutex> lock(render_mutex_);
+					render_cond_.wait_for(lock, std::chrono::milliseconds(5));
+				}
+				continue;
+			}
+			
+			render_status_ = snapshot->status;
+			render_show_hud_ = snapshot->show_hud;
+			render_info_ = snapshot->info;
+			if (!snapshot->image.empty()) {
+				// 'base_' holds the visible tiles and is only recomposed when the view moves;
+				// in between, the drawer repaints only what changed since the last frame
+				if (snapshot->image_seq != rendered_image_seq_ || snapshot->view_seq != rendered_view_seq_) {
+					ScopedTimer timer(profiler_, Profiler::COMPOSE);
+					if (snapshot->image_seq != rendered_image_seq_) {
+						pyramid_.setImage(snapshot->image);
+						detail_pyramid_.setImage(snapshot->detail);
+						render_labels_.clear();
+					}
+					if (snapshot->detail && snapshot->view.zoom() > 1.0) {
+						// Past the scale of the display copy, from the full image; the view stays in copy pixels
+						cv::Size detail_size = snapshot->detail->size();
+						cv::Point2d scale(double(detail_size.width) / snapshot->image.cols, double(detail_size.height) / snapshot->image.rows);
+						detail_pyramid_.render(snapshot->view, base_, scale);
+					} else {
+						pyramid_.render(snapshot->view, base_);
+					}
+					// Size and zoom of the source image, not of its display copy
+					cv::Size full_size = snapshot->drawer.getImageSize();
+					double zoom = snapshot->view.zoom() * snapshot->image.cols / std::max(full_size.width, 1);
+					this->drawImageHeader(base_, snapshot->name, full_size, zoom);
+					snapshot->drawer.invalidate();
+					rendered_image_seq_ = snapshot->image_seq;
+					rendered_view_seq_ = snapshot->view_seq;
+				}
+				ScopedTimer timer(profiler_, Profiler::DRAW);
+				snapshot->drawer.useLabelCache(&render_labels_);
+				snapshot->drawer.render(base_, frame_);
+			}
+			this->present();
+		}
+	}
+	
+	// Hands a finished copy to the UI thread, replacing one it has not shown yet
+	void present() {
+		DisplayFrame *display = new DisplayFrame();
+		display->info = render_info_;
+		cv::Mat &image = display->image;
+		if (frame_.empty()) {
+			image = cv::Mat(480, 640, CV_8UC3, cv::Scalar(0, 0, 0));
+		} else {
+			frame_.copyTo(image);
+		}
+		if (!render_status_.empty()) {
+			cv::putText(image, render_status_, cv::Point(10, image.rows - 15), cv::FONT_HERSHEY_SIMPLEX, 0.6, cv::Scalar(0, 255, 255), 2);
+		}
+		if (render_show_hud_) {
+			this->drawHud(image);
+			hud_refresh_ns_ = Profiler::now() + 250000000;
+		}
+		delete display_.exchange(display);
+	}
+	
+	void consoleLoop() {
+		while (!quit_) {
+			int request;
+			if (!prompts_.pop(request)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				continue;
+			}
+			EditorCommand command;
+			if (request == 'l') {
+				command.type = EditorCommand::FIND;
+				this->readLabel(command.name);
+				command.input_seq = input_.eventSeq();
+				this->post(command);
+				continue;
+			}
+			command.type = EditorCommand::RENAME;
+			bool ok = this->readToken("Enter a region id: ", command.id);
+			if (ok) this->acknowledgeInput();
+			if (!ok || !this->readToken("Enter a new name (spacebar is not allowed !!!) : ", command.name)) {
+				command.id.clear();
+			}
+			command.input_seq = input_.eventSeq();
+			this->post(command);
+		}
+	}
+	
+	// First word of the next non-empty line; the input source gives up once quitting is requested
+	bool readToken(const std::string &prompt, std::string &token) {
+		std::cout << prompt << std::flush;
+		std::string line;
+		while (input_.readLine(line, quit_requested_)) {
+			std::stringstream ss(line);
+			if (ss >> token) return true;
+			this->acknowledgeInput();
+		}
+		return false;
+	}
+	
+	// An empty line is an answer too, it repeats the previous label
+	void readLabel(std::string &label) {
+		std::cout << "Enter a label to go to (empty for the previous one): " << std::flush;
+		std::string line;
+		label.clear();
+		if (input_.readLine(line, quit_requested_)) {
+			std::stringstream ss(line);
+			ss >> label;
+		}
+	}
+	
+	// A line that does not complete the prompt changes nothing, but a replay still waits for its frame
+	void acknowledgeInput() {
+		if (!input_.waitsForFrames()) return;
+		EditorCommand command;
+		command.input_seq = input_.eventSeq();
+		this->post(command);
+	}
 	
 	std::string randomId() {
-		int idx = int(rand() % 100);
-		int idy = int(rand() % 100);
+		std::uniform_int_distribution<int> digits(0, 99);
+		int idx = digits(id_rng_);
+		int idy = digits(id_rng_);
 		std::string idx_str = std::to_string(idx);
 		std::string idy_str = std::to_string(idy);
 		if (idx_str.size() == 1) { idx_str = "0" + idx_str; }
@@ -252,11 +979,11 @@ private:
 		return idx_str + idy_str;
 	}
 	
-	void drawImageHeader(cv::Mat &image, std::string name) {
+	void drawImageHeader(cv::Mat &image, std::string name, cv::Size size, double zoom) {
 		std::vector<std::string> texts;
 		texts.push_back(utils::getLocaltime(1));
 		texts.push_back(cv::format("File: %s", name.c_str()));
-		texts.push_back(cv::format("Size: %d x %d", image.cols, image.rows));
+		texts.push_back(cv::format("Size: %d x %d, zoom %.2f", size.width, size.height, zoom));
 		
 		int fontface = cv::FONT_HERSHEY_SIMPLEX;
 		double fontscale = 0.5;
@@ -268,35 +995,411 @@ private:
 		}
 	}
 	
-	bool setImageList(std::string dir) {
-		boost::filesystem::path path(dir);
-		boost::filesystem::recursive_directory_iterator it_end;
-		for (boost::filesystem::recursive_directory_iterator it(path); it != it_end; it++) {
-			const boost::filesystem::path full_path = (*it);
-			std::string filename = full_path.string();
+	void drawHud(cv::Mat &image) {
+		// Below the header lines of drawImageHeader
+		const int stages[] = {Profiler::INPUT, Profiler::FRAME, Profiler::WAITKEY, Profiler::IMSHOW, Profiler::DRAW, Profiler::COMPOSE,
+			Profiler::IMAGE, Profiler::DECODE, Profiler::PREFETCH, Profiler::AUTOSAVE};
+		std::vector<std::string> texts;
+		texts.push_back("stage: last / p50 / p99 ms");
+		for (size_t i=0; i<sizeof(stages) / sizeof(stages[0]); i++) {
+			Profiler::Summary summary = profiler_.summary(stages[i]);
+			if (summary.count == 0) continue;
+			texts.push_back(cv::format("%s: %.2f / %.2f / %.2f", Profiler::stageName(stages[i]), summary.last_ms, summary.p50_ms, summary.p99_ms));
+		}
+		
+		int fontface = cv::FONT_HERSHEY_SIMPLEX;
+		double fontscale = 0.45;
+		int thickness = 1;
+		cv::Rect box = cv::Rect(5, 115, 260, 20 * int(texts.size()) + 8) & cv::Rect(0, 0, image.cols, image.rows);
+		if (box.area() > 0) {
+			image(box).setTo(cv::Scalar(32, 32, 32));
+		}
+		for (int i=0; i<texts.size(); i++) {
+			cv::putText(image, texts[i], cv::Point(10, 130 + 20 * i), fontface, fontscale, cv::Scalar(0, 255, 255), thickness);
+		}
+	}
+	
+	void writeProfile() {
+		if (!profiler_.enabled()) return;
+		
+		std::cout << "\nStage timings (ms):" << std::endl;
+		for (int stage=0; stage<Profiler::NUM_STAGES; stage++) {
+			Profiler::Summary summary = profiler_.summary(stage);
+			if (summary.count == 0) continue;
+			std::cout << cv::format(" |-- %-9s n: %-7d mean: %8.3f  p50: %8.3f  p99: %8.3f  max: %8.3f", Profiler::stageName(stage),
+				int(summary.count), summary.mean_ms, summary.p50_ms, summary.p99_ms, summary.max_ms) << std::endl;
+		}
+		if (profiler_.writeTrace(trace_filename_)) {
+			std::cout << utils::getBashColorText("[Ok] Saved trace (chrome://tracing): " + trace_filename_, 'g', 'b') << std::endl;
+		} else {
+			std::cout << utils::getBashColorText("[Warning] Failed to save trace: " + trace_filename_, 'y', 'b') << std::endl;
+		}
+	}
+	
+	MyPolygonDrawer* findDrawer(const std::string &name) {
+		std::map<std::string, MyPolygonDrawer>::iterator it = drawer_list_.find(name);
+		if (it != drawer_list_.end()) {
+			return &it->second;
+		}
+		int index = binary_.isOpen() ? binary_.find(name) : -1;
+		if (index < 0) {
+			return NULL;
+		}
+		MyPolygonDrawer &drawer = drawer_list_[name];
+		binary_.loadDrawer(index, drawer);
+		return &drawer;
+	}
+	
+	bool isBinaryCurrent(const std::string &yaml_file) {
+		// To the nanosecond, so that a hand edit of the YAML in the second the .bin was written still counts
+		struct stat binary_stat, yaml_stat;
+		if (stat(binary_filename_.c_str(), &binary_stat) != 0) return false;
+		if (stat(yaml_file.c_str(), &yaml_stat) != 0) return true;
+		if (binary_stat.st_mtim.tv_sec != yaml_stat.st_mtim.tv_sec) {
+			return binary_stat.st_mtim.tv_sec > yaml_stat.st_mtim.tv_sec;
+		}
+		return binary_stat.st_mtim.tv_nsec >= yaml_stat.st_mtim.tv_nsec;
+	}
+	
+	void prefetchNeighbors(int index) {
+		// Nearest neighbors first, alternating between the '1' and '2' directions
+		std::vector<std::string> filenames;
+		int n = int(image_list_.size());
+		for (int k=1; k<=options_.prefetch_radius && k < n; k++) {
+			filenames.push_back(image_list_[(index + k) % n].filename);
+			filenames.push_back(image_list_[(n + (index - k) % n) % n].filename);
+		}
+		image_cache_.prefetch(filenames);
+		
+		// Edge proposals for the image being opened first, then for the same neighbors
+		if (options_.proposals) {
+			filenames.insert(filenames.begin(), image_list_[index].filename);
+			proposals_.prepare(filenames);
+		}
+	}
+	
+	void startWatcher(const std::string &dir) {
+		watcher_.reset(new DirectoryWatcher(dir, [this](std::shared_ptr<DirectoryWatcher::Batch> batch) {
+			EditorCommand command;
+			command.type = EditorCommand::SOURCE_CHANGED;
+			command.changes = batch;
+			this->post(command);
+		}, options_.watch_debounce_ms, 4 * options_.watch_debounce_ms, options_.probe_image_size));
+		if (watcher_->start()) {
+			std::cout << utils::getBashColorText("[Ok] Watching " + dir + " for new images", 'g', 'b') << std::endl;
+		} else {
+			watcher_.reset();
+		}
+	}
+	
+	bool ownsImage(const std::string &name) {
+		return options_.worker_count <= 1 || annotation_io::workerOf(name, options_.worker_count) == options_.worker_index;
+	}
+	
+	// One batch of the watcher at a time: the list stays sorted by name as after the scan, the open
+	// image keeps its place and the annotations follow renamed images. The changes are collected by
+	// name and merged into the sorted list in one pass, O(n + k log n) for k changes. The label index
+	// is keyed by list position, so every batch also rebuilds it, O(n) over the drawers.
+	void applySourceChanges(const DirectoryWatcher::Batch &batch) {
+		int64 t0 = cv::getTickCount();
+		std::vector<LabelImageInfo> scanned;
+		if (batch.rescanned) {
+			scanned.reserve(batch.images.size());
+			for (size_t i=0; i<batch.images.size(); i++) {
+				if (this->ownsImage(batch.images[i].name)) scanned.push_back(batch.images[i]);
+			}
+		}
+		const std::vector<LabelImageInfo> &base = batch.rescanned ? scanned : image_list_;
+		
+		// Name -> the image after the batch, false for one that is gone
+		typedef std::map<std::string, std::pair<bool, LabelImageInfo> > ChangeMap;
+		ChangeMap changed;
+		auto find = [&](const std::string &name) -> const LabelImageInfo* {
+			ChangeMap::iterator it = changed.find(name);
+			if (it != changed.end()) return it->second.first ? &it->second.second : NULL;
+			std::vector<LabelImageInfo>::const_iterator pos = std::lower_bound(base.begin(), base.end(), name, 
+				[](const LabelImageInfo &item, const std::string &name) { return item.name < name; });
+			return (pos != base.end() && pos->name == name) ? &*pos : NULL;
+		};
+		auto below = [&](const std::string &dir) {
+			std::string prefix = dir + "/";
+			std::vector<std::string> names;
+			std::vector<LabelImageInfo>::const_iterator pos = std::lower_bound(base.begin(), base.end(), prefix, 
+				[](const LabelImageInfo &item, const std::string &name) { return item.name < name; });
+			for (; pos != base.end() && pos->name.compare(0, prefix.size(), prefix) == 0; pos++) {
+				names.push_back(pos->name);
+			}
+			for (ChangeMap::iterator it = changed.lower_bound(prefix); it != changed.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++) {
+				names.push_back(it->first);
+			}
+			std::sort(names.begin(), names.end());
+			names.erase(std::unique(names.begin(), names.end()), names.end());
+			return names;
+		};
+		
+		int added = 0, removed = 0, renamed = 0;
+		if (batch.rescanned) {
+			// The scan is the new list; only the annotations still have to follow the renames
+			renamed = this->followRenames(batch.changes);
+		}
+		for (size_t i=0; !batch.rescanned && i<batch.changes.size(); i++) {
+			const DirectoryWatcher::Change &change = batch.changes[i];
+			if (change.type == DirectoryWatcher::Change::ADDED) {
+				if (!this->ownsImage(change.name)) continue;
+				const LabelImageInfo *existing = find(change.name);
+				if (existing == NULL) {
+					added++;
+				} else {
+					// Written again, the decoded pixels are stale
+					image_cache_.erase(existing->filename);
+				}
+				changed[change.name] = std::make_pair(true, change.info);
+				continue;
+			}
 			
-			std::size_t found = filename.find(dir);
-			if (found != std::string::npos) {
-				std::string image_name = filename.substr(int(found) + dir.size() + 1, filename.size() - dir.size() - 1);
-				LabelImageInfo info;
-				info.name = image_name;
-				info.filename = filename;
-				info.image = cv::imread(filename, cv::IMREAD_COLOR);
-				image_list_.push_back(info);
+			// The image itself, or everything below a directory
+			bool is_rename = (change.type == DirectoryWatcher::Change::RENAMED);
+			std::string key = is_rename ? change.from : change.name;
+			std::vector<LabelImageInfo> affected;
+			std::vector<std::string> names = change.is_dir ? below(key) : std::vector<std::string>(1, key);
+			for (size_t k=0; k<names.size(); k++) {
+				const LabelImageInfo *info = find(names[k]);
+				if (info == NULL) continue;
+				affected.push_back(*info);
+				changed[names[k]] = std::make_pair(false, LabelImageInfo());
+			}
+			if (!is_rename) {
+				removed += int(affected.size());
+				continue;
+			}
+			if (!change.is_dir) {
+				// Also when the old name was not listed, e.g. of another worker, its annotations move along
+				this->renameAnnotations(change.from, change.name);
+				if (this->ownsImage(change.name)) changed[change.name] = std::make_pair(true, change.info);
+				renamed++;
+				continue;
+			}
+			for (size_t k=0; k<affected.size(); k++) {
+				LabelImageInfo info = affected[k];
+				std::string name = change.name + info.name.substr(key.size());
+				this->renameAnnotations(info.name, name);
+				info.filename = info.filename.substr(0, info.filename.size() - info.name.size()) + name;
+				info.name = name;
+				if (this->ownsImage(name)) changed[name] = std::make_pair(true, info);
+				renamed++;
 			}
 		}
 		
-		return (int)image_list_.size() > 0;
+		// Both are sorted by name; a changed name replaces or drops its entry in the list
+		std::vector<LabelImageInfo> images;
+		images.reserve(base.size() + changed.size());
+		size_t next = 0;
+		for (ChangeMap::iterator it = changed.begin(); it != changed.end(); it++) {
+			while (next < base.size() && base[next].name < it->first) {
+				images.push_back(base[next++]);
+			}
+			if (next < base.size() && base[next].name == it->first) next++;
+			if (it->second.first) images.push_back(it->second.second);
+		}
+		images.insert(images.end(), base.begin() + next, base.end());
+		
+		if (images.empty()) {
+			std::cout << utils::getBashColorText("[Warning] No images left in the source directory, the list is kept", 'y', 'b') << std::endl;
+			return;
+		}
+		image_list_.swap(images);
+		
+		std::vector<LabelImageInfo>::iterator pos = std::lower_bound(image_list_.begin(), image_list_.end(), current_name_, 
+			[](const LabelImageInfo &item, const std::string &name) { return item.name < name; });
+		int position = int(pos - image_list_.begin());
+		bool current_gone = (pos == image_list_.end() || pos->name != current_name_);
+		double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+		std::cout << utils::getBashColorText(cv::format("[Ok] Source directory changed: %d added, %d removed, %d renamed%s, %d images (%.1f ms)", 
+			added, removed, renamed, batch.rescanned ? ", scanned again" : "", int(image_list_.size()), elapsed_ms), 'g', 'b') << std::endl;
+		
+		if (current_gone) {
+			// Its annotations are kept, under its name
+			std::cout << utils::getBashColorText("[Warning] The open image left the source directory: " + current_name_, 'y', 'b') << std::endl;
+			this->leaveImage();
+			this->buildIndex();
+			this->openImage(std::min(position, int(image_list_.size()) - 1));
+		} else {
+			index_ = position;
+			this->buildIndex();
+		}
 	}
 	
-	MyPolygonDrawer current_drawer_;
-	bool is_ok_;
+	// Renames of a batch whose other events were lost, against the names listed before it
+	int followRenames(const std::vector<DirectoryWatcher::Change> &changes) {
+		std::set<std::string> names;
+		for (size_t i=0; i<image_list_.size(); i++) {
+			names.insert(image_list_[i].name);
+		}
+		int renamed = 0;
+		for (size_t i=0; i<changes.size(); i++) {
+			const DirectoryWatcher::Change &change = changes[i];
+			if (change.type != DirectoryWatcher::Change::RENAMED) continue;
+			std::vector<std::string> moved;
+			if (change.is_dir) {
+				std::string prefix = change.from + "/";
+				std::set<std::string>::iterator it = names.lower_bound(prefix);
+				for (; it != names.end() && it->compare(0, prefix.size(), prefix) == 0; it++) {
+					moved.push_back(*it);
+				}
+			} else {
+				moved.push_back(change.from);
+			}
+			for (size_t k=0; k<moved.size(); k++) {
+				std::string name = change.name + moved[k].substr(change.from.size());
+				this->renameAnnotations(moved[k], name);
+				names.erase(moved[k]);
+				names.insert(name);
+				renamed++;
+			}
+		}
+		return renamed;
+	}
+	
+	void renameAnnotations(const std::string &from, const std::string &to) {
+		MyPolygonDrawer *existing = this->findDrawer(to);
+		if (existing != NULL && existing->getPolygons().size() > 0) {
+			std::cout << utils::getBashColorText("[Warning] Both " + from + " and " + to + " have annotations, they are kept apart", 'y', 'b') << std::endl;
+			return;
+		}
+		if (from == current_name_) {
+			// The open drawer is stored under the new name when leaving
+			current_name_ = to;
+			if (!current_image_.empty()) this->viewChanged();
+		}
+		MyPolygonDrawer *drawer = this->findDrawer(from);
+		if (drawer == NULL) return;
+		drawer_list_[to] = *drawer;
+		// An empty entry keeps the copy in the mapped file from coming back under the old name;
+		// it is dropped again when saving
+		if (binary_.isOpen() && binary_.find(from) >= 0) {
+			*drawer = MyPolygonDrawer();
+			renamed_from_.insert(from);
+		} else {
+			drawer_list_.erase(from);
+		}
+		this->moveShard(from, to);
+		std::cout << " .. Moved annotations: " << utils::getBashColorText(from + " -> " + to, 'g', 'b') << std::endl;
+	}
 	
+	// An autosaved shard under the old name would bring the annotations back there after
+	// a crash; it is written again under the new name, on the I/O pool like the autosave
+	void moveShard(const std::string &from, const std::string &to) {
+		io_pool_.submit([this, from, to]() {
+			std::lock_guard<std::mutex> lock(shard_mutex_);
+			std::string filename = annotation_io::shardPath(shard_dir_, from);
+			boost::system::error_code ec;
+			if (!boost::filesystem::exists(filename, ec)) return;
+			DrawerMap shard;
+			if (annotation_io::loadYaml(filename, shard) && shard.count(from) > 0) {
+				if (!annotation_io::saveShard(shard_dir_, appname_, to, shard[from])) {
+					std::cout << utils::getBashColorText("[Error] Failed to move the autosaved shard of " + from, 'r', 'b') << std::endl;
+					return;
+				}
+			}
+			boost::filesystem::remove(filename, ec);
+		});
+	}
+	
+	bool setImageList(std::string dir) {
+		ImageScanner scanner(options_.scan_threads, options_.probe_image_size);
+		if (!scanner.scan(dir, image_list_)) {
+			return false;
+		}
+		
+		std::cout << utils::getBashColorText(cv::format("[Ok] Indexed %d images in %.1f ms (%d threads)", 
+			int(image_list_.size()), scanner.lastScanMs(), scanner.threads()), 'g', 'b') << std::endl;
+		
+		if (options_.worker_count > 1) {
+			std::vector<LabelImageInfo> own;
+			for (size_t i=0; i<image_list_.size(); i++) {
+				if (annotation_io::workerOf(image_list_[i].name, options_.worker_count) == options_.worker_index) {
+					own.push_back(image_list_[i]);
+				}
+			}
+			std::cout << utils::getBashColorText(cv::format("[Ok] Worker %d/%d annotates %d of them", 
+				options_.worker_index, options_.worker_count, int(own.size())), 'g', 'b') << std::endl;
+			image_list_.swap(own);
+		}
+		return !image_list_.empty();
+	}
+	
+	bool is_ok_;
 	std::map<std::string, MyPolygonDrawer> drawer_list_;
+	std::set<std::string> renamed_from_;    // empty in drawer_list_ only to hide the mapped copy
 	std::vector<LabelImageInfo> image_list_;
 	std::string appname_;
+	InputSource &input_;
 	std::string results_dir_;
 	std::string polygon_data_filename_;
+	std::string binary_filename_;
+	std::string shard_dir_;
+	std::string trace_filename_;
+	std::string worker_filename_;   // empty unless started with --worker
+	EditorOptions options_;
+	Profiler profiler_;     // declared before the cache, whose worker records into it
+	DisplayCache display_cache_;
+	ImageCache image_cache_;
+	ThreadPool io_pool_;    // decoding and autosave; declared after what its tasks use
+	std::mutex shard_mutex_;
+	
+	// Between the threads
+	BoundedQueue<EditorCommand> commands_;    // UI, console and I/O pool -> model
+	BoundedQueue<int> prompts_;               // model -> console
+	std::atomic<FrameSnapshot*> snapshot_;    // model -> render, latest only
+	std::atomic<DisplayFrame*> display_;      // render -> UI, latest only
+	std::atomic<bool> quit_;                  // set by the model once everything is saved
+	std::atomic<bool> quit_requested_;
+	std::mutex model_mutex_;
+	std::condition_variable model_cond_;
+	std::mutex render_mutex_;
+	std::condition_variable render_cond_;
+	ProposalCache proposals_;                 // answers GrabCut requests through commands_, declared after it
+	std::unique_ptr<DirectoryWatcher> watcher_;   // posts SOURCE_CHANGED to commands_, likewise
+	
+	// Model thread
+	MyPolygonDrawer current_drawer_;
+	std::mt19937 id_rng_;   // ids and vertices of new regions, apart from the drawer colours
+	AnnotationBinary binary_;
+	cv::Mat current_image_;   // empty while loading
+	std::string current_name_;
+	int index_;
+	AnnotationIndex annotation_index_;  // over image_list_, the open image included
+	std::string find_label_;            // of the last 'l'
+	uint64_t image_seq_;
+	uint64_t view_seq_;
+	uint64_t load_seq_;
+	uint64_t input_seq_;    // of the latest event applied
+	bool loading_;          // the current image is being decoded
+	std::shared_ptr<TiledImage> detail_image_;  // see requestDetail()
+	bool detail_requested_;
+	bool detail_loading_;
+	int pending_proposals_; // GrabCut requests not answered yet
+	Viewport view_;
+	bool panning_;      // right button held
+	cv::Point pan_pt_;
+	cv::Point cursor_pt_;   // last mouse position in the window, the seed for 's'
+	bool show_hud_;
+	bool prompt_pending_;
+	bool dirty_;        // something other than the polygons changed since the last snapshot
+	std::string status_;
+	
+	// Render thread
+	TilePyramid pyramid_;
+	TilePyramid detail_pyramid_;
+	cv::Mat base_;
+	cv::Mat frame_;
+	MyPolygonDrawer::LabelCache render_labels_;   // outlives the snapshots, whose drawers come without sprites
+	uint64_t rendered_image_seq_;
+	uint64_t rendered_view_seq_;
+	std::string render_status_;
+	bool render_show_hud_;
+	FrameInfo render_info_;
+	int64_t hud_refresh_ns_;
 };
 
 int main(int argc, char **argv) {
@@ -313,13 +1416,72 @@ int main(int argc, char **argv) {
 	std::string source_image_dir = node["source_image_dir"].as<std::string>();
 	std::string results_dir = node["results_dir"].as<std::string>();
 	
+	EditorOptions options;
+	if (node["image_cache_mb"]) { options.image_cache_mb = node["image_cache_mb"].as<int>(); }
+	if (node["prefetch_radius"]) { options.prefetch_radius = node["prefetch_radius"].as<int>(); }
+	if (node["scan_threads"]) { options.scan_threads = node["scan_threads"].as<int>(); }
+	if (node["probe_image_size"]) { options.probe_image_size = node["probe_image_size"].as<bool>(); }
+	if (node["autosave"]) { options.autosave = node["autosave"].as<bool>(); }
+	if (node["viewport_width"]) { options.viewport_width = node["viewport_width"].as<int>(); }
+	if (node["viewport_height"]) { options.viewport_height = node["viewport_height"].as<int>(); }
+	if (node["tile_size"]) { options.tile_size = node["tile_size"].as<int>(); }
+	if (node["tile_cache_mb"]) { options.tile_cache_mb = node["tile_cache_mb"].as<int>(); }
+	if (node["profile"]) { options.profile = node["profile"].as<bool>(); }
+	if (node["show_hud"]) { options.show_hud = node["show_hud"].as<bool>(); }
+	if (node["proposals"]) { options.proposals = node["proposals"].as<bool>(); }
+	if (node["proposal_threads"]) { options.proposal_threads = node["proposal_threads"].as<int>(); }
+	if (node["display_cache"]) { options.display_cache = node["display_cache"].as<bool>(); }
+	if (node["display_cache_dir"]) { options.display_cache_dir = node["display_cache_dir"].as<std::string>(); }
+	if (node["watch_source_dir"]) { options.watch_source_dir = node["watch_source_dir"].as<bool>(); }
+	if (node["watch_debounce_ms"]) { options.watch_debounce_ms = node["watch_debounce_ms"].as<int>(); }
+	
+	// --worker k/n, per process since the config file is shared
+	// --replay <event log> [--report <file>] runs without a window, --record <event log> writes one
+	std::string replay_file, record_file;
+	std::string report_file = results_dir + "/replay_report.json";
+	for (int i=1; i+1<argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--replay") replay_file = argv[i + 1];
+		if (arg == "--report") report_file = argv[i + 1];
+		if (arg == "--record") record_file = argv[i + 1];
+		if (arg != "--worker") continue;
+		if (sscanf(argv[i + 1], "%d/%d", &options.worker_index, &options.worker_count) != 2 
+			|| options.worker_count < 1 || options.worker_index < 0 || options.worker_index >= options.worker_count) {
+			std::cout << utils::getBashColorText("[Error] --worker expects k/n with 0 <= k < n", 'r', 'b') << std::endl;
+			return -1;
+		}
+	}
+	
 	std::cout << " -- Source image : " << utils::getBashColorText(source_image_dir, 'l', 'b') << std::endl;
 	std::cout << " -- Results      : " << utils::getBashColorText(results_dir, 'l', 'b') << std::endl;
+	if (options.worker_count > 1) {
+		std::cout << " -- Worker       : " << utils::getBashColorText(cv::format("%d of %d", options.worker_index, options.worker_count), 'l', 'b') << std::endl;
+	}
 	
 	checkResultDir(results_dir);
 	
-	ImageEditor editor(source_image_dir, results_dir, argv[0]);
+	std::unique_ptr<InputSource> input;
+	ReplayInput *replay = NULL;
+	if (!replay_file.empty()) {
+		replay = new ReplayInput();
+		input.reset(replay);
+		// Files arriving meanwhile would make the result depend on timing
+		options.watch_source_dir = false;
+		if (!replay->load(replay_file)) {
+			return -1;
+		}
+		std::cout << " -- Replay       : " << utils::getBashColorText(cv::format("%d events from ", int(replay->events().size())) + replay_file, 'l', 'b') << std::endl;
+	} else {
+		input.reset(new HighGuiInput(argv[0], record_file));
+	}
+	
+	ImageEditor editor(source_image_dir, results_dir, argv[0], *input, options);
 	editor.run();
 	
+	if (replay != NULL) {
+		// Nonzero when an event never got its frame, for scripted runs
+		bool saved = editor.writeReplayReport(*replay, report_file);
+		return (saved && replay->timeouts() == 0) ? 0 : 1;
+	}
 	return 0;
 }
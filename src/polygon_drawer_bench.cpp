@@ -0,0 +1,398 @@
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+
+#include <yaml-cpp/yaml.h>
+#include <boost/filesystem.hpp>
+#include <polygon_drawer/editor.h>
+#include <polygon_drawer/annotation_io.h>
+#include <polygon_drawer/annotation_binary.h>
+#include <polygon_drawer/image_scanner.h>
+
+#include "utils.h"
+
+// Repeatable benchmarks of the editor hot paths on a synthetic dataset.
+// The same seed and sizes always produce the same images and polygons, so
+// two JSON reports can be compared across commits or machines.
+
+const std::string APPNAME = "polygon_drawer_bench";
+
+// Set by CMake; numbers from an unoptimized build are not comparable
+#ifndef POLYGON_DRAWER_BUILD_TYPE
+#define POLYGON_DRAWER_BUILD_TYPE "unknown"
+#endif
+
+const char *LABELS[] = {"car", "person", "tree", "building", "road", "sign"};
+
+struct BenchConfig {
+	int images;
+	int polygons;       // per image
+	int vertices;       // per polygon
+	cv::Size image_size;
+	int images_per_dir;
+	int repeat;         // samples of the heavy benchmarks, the per-call ones take 20x more
+	int threads;        // directory scan, 0 uses every core
+	unsigned seed;
+	
+	BenchConfig()
+		: images(1000)
+		, polygons(20)
+		, vertices(8)
+		, image_size(640, 480)
+		, images_per_dir(250)
+		, repeat(30)
+		, threads(0)
+		, seed(1)
+	{}
+};
+
+struct BenchResult {
+	std::string name;
+	std::string unit;
+	std::vector<double> samples;
+};
+
+void printUsage(const char *program) {
+	std::cout << "Usage: " << program << " <command> [args]" << std::endl;
+	std::cout << "  generate <dir> [--images n] [--polygons n] [--vertices n] [--size WxH] [--per-dir n] [--seed n]" << std::endl;
+	std::cout << "                             write an image tree to <dir>/images and its annotations to <dir>/results" << std::endl;
+	std::cout << "  run [--data dir] [--output file.json] [--baseline file.json] [--filter name] [--repeat n] [--threads n]" << std::endl;
+	std::cout << "                             run the benchmarks, generating a dataset in ./bench_data unless --data is given" << std::endl;
+}
+
+// Splits "--key value" pairs from positional arguments
+bool parseOptions(const std::vector<std::string> &args, std::vector<std::string> &positional, std::map<std::string, std::string> &options) {
+	for (size_t i=0; i<args.size(); i++) {
+		if (args[i].compare(0, 2, "--") == 0) {
+			if (i + 1 >= args.size()) {
+				std::cout << utils::getBashColorText("[Error] Missing value for " + args[i], 'r', 'b') << std::endl;
+				return false;
+			}
+			options[args[i].substr(2)] = args[i + 1];
+			i++;
+		} else {
+			positional.push_back(args[i]);
+		}
+	}
+	return true;
+}
+
+std::string option(const std::map<std::string, std::string> &options, const std::string &key, const std::string &fallback) {
+	std::map<std::string, std::string>::const_iterator it = options.find(key);
+	return (it != options.end()) ? it->second : fallback;
+}
+
+bool parseConfig(const std::map<std::string, std::string> &options, BenchConfig &config) {
+	config.images = std::atoi(option(options, "images", std::to_string(config.images)).c_str());
+	config.polygons = std::atoi(option(options, "polygons", std::to_string(config.polygons)).c_str());
+	config.vertices = std::atoi(option(options, "vertices", std::to_string(config.vertices)).c_str());
+	config.images_per_dir = std::atoi(option(options, "per-dir", std::to_string(config.images_per_dir)).c_str());
+	config.repeat = std::atoi(option(options, "repeat", std::to_string(config.repeat)).c_str());
+	config.threads = std::atoi(option(options, "threads", std::to_string(config.threads)).c_str());
+	config.seed = unsigned(std::atoi(option(options, "seed", std::to_string(config.seed)).c_str()));
+	if (options.count("size") > 0 && std::sscanf(options.at("size").c_str(), "%dx%d", &config.image_size.width, &config.image_size.height) != 2) {
+		std::cout << utils::getBashColorText("[Error] --size expects WxH, e.g. 640x480", 'r', 'b') << std::endl;
+		return false;
+	}
+	if (config.images <= 0 || config.polygons < 0 || config.vertices < 3 || config.images_per_dir <= 0 || config.repeat <= 0
+		|| config.image_size.width <= 0 || config.image_size.height <= 0) {
+		std::cout << utils::getBashColorText("[Error] Invalid benchmark size", 'r', 'b') << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Star-shaped polygon around a random center: sorted angles keep it simple
+void randomPolygon(std::mt19937 &rng, int n, std::vector<cv::Point2f> &points) {
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	float cx = 0.1f + 0.8f * unit(rng);
+	float cy = 0.1f + 0.8f * unit(rng);
+	float radius = 0.02f + 0.08f * unit(rng);
+	
+	std::vector<float> angles(n);
+	for (int k=0; k<n; k++) {
+		angles[k] = float(2.0 * CV_PI) * unit(rng);
+	}
+	std::sort(angles.begin(), angles.end());
+	
+	points.resize(n);
+	for (int k=0; k<n; k++) {
+		float r = radius * (0.5f + 0.5f * unit(rng));
+		points[k] = cv::Point2f(cx + r * std::cos(angles[k]), cy + r * std::sin(angles[k]));
+	}
+}
+
+void generateDrawer(std::mt19937 &rng, const BenchConfig &config, MyPolygonDrawer &drawer) {
+	drawer.setImageSize(config.image_size);
+	drawer.reserve(config.polygons, size_t(config.polygons) * config.vertices);
+	std::vector<cv::Point2f> points;
+	int n_labels = int(sizeof(LABELS) / sizeof(LABELS[0]));
+	for (int i=0; i<config.polygons; i++) {
+		randomPolygon(rng, config.vertices, points);
+		std::string id = cv::format("%s_%d", LABELS[i % n_labels], i / n_labels + 1);
+		drawer.addRegion(id, points.data(), points.size());
+	}
+	drawer.clearModified();
+}
+
+std::string imageName(const BenchConfig &config, int i) {
+	return cv::format("d%03d/img_%06d.jpg", i / config.images_per_dir, i);
+}
+
+int generate(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	BenchConfig config;
+	if (!parseOptions(args, positional, options) || !parseConfig(options, config)) return -1;
+	if (positional.size() != 1) {
+		std::cout << utils::getBashColorText("[Error] generate expects <dir>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	std::string image_dir = positional[0] + "/images";
+	std::string results_dir = positional[0] + "/results";
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(results_dir, ec);
+	
+	int64 t0 = cv::getTickCount();
+	std::mt19937 rng(config.seed);
+	std::uniform_int_distribution<int> shade(0, 255);
+	DrawerMap drawers;
+	for (int i=0; i<config.images; i++) {
+		std::string name = imageName(config, i);
+		std::string filename = image_dir + "/" + name;
+		if (i % config.images_per_dir == 0) {
+			boost::filesystem::create_directories(boost::filesystem::path(filename).parent_path(), ec);
+		}
+		// Flat images: the scan only reads the headers and the benchmarks never decode them
+		int b = shade(rng), g = shade(rng), r = shade(rng);
+		cv::Mat image(config.image_size, CV_8UC3, cv::Scalar(b, g, r));
+		if (!cv::imwrite(filename, image)) {
+			std::cout << utils::getBashColorText("[Error] Failed to write " + filename, 'r', 'b') << std::endl;
+			return -1;
+		}
+		generateDrawer(rng, config, drawers[name]);
+	}
+	
+	std::string yaml_file = results_dir + "/polygon_drawer.yaml";
+	if (!annotation_io::saveYaml(yaml_file, APPNAME, drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to write " + yaml_file, 'r', 'b') << std::endl;
+		return -1;
+	}
+	double ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	std::cout << utils::getBashColorText(cv::format("[Ok] Generated %d images with %d polygons each in %.1f ms: ",
+		config.images, config.polygons, ms) + positional[0], 'g', 'b') << std::endl;
+	return 0;
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile(const std::vector<double> &sorted, double q) {
+	if (sorted.empty()) return 0.0;
+	size_t rank = size_t(std::ceil(q * sorted.size()));
+	return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+// One untimed warm-up call, then 'samples' timed calls. 'prepare' runs before each call outside the timing
+BenchResult measure(const std::string &name, const std::string &unit, int samples,
+	const std::function<void()> &prepare, const std::function<void()> &body) {
+	double scale = (unit == "us" ? 1e6 : 1e3) / cv::getTickFrequency();
+	BenchResult result;
+	result.name = name;
+	result.unit = unit;
+	result.samples.reserve(samples);
+	prepare();
+	body();
+	for (int i=0; i<samples; i++) {
+		prepare();
+		int64 t0 = cv::getTickCount();
+		body();
+		result.samples.push_back((cv::getTickCount() - t0) * scale);
+	}
+	return result;
+}
+
+std::string formatResults(const BenchConfig &config, const std::vector<BenchResult> &results) {
+	std::stringstream ss;
+	ss << "{\n\"config\": {\"images\": " << config.images << ", \"polygons\": " << config.polygons << ", \"vertices\": " << config.vertices
+		<< ", \"image_size\": [" << config.image_size.width << ", " << config.image_size.height << "], \"repeat\": " << config.repeat
+		<< ", \"threads\": " << config.threads << ", \"seed\": " << config.seed
+		<< ", \"build_type\": \"" << POLYGON_DRAWER_BUILD_TYPE << "\"},\n\"benchmarks\": [";
+	for (size_t i=0; i<results.size(); i++) {
+		std::vector<double> sorted = results[i].samples;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (size_t k=0; k<sorted.size(); k++) sum += sorted[k];
+		ss << (i > 0 ? ",\n" : "\n") << cv::format("  {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %d, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+			results[i].name.c_str(), results[i].unit.c_str(), int(sorted.size()), sorted.empty() ? 0.0 : sorted.front(),
+			sorted.empty() ? 0.0 : sum / sorted.size(), percentile(sorted, 0.5), percentile(sorted, 0.9), percentile(sorted, 0.99),
+			sorted.empty() ? 0.0 : sorted.back());
+	}
+	ss << "\n]\n}\n";
+	return ss.str();
+}
+
+// Medians of an earlier report, keyed by benchmark name; the report is JSON and thus valid YAML
+std::map<std::string, double> loadBaseline(const std::string &filename) {
+	std::map<std::string, double> medians;
+	try {
+		YAML::Node root = YAML::LoadFile(filename);
+		for (size_t i=0; i<root["benchmarks"].size(); i++) {
+			YAML::Node item = root["benchmarks"][i];
+			medians[item["name"].as<std::string>()] = item["p50"].as<double>();
+		}
+	} catch (const std::exception &e) {
+		std::cout << utils::getBashColorText("[Warning] Failed to read the baseline " + filename + ": " + e.what(), 'y', 'b') << std::endl;
+	}
+	return medians;
+}
+
+int run(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	BenchConfig config;
+	if (!parseOptions(args, positional, options) || !parseConfig(options, config)) return -1;
+	
+	std::string data_dir = option(options, "data", "");
+	if (data_dir.empty()) {
+		data_dir = "bench_data";
+		std::vector<std::string> generate_args(args);
+		generate_args.insert(generate_args.begin(), data_dir);
+		if (generate(generate_args) != 0) return -1;
+	}
+	std::string image_dir = data_dir + "/images";
+	std::string yaml_file = data_dir + "/results/polygon_drawer.yaml";
+	std::string binary_file = data_dir + "/results/polygon_drawer.bin";
+	std::string scratch_yaml = data_dir + "/results/bench_save.yaml";
+	std::string scratch_binary = data_dir + "/results/bench_save.bin";
+	std::string filter = option(options, "filter", "");
+	
+	DrawerMap drawers;
+	if (!annotation_io::loadYaml(yaml_file, drawers) || drawers.empty()) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + yaml_file, 'r', 'b') << std::endl;
+		return -1;
+	}
+	if (!AnnotationBinary::save(binary_file, drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to write " + binary_file, 'r', 'b') << std::endl;
+		return -1;
+	}
+	// Sizes in the report describe the dataset actually measured
+	MyPolygonDrawer &first = drawers.begin()->second;
+	config.images = int(drawers.size());
+	config.polygons = int(first.getPolygons().size());
+	config.vertices = first.getPolygons().size() > 0 ? int((*first.getPolygons().begin()).size()) : 0;
+	config.image_size = first.getImageSize();
+	
+	std::vector<BenchResult> results;
+	std::mt19937 rng(config.seed);
+	std::uniform_int_distribution<int> px(0, config.image_size.width - 1), py(0, config.image_size.height - 1);
+	int calls = config.repeat * 20;
+	cv::Mat canvas;
+	cv::Point pt;
+	std::string text;
+	auto wanted = [&](const std::string &name) { return filter.empty() || name.find(filter) != std::string::npos; };
+	auto nothing = []() {};
+	
+	// Micro benchmarks on a single image
+	if (wanted("draw")) {
+		results.push_back(measure("draw", "ms", config.repeat,
+			[&]() { canvas = cv::Mat::zeros(config.image_size, CV_8UC3); },
+			[&]() { first.draw(canvas); }));
+	}
+	if (wanted("mouse_select")) {
+		// The vertex grid is built by the warm-up call, as it would be by the first click
+		results.push_back(measure("mouse_select", "us", calls,
+			[&]() { first.mouseRelease(); pt = cv::Point(px(rng), py(rng)); },
+			[&]() { first.mouseSelectPoint(pt); }));
+	}
+	if (wanted("text_info")) {
+		results.push_back(measure("text_info", "us", calls, nothing, [&]() { text = first.getTextInfo(); }));
+	}
+	
+	// Macro benchmarks on the whole dataset, the steps of the editor's start-up and exit
+	DrawerMap loaded;
+	if (wanted("load_yaml")) {
+		results.push_back(measure("load_yaml", "ms", config.repeat,
+			[&]() { loaded.clear(); },
+			[&]() { annotation_io::loadYaml(yaml_file, loaded); }));
+	}
+	if (wanted("load_binary")) {
+		results.push_back(measure("load_binary", "ms", config.repeat,
+			[&]() { loaded.clear(); },
+			[&]() { AnnotationBinary binary; binary.open(binary_file); binary.loadAll(loaded); }));
+	}
+	if (wanted("save_yaml")) {
+		results.push_back(measure("save_yaml", "ms", config.repeat, nothing,
+			[&]() { annotation_io::saveYaml(scratch_yaml, APPNAME, drawers); }));
+	}
+	if (wanted("save_binary")) {
+		results.push_back(measure("save_binary", "ms", config.repeat, nothing,
+			[&]() { AnnotationBinary::save(scratch_binary, drawers); }));
+	}
+	if (wanted("scan")) {
+		std::vector<LabelImageInfo> images;
+		results.push_back(measure("scan", "ms", config.repeat, nothing,
+			[&]() { ImageScanner scanner(config.threads, true); scanner.scan(image_dir, images); }));
+	}
+	boost::system::error_code ec;
+	boost::filesystem::remove(scratch_yaml, ec);
+	boost::filesystem::remove(scratch_binary, ec);
+	
+	std::map<std::string, double> baseline;
+	if (options.count("baseline") > 0) {
+		baseline = loadBaseline(options["baseline"]);
+	}
+	std::cout << cv::format("\n%-14s %8s %10s %10s %10s %10s", "benchmark", "samples", "p50", "p90", "p99", "vs base") << std::endl;
+	for (size_t i=0; i<results.size(); i++) {
+		std::vector<double> sorted = results[i].samples;
+		std::sort(sorted.begin(), sorted.end());
+		double p50 = percentile(sorted, 0.5);
+		std::string change = "";
+		if (baseline.count(results[i].name) > 0 && baseline[results[i].name] > 0.0) {
+			change = cv::format("%+.1f%%", 100.0 * (p50 / baseline[results[i].name] - 1.0));
+		}
+		std::cout << cv::format("%-14s %8d %7.3f %-2s %7.3f %-2s %7.3f %-2s %10s", results[i].name.c_str(), int(sorted.size()),
+			p50, results[i].unit.c_str(), percentile(sorted, 0.9), results[i].unit.c_str(),
+			percentile(sorted, 0.99), results[i].unit.c_str(), change.c_str()) << std::endl;
+	}
+	
+	std::string output = option(options, "output", "");
+	if (!output.empty()) {
+		if (!utils::writeFileAtomic(output, formatResults(config, results))) {
+			std::cout << utils::getBashColorText("[Error] Failed to write " + output, 'r', 'b') << std::endl;
+			return -1;
+		}
+		std::cout << utils::getBashColorText("[Ok] Wrote " + output, 'g', 'b') << std::endl;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printUsage(argv[0]);
+		return -1;
+	}
+	
+	std::string command = argv[1];
+	std::vector<std::string> args(argv + 2, argv + argc);
+	
+	if (command == "generate") {
+		return generate(args);
+	} else if (command == "run") {
+		return run(args);
+	}
+	
+	std::cout << utils::getBashColorText("[Error] Unknown command: " + command, 'r', 'b') << std::endl;
+	printUsage(argv[0]);
+	return -1;
+}
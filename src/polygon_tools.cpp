@@ -0,0 +1,744 @@
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <cstdlib>
+#include <mutex>
+#include <ctime>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+#include <polygon_drawer/annotation_io.h>
+#include <polygon_drawer/annotation_binary.h>
+#include <polygon_drawer/annotation_diff.h>
+#include <polygon_drawer/annotation_index.h>
+#include <polygon_drawer/annotation_validator.h>
+#include <polygon_drawer/async_writer.h>
+#include <polygon_drawer/dataset_export.h>
+#include <polygon_drawer/image_scanner.h>
+#include <polygon_drawer/mask_importer.h>
+#include <polygon_drawer/mask_rasterizer.h>
+#include <polygon_drawer/thread_pool.h>
+
+#include "utils.h"
+
+// Offline tools working on results_dir/polygon_drawer.{yaml,bin}, no window is opened
+
+const std::string APPNAME = "polygon_drawer";
+
+void printUsage(const char *program) {
+	std::cout << "Usage: " << program << " <command> [args]" << std::endl;
+	std::cout << "  convert <input> <output>   convert between .yaml and .bin annotation files" << std::endl;
+	std::cout << "  merge <results_dir> [--threads n] [--clean true]" << std::endl;
+	std::cout << "                             combine the results of 'polygon_drawer --worker k/n' into polygon_drawer.yaml," << std::endl;
+	std::cout << "                             then move the worker files to workers/merged, or remove them with --clean" << std::endl;
+	std::cout << "  masks <input> <out_dir> [--kinds binary,instance,class] [--classes file] [--threads n] [--overlay source_image_dir]" << std::endl;
+	std::cout << "                             write PNG masks for every annotated image" << std::endl;
+	std::cout << "  import-masks <mask_dir> <output> [--kind binary|instance|class] [--classes file] [--tolerance px] [--min-area px] [--label name] [--image-ext .jpg] [--threads n]" << std::endl;
+	std::cout << "                             trace the regions of PNG masks into simplified polygons" << std::endl;
+	std::cout << "  export <input> <output> --format coco|yolo [--classes file] [--threads n] [--batch n]" << std::endl;
+	std::cout << "                             COCO: one JSON file, YOLO-seg: a directory of per-image .txt files" << std::endl;
+	std::cout << "  validate <input> [--images source_image_dir] [--report file.json] [--min-area px] [--threads n]" << std::endl;
+	std::cout << "                             report broken polygons and dataset statistics, exits with 1 on issues" << std::endl;
+	std::cout << "  diff <left> <right> [--min-iou 0.5] [--report file.json] [--threads n]" << std::endl;
+	std::cout << "                             per-image and per-label IoU and the added, removed and moved polygons, exits with 1 on differences" << std::endl;
+	std::cout << "  query <input> [--label name] [--state labeled|unlabeled] [--polygons 0|1|2-9|10+] [--images dir] [--output file]" << std::endl;
+	std::cout << "                             list the images that match, or the labels and polygon counts without a filter; exits with 1 on no match" << std::endl;
+}
+
+// Splits "--key value" pairs from positional arguments
+bool parseOptions(const std::vector<std::string> &args, std::vector<std::string> &positional, std::map<std::string, std::string> &options) {
+	for (size_t i=0; i<args.size(); i++) {
+		if (args[i].compare(0, 2, "--") == 0) {
+			if (i + 1 >= args.size()) {
+				std::cout << utils::getBashColorText("[Error] Missing value for " + args[i], 'r', 'b') << std::endl;
+				return false;
+			}
+			options[args[i].substr(2)] = args[i + 1];
+			i++;
+		} else {
+			positional.push_back(args[i]);
+		}
+	}
+	return true;
+}
+
+std::string option(const std::map<std::string, std::string> &options, const std::string &key, const std::string &fallback) {
+	std::map<std::string, std::string>::const_iterator it = options.find(key);
+	return (it != options.end()) ? it->second : fallback;
+}
+
+bool isBinaryFile(const std::string &filename) {
+	return boost::filesystem::path(filename).extension() == ".bin";
+}
+
+bool loadAnnotations(const std::string &filename, DrawerMap &drawers) {
+	if (isBinaryFile(filename)) {
+		AnnotationBinary binary;
+		if (!binary.open(filename)) return false;
+		binary.loadAll(drawers);
+		return true;
+	}
+	return annotation_io::loadYaml(filename, drawers);
+}
+
+bool saveAnnotations(const std::string &filename, DrawerMap &drawers) {
+	if (isBinaryFile(filename)) {
+		return AnnotationBinary::save(filename, drawers);
+	}
+	return annotation_io::saveYaml(filename, APPNAME, drawers);
+}
+
+int convert(const std::vector<std::string> &args) {
+	if (args.size() != 2) {
+		std::cout << utils::getBashColorText("[Error] convert expects <input> <output>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	DrawerMap drawers;
+	int64 t0 = cv::getTickCount();
+	if (!loadAnnotations(args[0], drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + args[0], 'r', 'b') << std::endl;
+		return -1;
+	}
+	double load_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	t0 = cv::getTickCount();
+	if (!saveAnnotations(args[1], drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to write " + args[1], 'r', 'b') << std::endl;
+		return -1;
+	}
+	double save_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	std::cout << utils::getBashColorText(cv::format("[Ok] Converted %d images (read %.1f ms, write %.1f ms): ",
+		int(drawers.size()), load_ms, save_ms) + args[1], 'g', 'b') << std::endl;
+	return 0;
+}
+
+// Loads the annotations and the class list given by --classes, or collects the labels in use
+bool loadWithClasses(const std::string &filename, std::map<std::string, std::string> &options, DrawerMap &drawers, annotation_io::ClassMap &classes) {
+	if (!loadAnnotations(filename, drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + filename, 'r', 'b') << std::endl;
+		return false;
+	}
+	if (options.count("classes") > 0) {
+		if (!annotation_io::loadClasses(options["classes"], classes)) {
+			std::cout << utils::getBashColorText("[Error] Failed to read " + options["classes"], 'r', 'b') << std::endl;
+			return false;
+		}
+	} else {
+		classes = annotation_io::collectClasses(drawers);
+	}
+	return true;
+}
+
+// <out_dir>/<kind>/<image name>.png, image names may contain sub-directories
+std::string maskPath(const std::string &out_dir, const std::string &kind, const std::string &name, const std::string &ext = ".png") {
+	return (boost::filesystem::path(out_dir) / kind / boost::filesystem::path(name).replace_extension(ext)).string();
+}
+
+// One worker's results: its file and the autosave shards it left behind
+struct WorkerResults {
+	std::string filename;
+	std::string shard_dir;
+	int64_t mtime_ns;
+	uint64_t size;
+	DrawerMap drawers;
+	bool ok;
+};
+
+// To the nanosecond, so that a worker saving again in the same second still counts as a change
+bool statWorkerFile(const std::string &filename, int64_t &mtime_ns, uint64_t &size) {
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return false;
+	mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+	size = uint64_t(st.st_size);
+	return true;
+}
+
+int merge(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 1) {
+		std::cout << utils::getBashColorText("[Error] merge expects <results_dir>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	std::string results_dir = positional[0];
+	std::string output = results_dir + "/polygon_drawer.yaml";
+	std::string binary_output = results_dir + "/polygon_drawer.bin";
+	
+	// Held until both files are written, so an editor saving the same results_dir waits for it
+	utils::FileLock lock(annotation_io::lockPath(results_dir));
+	if (!lock.locked()) {
+		std::cout << utils::getBashColorText("[Error] Failed to lock " + annotation_io::lockPath(results_dir), 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	std::vector<WorkerResults> workers;
+	boost::system::error_code ec;
+	boost::filesystem::directory_iterator it(annotation_io::workerDir(results_dir), ec), end;
+	for (; !ec && it != end; it.increment(ec)) {
+		boost::filesystem::path path = it->path();
+		if (path.extension() != ".yaml" || !boost::filesystem::is_regular_file(path)) continue;
+		WorkerResults worker;
+		worker.filename = path.string();
+		worker.shard_dir = (path.parent_path() / path.stem()).string();
+		worker.ok = false;
+		if (!statWorkerFile(worker.filename, worker.mtime_ns, worker.size)) continue;
+		workers.push_back(worker);
+	}
+	if (workers.empty()) {
+		std::cout << utils::getBashColorText("[Warning] No worker results in " + annotation_io::workerDir(results_dir), 'y', 'b') << std::endl;
+		return 0;
+	}
+	// Images only move between workers when n changes; then the newer file wins
+	std::sort(workers.begin(), workers.end(), [](const WorkerResults &a, const WorkerResults &b) {
+		return a.mtime_ns < b.mtime_ns || (a.mtime_ns == b.mtime_ns && a.filename < b.filename);
+	});
+	
+	// The combined file and every worker are parsed at the same time, index 0 is the combined file
+	DrawerMap drawers;
+	bool base_ok = true;
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	int64 t0 = cv::getTickCount();
+	pool.parallelFor(workers.size() + 1, [&](size_t i) {
+		if (i == 0) {
+			if (boost::filesystem::exists(output)) base_ok = annotation_io::loadYaml(output, drawers);
+			return;
+		}
+		WorkerResults &worker = workers[i - 1];
+		worker.ok = annotation_io::loadYaml(worker.filename, worker.drawers);
+		// Shards are newer than the worker file, e.g. after a crash
+		annotation_io::loadShards(worker.shard_dir, worker.drawers);
+	});
+	double load_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	if (!base_ok) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + output, 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	std::map<std::string, size_t> owner;
+	int n_images = 0, n_conflicts = 0;
+	for (size_t w=0; w<workers.size(); w++) {
+		if (!workers[w].ok) {
+			std::cout << utils::getBashColorText("[Error] Failed to read " + workers[w].filename, 'r', 'b') << std::endl;
+			return -1;
+		}
+		for (DrawerMap::iterator it = workers[w].drawers.begin(); it != workers[w].drawers.end(); it++) {
+			std::map<std::string, size_t>::iterator previous = owner.find(it->first);
+			if (previous != owner.end()) {
+				std::cout << utils::getBashColorText("[Warning] " + it->first + " is in " + workers[previous->second].filename + 
+					" and the newer " + workers[w].filename, 'y', 'b') << std::endl;
+				n_conflicts++;
+			}
+			owner[it->first] = w;
+			drawers[it->first] = it->second;
+			n_images++;
+		}
+	}
+	
+	if (!annotation_io::saveYaml(output, APPNAME, drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to write " + output, 'r', 'b') << std::endl;
+		return -1;
+	}
+	// After the YAML, the editor uses the binary file while it is at least as new
+	if (!AnnotationBinary::save(binary_output, drawers)) {
+		std::cout << utils::getBashColorText("[Warning] Failed to write " + binary_output, 'y', 'b') << std::endl;
+	}
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	// Merged worker files are moved out of the way, so that a later merge does not apply them
+	// again over newer edits; a worker that saved while this ran keeps its file for the next merge
+	bool clean = option(options, "clean", "false") == "true";
+	std::string merged_dir = annotation_io::workerDir(results_dir) + "/merged";
+	int n_kept = 0;
+	if (!clean) boost::filesystem::create_directories(merged_dir, ec);
+	for (size_t w=0; w<workers.size(); w++) {
+		boost::filesystem::path path(workers[w].filename);
+		int64_t mtime_ns = 0;
+		uint64_t size = 0;
+		if (!statWorkerFile(workers[w].filename, mtime_ns, size) || mtime_ns != workers[w].mtime_ns || size != workers[w].size) {
+			std::cout << utils::getBashColorText("[Warning] " + workers[w].filename + " changed during the merge, kept for the next one", 'y', 'b') << std::endl;
+			n_kept++;
+			continue;
+		}
+		if (clean) {
+			boost::filesystem::remove(path, ec);
+			boost::filesystem::remove_all(workers[w].shard_dir, ec);
+			continue;
+		}
+		boost::filesystem::path target = boost::filesystem::path(merged_dir) / path.filename();
+		boost::filesystem::path shard_target = boost::filesystem::path(merged_dir) / path.stem();
+		boost::filesystem::remove_all(shard_target, ec);
+		boost::filesystem::rename(path, target, ec);
+		if (ec) {
+			std::cout << utils::getBashColorText("[Error] Failed to move " + workers[w].filename + " to " + merged_dir + ", remove it before the next merge", 'r', 'b') << std::endl;
+			n_kept++;
+			continue;
+		}
+		if (boost::filesystem::exists(workers[w].shard_dir)) {
+			boost::filesystem::rename(workers[w].shard_dir, shard_target, ec);
+		}
+	}
+	std::cout << utils::getBashColorText(cv::format("[Ok] Merged %d images from %d workers into %d images in %.1f ms (read %.1f ms, %d threads): ", 
+		n_images, int(workers.size()), int(drawers.size()), elapsed_ms, load_ms, pool.size()) + output, 'g', 'b') << std::endl;
+	if (n_kept < int(workers.size())) {
+		std::cout << cv::format(" %s %d worker files", clean ? "Removed" : "Moved", int(workers.size()) - n_kept) << (clean ? "" : " to " + merged_dir) << std::endl;
+	}
+	if (n_conflicts > 0) {
+		std::cout << utils::getBashColorText(cv::format("[Warning] %d images were in more than one worker, kept the newest", n_conflicts), 'y', 'b') << std::endl;
+	}
+	return 0;
+}
+
+int masks(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 2) {
+		std::cout << utils::getBashColorText("[Error] masks expects <input> <out_dir>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	std::string out_dir = positional[1];
+	
+	int kinds = 0;
+	std::stringstream kinds_ss(option(options, "kinds", "binary,instance,class"));
+	std::string kind;
+	while (std::getline(kinds_ss, kind, ',')) {
+		if (kind == "binary") kinds |= MaskRasterizer::BINARY;
+		else if (kind == "instance") kinds |= MaskRasterizer::INSTANCE;
+		else if (kind == "class") kinds |= MaskRasterizer::CLASS;
+		else {
+			std::cout << utils::getBashColorText("[Error] Unknown mask kind: " + kind, 'r', 'b') << std::endl;
+			return -1;
+		}
+	}
+	
+	DrawerMap drawers;
+	annotation_io::ClassMap classes;
+	if (!loadWithClasses(positional[0], options, drawers, classes)) {
+		return -1;
+	}
+	MaskRasterizer rasterizer(classes);
+	
+	// Source images are only decoded for the optional overlays; masks need nothing but w/h
+	std::string overlay_dir = option(options, "overlay", "");
+	
+	std::vector<DrawerMap::iterator> items;
+	for (DrawerMap::iterator it = drawers.begin(); it != drawers.end(); it++) {
+		items.push_back(it);
+	}
+	
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	AsyncWriter writer(4 * pool.size());
+	std::mutex log_mutex;
+	int n_polygons = 0, n_skipped = 0;
+	
+	int64 t0 = cv::getTickCount();
+	pool.parallelFor(items.size(), [&](size_t i) {
+		const std::string &name = items[i]->first;
+		MyPolygonDrawer &drawer = items[i]->second;
+		
+		cv::Mat binary, instance, class_mask;
+		int n = rasterizer.rasterize(drawer, kinds, binary, instance, class_mask);
+		if (n < 0) {
+			std::lock_guard<std::mutex> lock(log_mutex);
+			std::cout << utils::getBashColorText("[Warning] Unknown image size, skipped " + name, 'y', 'b') << std::endl;
+			n_skipped++;
+			return;
+		}
+		
+		// Encoding runs on the pool, the writer thread only touches the disk
+		std::vector<unsigned char> buffer;
+		if (kinds & MaskRasterizer::BINARY) {
+			cv::imencode(".png", binary, buffer);
+			writer.write(maskPath(out_dir, "binary", name), buffer);
+		}
+		if (kinds & MaskRasterizer::INSTANCE) {
+			cv::imencode(".png", instance, buffer);
+			writer.write(maskPath(out_dir, "instance", name), buffer);
+		}
+		if (kinds & MaskRasterizer::CLASS) {
+			cv::imencode(".png", class_mask, buffer);
+			writer.write(maskPath(out_dir, "class", name), buffer);
+		}
+		
+		if (!overlay_dir.empty()) {
+			cv::Mat image = cv::imread(overlay_dir + "/" + name);
+			if (!image.empty() && image.size() == drawer.getImageSize()) {
+				cv::Mat colored = image.clone();
+				std::vector<std::vector<cv::Point> > contour(1);
+				const PolygonStore &polygons = drawer.getPolygons();
+				for (PolygonStore::const_iterator it = polygons.begin(); it != polygons.end(); ++it) {
+					int c = rasterizer.classOf((*it).id());
+					MaskRasterizer::toPixels(*it, image.size(), contour[0]);
+					cv::fillPoly(colored, contour, cv::Scalar((c * 67) % 256, (c * 151) % 256, (c * 229) % 256));
+				}
+				cv::addWeighted(image, 0.5, colored, 0.5, 0.0, image);
+				cv::imencode(".jpg", image, buffer);
+				writer.write(maskPath(out_dir, "overlay", name, ".jpg"), buffer);
+			} else {
+				std::lock_guard<std::mutex> lock(log_mutex);
+				std::cout << utils::getBashColorText("[Warning] No matching source image for overlay: " + name, 'y', 'b') << std::endl;
+			}
+		}
+		
+		std::lock_guard<std::mutex> lock(log_mutex);
+		n_polygons += n;
+	});
+	
+	std::vector<unsigned char> class_list;
+	std::string class_text = annotation_io::formatClasses(classes);
+	class_list.assign(class_text.begin(), class_text.end());
+	writer.write((boost::filesystem::path(out_dir) / "classes.txt").string(), class_list);
+	int failures = writer.finish();
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	int n_images = int(items.size()) - n_skipped;
+	std::cout << utils::getBashColorText(cv::format("[Ok] Rasterized %d images, %d polygons in %.1f ms (%.0f images/s, %d threads), wrote %d files, %.1f MB: ", 
+		n_images, n_polygons, elapsed_ms, n_images * 1000.0 / std::max(elapsed_ms, 1e-3), pool.size(), 
+		int(writer.written()), writer.bytes() / (1024.0 * 1024.0)) + out_dir, 'g', 'b') << std::endl;
+	return failures == 0 ? 0 : -1;
+}
+
+int importMasks(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 2) {
+		std::cout << utils::getBashColorText("[Error] import-masks expects <mask_dir> <output>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	boost::filesystem::path mask_dir(positional[0]);
+	int kind = MaskImporter::kindOf(option(options, "kind", "binary"));
+	if (kind == 0) {
+		std::cout << utils::getBashColorText("[Error] Unknown mask kind: " + option(options, "kind", ""), 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	// Class names from --classes, or from the classes.txt that 'masks' writes next to the masks
+	annotation_io::ClassMap classes;
+	std::string classes_file = option(options, "classes", (mask_dir / "classes.txt").string());
+	if (kind == MaskImporter::CLASS && boost::filesystem::exists(classes_file) && !annotation_io::loadClasses(classes_file, classes)) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + classes_file, 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	// Image names are the mask paths relative to mask_dir with the image extension
+	std::vector<std::string> files, names;
+	std::string image_ext = option(options, "image-ext", ".jpg");
+	boost::system::error_code ec;
+	for (boost::filesystem::recursive_directory_iterator it(mask_dir, ec), end; it != end; it.increment(ec)) {
+		if (ec || !boost::filesystem::is_regular_file(it->path()) || it->path().extension() != ".png") continue;
+		std::string relative = it->path().string().substr(mask_dir.string().size());
+		while (!relative.empty() && relative[0] == '/') relative.erase(0, 1);
+		files.push_back(it->path().string());
+		names.push_back(boost::filesystem::path(relative).replace_extension(image_ext).string());
+	}
+	if (files.empty()) {
+		std::cout << utils::getBashColorText("[Error] No .png masks in " + positional[0], 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	std::vector<MyPolygonDrawer> results(files.size());
+	std::vector<int> counts(files.size(), -1);
+	std::mutex log_mutex;
+	size_t traced = 0;
+	
+	int64 t0 = cv::getTickCount();
+	pool.parallelFor(files.size(), [&](size_t i) {
+		// One importer per mask; the class table is small
+		MaskImporter importer(classes, atof(option(options, "tolerance", "1.0").c_str()), 
+			atof(option(options, "min-area", "4.0").c_str()), option(options, "label", "object"));
+		cv::Mat mask = cv::imread(files[i], cv::IMREAD_UNCHANGED);
+		counts[i] = importer.import(mask, kind, results[i]);
+		
+		std::lock_guard<std::mutex> lock(log_mutex);
+		traced += importer.tracedVertices();
+		if (counts[i] < 0) {
+			std::cout << utils::getBashColorText("[Warning] Not a single-channel mask, skipped " + files[i], 'y', 'b') << std::endl;
+		}
+	});
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	DrawerMap drawers;
+	int n_images = 0, n_polygons = 0;
+	size_t kept = 0;
+	for (size_t i=0; i<files.size(); i++) {
+		if (counts[i] < 0) continue;
+		n_images++;
+		n_polygons += counts[i];
+		kept += results[i].getPolygons().vertexCount();
+		drawers[names[i]] = results[i];
+	}
+	
+	if (!saveAnnotations(positional[1], drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to write " + positional[1], 'r', 'b') << std::endl;
+		return -1;
+	}
+	std::cout << utils::getBashColorText(cv::format("[Ok] Imported %d masks, %d polygons in %.1f ms (%.0f masks/s, %d threads), kept %d of %d traced vertices: ", 
+		n_images, n_polygons, elapsed_ms, n_images * 1000.0 / std::max(elapsed_ms, 1e-3), pool.size(), int(kept), int(traced)) + positional[1], 'g', 'b') << std::endl;
+	return 0;
+}
+
+int exportDataset(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 2) {
+		std::cout << utils::getBashColorText("[Error] export expects <input> <output> --format coco|yolo", 'r', 'b') << std::endl;
+		return -1;
+	}
+	std::string format = option(options, "format", "coco");
+	if (format != "coco" && format != "yolo") {
+		std::cout << utils::getBashColorText("[Error] Unknown export format: " + format, 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	DrawerMap drawers;
+	annotation_io::ClassMap classes;
+	if (!loadWithClasses(positional[0], options, drawers, classes)) {
+		return -1;
+	}
+	
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	DatasetExporter exporter(pool, classes, std::max(atoi(option(options, "batch", "256").c_str()), 1));
+	
+	int64 t0 = cv::getTickCount();
+	bool ok = (format == "coco") ? exporter.writeCoco(drawers, positional[1]) : exporter.writeYolo(drawers, positional[1]);
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	if (!ok) {
+		std::cout << utils::getBashColorText("[Error] Failed to export " + positional[1], 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	std::cout << utils::getBashColorText(cv::format("[Ok] Exported %d images, %d polygons as %s in %.1f ms (%.0f polygons/s, %d threads): ", 
+		int(exporter.images()), int(exporter.polygons()), format.c_str(), elapsed_ms, 
+		exporter.polygons() * 1000.0 / std::max(elapsed_ms, 1e-3), pool.size()) + positional[1], 'g', 'b') << std::endl;
+	if (exporter.skipped() > 0) {
+		std::cout << utils::getBashColorText(cv::format("[Warning] Skipped %d polygons with fewer than 3 vertices or no class", int(exporter.skipped())), 'y', 'b') << std::endl;
+	}
+	return 0;
+}
+
+int validate(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 1) {
+		std::cout << utils::getBashColorText("[Error] validate expects <input>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	DrawerMap drawers;
+	if (!loadAnnotations(positional[0], drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + positional[0], 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	AnnotationValidator validator(pool, atof(option(options, "min-area", "1.0").c_str()));
+	
+	int64 t0 = cv::getTickCount();
+	validator.run(drawers, option(options, "images", ""));
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	std::cout << cv::format("Checked %d images, %d polygons, %d vertices in %.1f ms (%.0f polygons/s, %d threads)", 
+		int(validator.images()), int(validator.polygons()), int(validator.vertices()), elapsed_ms, 
+		validator.polygons() * 1000.0 / std::max(elapsed_ms, 1e-3), pool.size()) << std::endl;
+	for (int t=0; t<AnnotationValidator::NUM_ISSUE_TYPES; t++) {
+		size_t n = validator.count(t);
+		std::string line = cv::format(" |-- %-18s %d", AnnotationValidator::issueName(t), int(n));
+		std::cout << (n > 0 ? utils::getBashColorText(line, 'y', 'b') : line) << std::endl;
+	}
+	
+	if (options.count("report") > 0) {
+		if (!utils::writeFileAtomic(options["report"], validator.formatReport())) {
+			std::cout << utils::getBashColorText("[Error] Failed to write " + options["report"], 'r', 'b') << std::endl;
+			return -1;
+		}
+		std::cout << utils::getBashColorText("[Ok] Saved validation report: " + options["report"], 'g', 'b') << std::endl;
+	}
+	return validator.issues().empty() ? 0 : 1;
+}
+
+int diff(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 2) {
+		std::cout << utils::getBashColorText("[Error] diff expects <left> <right>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	ThreadPool pool(atoi(option(options, "threads", "0").c_str()));
+	
+	// Both sides are parsed at the same time
+	DrawerMap drawers[2];
+	bool loaded[2];
+	pool.parallelFor(2, [&](size_t i) {
+		loaded[i] = loadAnnotations(positional[i], drawers[i]);
+	});
+	for (int i=0; i<2; i++) {
+		if (!loaded[i]) {
+			std::cout << utils::getBashColorText("[Error] Failed to read " + positional[i], 'r', 'b') << std::endl;
+			return -1;
+		}
+	}
+	
+	AnnotationDiff differ(pool, atof(option(options, "min-iou", "0.5").c_str()));
+	int64 t0 = cv::getTickCount();
+	differ.run(drawers[0], drawers[1]);
+	double elapsed_ms = (cv::getTickCount() - t0) * 1000.0 / cv::getTickFrequency();
+	
+	std::cout << cv::format("Compared %d images in %.1f ms (%.0f images/s, %d threads), %d only left, %d only right", 
+		int(differ.images().size()), elapsed_ms, differ.images().size() * 1000.0 / std::max(elapsed_ms, 1e-3), pool.size(),
+		int(differ.onlyLeft()), int(differ.onlyRight())) << std::endl;
+	std::cout << cv::format(" |-- %-18s %.4f (mean per image %.4f)", "iou", differ.overlap().iou(), differ.meanImageIou()) << std::endl;
+	std::cout << cv::format(" |-- %-18s %d", "unchanged", int(differ.unchanged())) << std::endl;
+	size_t changed = 0;
+	for (int t=0; t<AnnotationDiff::NUM_CHANGE_TYPES; t++) {
+		size_t n = differ.count(t);
+		changed += n;
+		std::string line = cv::format(" |-- %-18s %d", AnnotationDiff::changeName(t), int(n));
+		std::cout << (n > 0 ? utils::getBashColorText(line, 'y', 'b') : line) << std::endl;
+	}
+	const std::map<std::string, AnnotationDiff::Overlap> &labels = differ.labels();
+	for (std::map<std::string, AnnotationDiff::Overlap>::const_iterator it = labels.begin(); it != labels.end(); it++) {
+		std::cout << cv::format(" |-- label %-12s iou %.4f", it->first.c_str(), it->second.iou()) << std::endl;
+	}
+	
+	if (options.count("report") > 0) {
+		if (!utils::writeFileAtomic(options["report"], differ.formatReport())) {
+			std::cout << utils::getBashColorText("[Error] Failed to write " + options["report"], 'r', 'b') << std::endl;
+			return -1;
+		}
+		std::cout << utils::getBashColorText("[Ok] Saved diff report: " + options["report"], 'g', 'b') << std::endl;
+	}
+	return changed == 0 ? 0 : 1;
+}
+
+int query(const std::vector<std::string> &args) {
+	std::vector<std::string> positional;
+	std::map<std::string, std::string> options;
+	if (!parseOptions(args, positional, options) || positional.size() != 1) {
+		std::cout << utils::getBashColorText("[Error] query expects <input>", 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	AnnotationIndex::Filter filter;
+	filter.label = option(options, "label", "");
+	std::string state = option(options, "state", "any");
+	if (state == "labeled" || state == "unlabeled") {
+		filter.labeled = (state == "labeled") ? 1 : 0;
+	} else if (state != "any") {
+		std::cout << utils::getBashColorText("[Error] --state expects labeled or unlabeled", 'r', 'b') << std::endl;
+		return -1;
+	}
+	if (options.count("polygons") > 0) {
+		filter.bucket = AnnotationIndex::parseBucket(options["polygons"]);
+		if (filter.bucket < 0) {
+			std::cout << utils::getBashColorText("[Error] --polygons expects 0, 1, 2-9 or 10+", 'r', 'b') << std::endl;
+			return -1;
+		}
+	}
+	
+	DrawerMap drawers;
+	if (!loadAnnotations(positional[0], drawers)) {
+		std::cout << utils::getBashColorText("[Error] Failed to read " + positional[0], 'r', 'b') << std::endl;
+		return -1;
+	}
+	
+	// With the source directory, images nobody annotated yet count as unlabeled and the order is the editor's
+	std::vector<std::string> names;
+	if (options.count("images") > 0) {
+		ImageScanner scanner(atoi(option(options, "threads", "0").c_str()), false);
+		std::vector<LabelImageInfo> images;
+		if (!scanner.scan(options["images"], images)) {
+			std::cout << utils::getBashColorText("[Error] Failed to scan " + options["images"], 'r', 'b') << std::endl;
+			return -1;
+		}
+		for (size_t i=0; i<images.size(); i++) {
+			names.push_back(images[i].name);
+		}
+	} else {
+		for (DrawerMap::iterator it = drawers.begin(); it != drawers.end(); it++) {
+			names.push_back(it->first);
+		}
+	}
+	
+	int64 t0 = cv::getTickCount();
+	AnnotationIndex index;
+	index.reset(names.size());
+	for (size_t i=0; i<names.size(); i++) {
+		DrawerMap::iterator it = drawers.find(names[i]);
+		if (it != drawers.end()) index.update(int(i), it->second.getPolygons());
+	}
+	int64 t1 = cv::getTickCount();
+	std::vector<int> matches = index.select(filter);
+	double build_ms = (t1 - t0) * 1000.0 / cv::getTickFrequency();
+	double query_ms = (cv::getTickCount() - t1) * 1000.0 / cv::getTickFrequency();
+	
+	std::cout << cv::format("Indexed %d images, %d labels in %.1f ms; %d match (%.3f ms)", 
+		int(index.size()), int(index.labels().size()), build_ms, int(matches.size()), query_ms) << std::endl;
+	
+	bool filtered = !filter.label.empty() || filter.labeled >= 0 || filter.bucket >= 0;
+	if (!filtered) {
+		for (int b=0; b<AnnotationIndex::NUM_BUCKETS; b++) {
+			std::cout << cv::format(" |-- %-4s polygons   %d images", AnnotationIndex::bucketName(b), int(index.count(b))) << std::endl;
+		}
+		const std::map<std::string, std::set<int> > &labels = index.labels();
+		for (std::map<std::string, std::set<int> >::const_iterator it = labels.begin(); it != labels.end(); it++) {
+			std::cout << cv::format(" |-- label %-12s %d images", it->first.c_str(), int(it->second.size())) << std::endl;
+		}
+		return matches.empty() ? 1 : 0;
+	}
+	
+	// One name per line, for scripts
+	std::stringstream ss;
+	for (size_t i=0; i<matches.size(); i++) {
+		ss << names[matches[i]] << "\n";
+	}
+	if (options.count("output") > 0) {
+		if (!utils::writeFileAtomic(options["output"], ss.str())) {
+			std::cout << utils::getBashColorText("[Error] Failed to write " + options["output"], 'r', 'b') << std::endl;
+			return -1;
+		}
+		std::cout << utils::getBashColorText("[Ok] Saved the matching images: " + options["output"], 'g', 'b') << std::endl;
+	} else {
+		std::cout << ss.str() << std::flush;
+	}
+	return matches.empty() ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		printUsage(argv[0]);
+		return -1;
+	}
+	
+	std::string command = argv[1];
+	std::vector<std::string> args(argv + 2, argv + argc);
+	
+	if (command == "convert") {
+		return convert(args);
+	} else if (command == "merge") {
+		return merge(args);
+	} else if (command == "masks") {
+		return masks(args);
+	} else if (command == "import-masks") {
+		return importMasks(args);
+	} else if (command == "export") {
+		return exportDataset(args);
+	} else if (command == "validate") {
+		return validate(args);
+	} else if (command == "diff") {
+		return diff(args);
+	} else if (command == "query") {
+		return query(args);
+	}
+	
+	std::cout << utils::getBashColorText("[Error] Unknown command: " + command, 'r', 'b') << std::endl;
+	printUsage(argv[0]);
+	return -1;
+}